@@ -0,0 +1,437 @@
+#include "benchmarks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#define MAX_PATH 4096
+#define FILENAME_FMT "%s/bench%05d"
+
+#define OP_CREATE 0
+#define OP_WRITE 1
+#define OP_READ 2
+#define OP_FSYNC 3
+#define OP_UNLINK 4
+#define OP_COUNT 5
+
+const char* op_names[OP_COUNT] = {"create", "write", "read", "fsync", "unlink"};
+
+struct bench_config {
+    const char* dir;
+    int file_count;
+    long file_size;
+    int io_size;
+    // percentage of mixed phase operations that are reads
+    int read_percent;
+    // fsync a file after every this many writes to it, 0 for never
+    int fsync_every;
+    bool random;
+    // mixed phase operations, by default enough to cover every file once
+    long op_count;
+    unsigned seed;
+    bool keep;
+    bool json;
+};
+
+struct phase_result {
+    const char* name;
+    double elapsed;
+    long ops;
+    long bytes;
+};
+
+struct bench_state {
+    struct bench_config* config;
+    char* buffer;
+    int* fds;
+    // next offset of each file for sequential access
+    long* cursors;
+    // writes to each file since it was last synced
+    int* unsynced;
+    unsigned seed;
+    struct latency_histogram latency[OP_COUNT];
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [OPTIONS]\n"
+        "    -d DIR     directory to run in, default .\n"
+        "    -n COUNT   files, default 16\n"
+        "    -s BYTES   file size, default 4M\n"
+        "    -i BYTES   I/O size, default 4K\n"
+        "    -m PERCENT reads in the mixed phase, default 50\n"
+        "    -f N       fsync after every N writes to a file, default never\n"
+        "    -r         random offsets, default sequential\n"
+        "    -o COUNT   mixed phase operations, default COUNT * BYTES / I/O\n"
+        "    -S SEED    random seed, default 1\n"
+        "    -k         keep the files instead of unlinking them\n"
+        "    -j         JSON output\n"
+        "sizes take a K, M or G suffix\n", name);
+}
+
+long parse_size(const char* arg) {
+    char* end;
+    long size = strtol(arg, &end, 10);
+    if(*end == 'K' || *end == 'k') {
+        size *= KB;
+    } else if(*end == 'M' || *end == 'm') {
+        size *= KB * KB;
+    } else if(*end == 'G' || *end == 'g') {
+        size *= KB * KB * KB;
+    } else if(*end != '\0') {
+        return -1;
+    }
+
+    return size;
+}
+
+int parse_args(int argc, char* argv[], struct bench_config* config) {
+    config->dir = ".";
+    config->file_count = 16;
+    config->file_size = 4 * KB * KB;
+    config->io_size = 4 * KB;
+    config->read_percent = 50;
+    config->fsync_every = 0;
+    config->random = false;
+    config->op_count = -1;
+    config->seed = 1;
+    config->keep = false;
+    config->json = false;
+    int opt;
+    while((opt = getopt(argc, argv, "d:n:s:i:m:f:ro:S:kjh")) != -1) {
+        switch(opt) {
+        case 'd':
+            config->dir = optarg;
+            break;
+        case 'n':
+            config->file_count = atoi(optarg);
+            break;
+        case 's':
+            config->file_size = parse_size(optarg);
+            break;
+        case 'i':
+            config->io_size = (int) parse_size(optarg);
+            break;
+        case 'm':
+            config->read_percent = atoi(optarg);
+            break;
+        case 'f':
+            config->fsync_every = atoi(optarg);
+            break;
+        case 'r':
+            config->random = true;
+            break;
+        case 'o':
+            config->op_count = atol(optarg);
+            break;
+        case 'S':
+            config->seed = (unsigned) atoi(optarg);
+            break;
+        case 'k':
+            config->keep = true;
+            break;
+        case 'j':
+            config->json = true;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if(config->file_count <= 0 || config->io_size <= 0
+            || config->file_size < config->io_size
+            || config->read_percent < 0 || config->read_percent > 100
+            || config->fsync_every < 0) {
+        return -1;
+    }
+
+    if(config->op_count < 0) {
+        config->op_count = config->file_count
+                * (config->file_size / config->io_size);
+    }
+
+    return 0;
+}
+
+void file_name(struct bench_config* config, int file, char* name) {
+    snprintf(name, MAX_PATH, FILENAME_FMT, config->dir, file);
+}
+
+// one timed write of io_size bytes, syncing the file when it's due
+int timed_write(struct bench_state* state, int file, long offset) {
+    struct bench_config* config = state->config;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(pwrite(state->fds[file], state->buffer, config->io_size, offset)
+            < config->io_size) {
+        perror("write");
+
+        return -1;
+    }
+    record_latency(&(state->latency[OP_WRITE]), &start);
+
+    state->unsynced[file]++;
+    if(config->fsync_every > 0
+            && state->unsynced[file] >= config->fsync_every) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(fsync(state->fds[file]) == -1) {
+            perror("fsync");
+
+            return -1;
+        }
+        record_latency(&(state->latency[OP_FSYNC]), &start);
+        state->unsynced[file] = 0;
+    }
+
+    return 0;
+}
+
+int timed_read(struct bench_state* state, int file, long offset) {
+    struct bench_config* config = state->config;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(pread(state->fds[file], state->buffer, config->io_size, offset)
+            < config->io_size) {
+        perror("read");
+
+        return -1;
+    }
+    record_latency(&(state->latency[OP_READ]), &start);
+
+    return 0;
+}
+
+// create every file and fill it sequentially
+int setup_phase(struct bench_state* state, struct phase_result* result) {
+    struct bench_config* config = state->config;
+    char name[MAX_PATH];
+    struct timespec start, end, op_start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int file = 0; file < config->file_count; file++) {
+        file_name(config, file, name);
+        clock_gettime(CLOCK_MONOTONIC, &op_start);
+        state->fds[file] = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if(state->fds[file] < 0) {
+            perror(name);
+
+            return -1;
+        }
+        record_latency(&(state->latency[OP_CREATE]), &op_start);
+
+        for(long offset = 0; offset + config->io_size <= config->file_size;
+                offset += config->io_size) {
+            if(timed_write(state, file, offset) == -1) {
+                return -1;
+            }
+
+            result->ops++;
+            result->bytes += config->io_size;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->name = "setup";
+    result->elapsed = elapsed_sec(&start, &end);
+
+    return 0;
+}
+
+// op_count reads and writes of io_size bytes, read_percent of them reads
+int mixed_phase(struct bench_state* state, struct phase_result* result) {
+    struct bench_config* config = state->config;
+    long blocks = config->file_size / config->io_size;
+    int file = 0;
+    long offset;
+    bool is_read;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long op = 0; op < config->op_count; op++) {
+        if(config->random) {
+            file = rand_r(&(state->seed)) % config->file_count;
+            offset = (long) (rand_r(&(state->seed)) % blocks)
+                    * config->io_size;
+        } else {
+            // stream through each file in turn
+            offset = state->cursors[file];
+            state->cursors[file] += config->io_size;
+            if(state->cursors[file] + config->io_size > config->file_size) {
+                state->cursors[file] = 0;
+                file = (file + 1) % config->file_count;
+            }
+        }
+
+        is_read = rand_r(&(state->seed)) % 100 < config->read_percent;
+        if(is_read ? timed_read(state, file, offset) == -1
+                   : timed_write(state, file, offset) == -1) {
+            return -1;
+        }
+
+        result->ops++;
+        result->bytes += config->io_size;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->name = "mixed";
+    result->elapsed = elapsed_sec(&start, &end);
+
+    return 0;
+}
+
+int unlink_phase(struct bench_state* state, struct phase_result* result) {
+    struct bench_config* config = state->config;
+    char name[MAX_PATH];
+    struct timespec start, end, op_start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int file = 0; file < config->file_count; file++) {
+        file_name(config, file, name);
+        clock_gettime(CLOCK_MONOTONIC, &op_start);
+        if(unlink(name) == -1) {
+            perror(name);
+
+            return -1;
+        }
+        record_latency(&(state->latency[OP_UNLINK]), &op_start);
+        result->ops++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->name = "unlink";
+    result->elapsed = elapsed_sec(&start, &end);
+
+    return 0;
+}
+
+void print_text(struct bench_state* state, struct phase_result* phases,
+                int phase_count) {
+    struct bench_config* config = state->config;
+    printf("Benchmark: %d files of %ld bytes, %d byte I/O, %d%% reads, %s\n",
+           config->file_count, config->file_size, config->io_size,
+           config->read_percent, config->random ? "random" : "sequential");
+    for(int i = 0; i < phase_count; i++) {
+        printf("\nPhase %d: %s\n", i + 1, phases[i].name);
+        printf("%-30s: %fs\n", "Elapsed time", phases[i].elapsed);
+        printf("%-30s: %f\n", "ops/sec", phases[i].ops / phases[i].elapsed);
+        if(phases[i].bytes > 0) {
+            printf("%-30s: %f\n", "KB/sec",
+                   phases[i].bytes / KB / phases[i].elapsed);
+        }
+    }
+
+    printf("\n%-10s %10s %12s %12s %12s %12s\n", "op", "count", "p50 us",
+           "p99 us", "p99.9 us", "max us");
+    struct latency_histogram* histogram;
+    for(int op = 0; op < OP_COUNT; op++) {
+        histogram = &(state->latency[op]);
+        if(histogram->count == 0) {
+            continue;
+        }
+
+        printf("%-10s %10lu %12.1f %12.1f %12.1f %12.1f\n", op_names[op],
+               (unsigned long) histogram->count,
+               latency_percentile(histogram, 0.5) / 1000.0,
+               latency_percentile(histogram, 0.99) / 1000.0,
+               latency_percentile(histogram, 0.999) / 1000.0,
+               histogram->max_ns / 1000.0);
+    }
+}
+
+void print_json(struct bench_state* state, struct phase_result* phases,
+                int phase_count) {
+    struct bench_config* config = state->config;
+    double total_elapsed = 0;
+    long total_ops = 0, total_bytes = 0;
+    printf("{\n  \"config\": {\"dir\": \"%s\", \"file_count\": %d, "
+           "\"file_size\": %ld, \"io_size\": %d, \"read_percent\": %d, "
+           "\"fsync_every\": %d, \"random\": %s, \"op_count\": %ld, "
+           "\"seed\": %u},\n", config->dir, config->file_count,
+           config->file_size, config->io_size, config->read_percent,
+           config->fsync_every, config->random ? "true" : "false",
+           config->op_count, config->seed);
+    printf("  \"phases\": [\n");
+    for(int i = 0; i < phase_count; i++) {
+        printf("    {\"name\": \"%s\", \"elapsed_sec\": %f, \"ops\": %ld, "
+               "\"bytes\": %ld, \"ops_per_sec\": %f, \"mb_per_sec\": %f}%s\n",
+               phases[i].name, phases[i].elapsed, phases[i].ops,
+               phases[i].bytes, phases[i].ops / phases[i].elapsed,
+               phases[i].bytes / (double) (KB * KB) / phases[i].elapsed,
+               i + 1 < phase_count ? "," : "");
+        total_elapsed += phases[i].elapsed;
+        total_ops += phases[i].ops;
+        total_bytes += phases[i].bytes;
+    }
+    printf("  ],\n  \"throughput\": {\"elapsed_sec\": %f, \"ops\": %ld, "
+           "\"bytes\": %ld, \"ops_per_sec\": %f, \"mb_per_sec\": %f},\n",
+           total_elapsed, total_ops, total_bytes, total_ops / total_elapsed,
+           total_bytes / (double) (KB * KB) / total_elapsed);
+    printf("  \"latency_us\": {\n");
+    struct latency_histogram* histogram;
+    for(int op = 0; op < OP_COUNT; op++) {
+        histogram = &(state->latency[op]);
+        printf("    \"%s\": {\"count\": %lu, \"mean\": %.1f, \"p50\": %.1f, "
+               "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}%s\n",
+               op_names[op], (unsigned long) histogram->count,
+               histogram->count == 0 ? 0.0
+                       : histogram->total_ns / 1000.0 / histogram->count,
+               latency_percentile(histogram, 0.5) / 1000.0,
+               latency_percentile(histogram, 0.99) / 1000.0,
+               latency_percentile(histogram, 0.999) / 1000.0,
+               histogram->max_ns / 1000.0, op + 1 < OP_COUNT ? "," : "");
+    }
+    printf("  }\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct bench_config config;
+    if(parse_args(argc, argv, &config) == -1) {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    struct bench_state state;
+    memset(&state, 0, sizeof(struct bench_state));
+    state.config = &config;
+    state.seed = config.seed;
+    state.buffer = (char*) malloc(config.io_size);
+    state.fds = (int*) calloc(config.file_count, sizeof(int));
+    state.cursors = (long*) calloc(config.file_count, sizeof(long));
+    state.unsynced = (int*) calloc(config.file_count, sizeof(int));
+    if(state.buffer == NULL || state.fds == NULL || state.cursors == NULL
+            || state.unsynced == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return 1;
+    }
+
+    for(int i = 0; i < config.io_size; i++) {
+        state.buffer[i] = (char) rand_r(&(state.seed));
+    }
+
+    struct phase_result phases[3];
+    memset(phases, 0, sizeof(phases));
+    int phase_count = 0;
+    if(setup_phase(&state, &(phases[phase_count++])) == -1
+            || mixed_phase(&state, &(phases[phase_count++])) == -1) {
+        return 1;
+    }
+
+    for(int file = 0; file < config.file_count; file++) {
+        close(state.fds[file]);
+    }
+    if(!config.keep && unlink_phase(&state, &(phases[phase_count++])) == -1) {
+        return 1;
+    }
+
+    if(config.json) {
+        print_json(&state, phases, phase_count);
+    } else {
+        print_text(&state, phases, phase_count);
+    }
+    free(state.buffer);
+    free(state.fds);
+    free(state.cursors);
+    free(state.unsynced);
+
+    return 0;
+}
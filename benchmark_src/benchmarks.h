@@ -6,9 +6,25 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <stdint.h>
+#include <string.h>
 
 #define KB (1 << 10)
 #define CACHE_SIZE 32 * KB
+#define NSEC_PER_SEC 1000000000L
+
+// log-linear latency histogram: each power of two of nanoseconds is split
+// into LATENCY_SUB_BUCKETS linear buckets, so a bucket is at most 1/16 wide
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((65 - LATENCY_SUB_BITS) * LATENCY_SUB_BUCKETS)
+
+struct latency_histogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
 
 void print_results(struct timespec*, struct timespec*);
 
@@ -40,4 +56,81 @@ void clear_l1_cache() {
     free(data);
 }
 
+double elapsed_sec(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec)
+            + (double) (end->tv_nsec - start->tv_nsec) / NSEC_PER_SEC;
+}
+
+int latency_bucket(uint64_t ns) {
+    if(ns < LATENCY_SUB_BUCKETS) {
+        return (int) ns;
+    }
+
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+
+    return (shift + 1) * LATENCY_SUB_BUCKETS
+            + (int) (ns >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+// add the time since start to histogram
+void record_latency(struct latency_histogram* histogram,
+                    struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ns = (uint64_t) (now.tv_sec - start->tv_sec) * NSEC_PER_SEC
+            + now.tv_nsec - start->tv_nsec;
+    histogram->counts[latency_bucket(ns)]++;
+    histogram->count++;
+    histogram->total_ns += ns;
+    if(ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+}
+
+// latency below which fraction of the samples fall, to within a bucket
+uint64_t latency_percentile(struct latency_histogram* histogram,
+                            double fraction) {
+    if(histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (fraction * histogram->count);
+    if(rank >= histogram->count) {
+        rank = histogram->count - 1;
+    }
+    uint64_t seen = 0;
+    uint64_t limit;
+    int shift;
+    for(int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if(seen <= rank) {
+            continue;
+        }
+
+        limit = bucket;
+        if(bucket >= LATENCY_SUB_BUCKETS) {
+            // upper end of the bucket
+            shift = bucket / LATENCY_SUB_BUCKETS - 1;
+            limit = ((uint64_t) (bucket % LATENCY_SUB_BUCKETS
+                                 + LATENCY_SUB_BUCKETS + 1) << shift) - 1;
+        }
+
+        return limit < histogram->max_ns ? limit : histogram->max_ns;
+    }
+
+    return histogram->max_ns;
+}
+
+void merge_latency(struct latency_histogram* into,
+                   struct latency_histogram* from) {
+    for(int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        into->counts[bucket] += from->counts[bucket];
+    }
+    into->count += from->count;
+    into->total_ns += from->total_ns;
+    if(from->max_ns > into->max_ns) {
+        into->max_ns = from->max_ns;
+    }
+}
+
 #endif
@@ -0,0 +1,488 @@
+#include "benchmarks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#define MAX_PATH 4096
+#define FILENAME_FMT "%s/clean%05d"
+#define STATS_FILE "/.lfs_stats"
+#define STATS_SIZE_MAX 16384
+#define MAX_UTILIZATIONS 16
+#define MAX_INTERVALS 4096
+
+struct cleaner_config {
+    const char* dir;
+    // bytes utilizations are a percentage of, 0 to use the log's size
+    long capacity;
+    // log utilizations to run at, in percent, ascending
+    int utilizations[MAX_UTILIZATIONS];
+    int utilization_count;
+    long file_size;
+    int io_size;
+    // hot_percent of the writes go to hot_data_percent of the blocks, the
+    // rest to the others; uniform when hot_percent is 0
+    int hot_percent;
+    int hot_data_percent;
+    int duration_sec;
+    int interval_sec;
+    unsigned seed;
+    bool keep;
+    bool json;
+};
+
+// counters read from the stats file, all -1 when it isn't a 380LFS mount
+struct lfs_counters {
+    double user_bytes;
+    double log_bytes;
+    double clean_time_us;
+    double clean_segments;
+};
+
+struct interval_result {
+    double time;
+    double mb_per_sec;
+    // log bytes written per user byte, -1 if unknown
+    double write_cost;
+    // fraction of the interval spent in clean(), -1 if unknown
+    double cleaner_share;
+    double clean_segments;
+};
+
+struct run_result {
+    int utilization;
+    int file_count;
+    struct interval_result intervals[MAX_INTERVALS];
+    int interval_count;
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s -d MOUNTDIR [OPTIONS]\n"
+        "    -u PERCENTS log utilizations to run at, default 50,75,90\n"
+        "    -c BYTES    capacity, required unless DIR is a 380LFS mount\n"
+        "    -s BYTES    file size, default 4M\n"
+        "    -i BYTES    overwrite size, default 4K\n"
+        "    -H PERCENT  writes that go to hot data, default 0 (uniform)\n"
+        "    -F PERCENT  data that is hot, default 10\n"
+        "    -t SECONDS  overwrite time per utilization, default 60\n"
+        "    -I SECONDS  reporting interval, default 5\n"
+        "    -S SEED     random seed, default 1\n"
+        "    -k          keep the files instead of unlinking them\n"
+        "    -j          JSON output\n"
+        "sizes take a K, M or G suffix\n", name);
+}
+
+long parse_size(const char* arg) {
+    char* end;
+    long size = strtol(arg, &end, 10);
+    if(*end == 'K' || *end == 'k') {
+        size *= KB;
+    } else if(*end == 'M' || *end == 'm') {
+        size *= KB * KB;
+    } else if(*end == 'G' || *end == 'g') {
+        size *= KB * KB * KB;
+    } else if(*end != '\0') {
+        return -1;
+    }
+
+    return size;
+}
+
+int parse_utilizations(char* arg, struct cleaner_config* config) {
+    config->utilization_count = 0;
+    for(char* value = strtok(arg, ","); value != NULL;
+            value = strtok(NULL, ",")) {
+        if(config->utilization_count == MAX_UTILIZATIONS) {
+            return -1;
+        }
+
+        config->utilizations[config->utilization_count++] = atoi(value);
+    }
+
+    return 0;
+}
+
+int parse_args(int argc, char* argv[], struct cleaner_config* config) {
+    char default_utilizations[] = "50,75,90";
+    config->dir = NULL;
+    config->capacity = 0;
+    parse_utilizations(default_utilizations, config);
+    config->file_size = 4 * KB * KB;
+    config->io_size = 4 * KB;
+    config->hot_percent = 0;
+    config->hot_data_percent = 10;
+    config->duration_sec = 60;
+    config->interval_sec = 5;
+    config->seed = 1;
+    config->keep = false;
+    config->json = false;
+    int opt;
+    while((opt = getopt(argc, argv, "d:c:u:s:i:H:F:t:I:S:kjh")) != -1) {
+        switch(opt) {
+        case 'd':
+            config->dir = optarg;
+            break;
+        case 'c':
+            config->capacity = parse_size(optarg);
+            break;
+        case 'u':
+            if(parse_utilizations(optarg, config) == -1) {
+                return -1;
+            }
+            break;
+        case 's':
+            config->file_size = parse_size(optarg);
+            break;
+        case 'i':
+            config->io_size = (int) parse_size(optarg);
+            break;
+        case 'H':
+            config->hot_percent = atoi(optarg);
+            break;
+        case 'F':
+            config->hot_data_percent = atoi(optarg);
+            break;
+        case 't':
+            config->duration_sec = atoi(optarg);
+            break;
+        case 'I':
+            config->interval_sec = atoi(optarg);
+            break;
+        case 'S':
+            config->seed = (unsigned) atoi(optarg);
+            break;
+        case 'k':
+            config->keep = true;
+            break;
+        case 'j':
+            config->json = true;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if(config->dir == NULL || config->io_size <= 0
+            || config->file_size < config->io_size
+            || config->hot_percent < 0 || config->hot_percent > 100
+            || config->hot_data_percent <= 0
+            || config->hot_data_percent >= 100
+            || config->duration_sec <= 0 || config->interval_sec <= 0
+            || config->duration_sec / config->interval_sec > MAX_INTERVALS) {
+        return -1;
+    }
+
+    for(int i = 0; i < config->utilization_count; i++) {
+        if(config->utilizations[i] <= 0 || config->utilizations[i] >= 100
+                || (i > 0 && config->utilizations[i]
+                                 <= config->utilizations[i - 1])) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// value of the "name value" line for name in stats, -1 if there is none
+double stat_value(const char* stats, const char* name) {
+    size_t length = strlen(name);
+    for(const char* line = stats; line != NULL && *line != '\0';
+            line = strchr(line, '\n')) {
+        if(*line == '\n') {
+            line++;
+        }
+        if(strncmp(line, name, length) == 0 && line[length] == ' ') {
+            return atof(line + length + 1);
+        }
+    }
+
+    return -1;
+}
+
+void read_counters(struct cleaner_config* config,
+                   struct lfs_counters* counters) {
+    char path[MAX_PATH];
+    char stats[STATS_SIZE_MAX];
+    counters->user_bytes = -1;
+    counters->log_bytes = -1;
+    counters->clean_time_us = -1;
+    counters->clean_segments = -1;
+    snprintf(path, MAX_PATH, "%s%s", config->dir, STATS_FILE);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return;
+    }
+
+    ssize_t length = read(fd, stats, STATS_SIZE_MAX - 1);
+    close(fd);
+    if(length <= 0) {
+        return;
+    }
+
+    stats[length] = '\0';
+    counters->user_bytes = stat_value(stats, "user_bytes_written");
+    counters->log_bytes = stat_value(stats, "log_bytes_written")
+            + stat_value(stats, "checkpoint_bytes_written");
+    counters->clean_time_us = stat_value(stats, "clean_time_us");
+    counters->clean_segments = stat_value(stats, "clean_segments");
+}
+
+// bytes the log can hold, from the stats file's segment count on 380LFS
+long log_capacity(struct cleaner_config* config) {
+    if(config->capacity > 0) {
+        return config->capacity;
+    }
+
+    char path[MAX_PATH];
+    char stats[STATS_SIZE_MAX];
+    snprintf(path, MAX_PATH, "%s%s", config->dir, STATS_FILE);
+    int fd = open(path, O_RDONLY);
+    if(fd >= 0) {
+        ssize_t length = read(fd, stats, STATS_SIZE_MAX - 1);
+        close(fd);
+        if(length > 0) {
+            stats[length] = '\0';
+            double segments = stat_value(stats, "segments");
+            if(segments > 0) {
+                return (long) segments * KB * KB;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// grow the file set to utilization percent of capacity, files are written
+// whole and stay open
+int fill(struct cleaner_config* config, int* fds, int* file_count,
+         int target_count, char* buffer) {
+    char name[MAX_PATH];
+    for(; *file_count < target_count; (*file_count)++) {
+        snprintf(name, MAX_PATH, FILENAME_FMT, config->dir, *file_count);
+        fds[*file_count] = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if(fds[*file_count] < 0) {
+            perror(name);
+
+            return -1;
+        }
+
+        for(long offset = 0; offset < config->file_size;
+                offset += config->io_size) {
+            if(pwrite(fds[*file_count], buffer, config->io_size, offset)
+                    < config->io_size) {
+                perror("write");
+
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// overwrite random blocks of the file set for duration_sec, reporting every
+// interval_sec
+int overwrite(struct cleaner_config* config, int* fds, int file_count,
+              char* buffer, unsigned* seed, struct run_result* run) {
+    long blocks_per_file = config->file_size / config->io_size;
+    long blocks = blocks_per_file * file_count;
+    long hot_blocks = blocks * config->hot_data_percent / 100;
+    if(hot_blocks == 0) {
+        hot_blocks = 1;
+    }
+    long block;
+    long interval_bytes = 0;
+    struct lfs_counters before, after;
+    struct timespec start, interval_start, now;
+    struct interval_result* result;
+    read_counters(config, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    interval_start = start;
+    run->interval_count = 0;
+    while(run->interval_count < config->duration_sec / config->interval_sec) {
+        // hot blocks are the first hot_data_percent of the file set
+        if(rand_r(seed) % 100 < (unsigned) config->hot_percent) {
+            block = (long) rand_r(seed) % hot_blocks;
+        } else if(config->hot_percent > 0) {
+            block = hot_blocks + (long) rand_r(seed) % (blocks - hot_blocks);
+        } else {
+            block = (long) rand_r(seed) % blocks;
+        }
+        if(pwrite(fds[block / blocks_per_file], buffer, config->io_size,
+                  (block % blocks_per_file) * config->io_size)
+                < config->io_size) {
+            perror("write");
+
+            return -1;
+        }
+        interval_bytes += config->io_size;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(elapsed_sec(&interval_start, &now) < config->interval_sec) {
+            continue;
+        }
+
+        read_counters(config, &after);
+        result = &(run->intervals[run->interval_count++]);
+        double elapsed = elapsed_sec(&interval_start, &now);
+        result->time = elapsed_sec(&start, &now);
+        result->mb_per_sec = interval_bytes / (double) (KB * KB) / elapsed;
+        result->write_cost = -1;
+        result->cleaner_share = -1;
+        result->clean_segments = after.clean_segments;
+        if(after.user_bytes > before.user_bytes) {
+            result->write_cost = (after.log_bytes - before.log_bytes)
+                    / (after.user_bytes - before.user_bytes);
+        }
+        if(after.clean_time_us >= 0) {
+            result->cleaner_share = (after.clean_time_us - before.clean_time_us)
+                    / 1e6 / elapsed;
+        }
+        if(!config->json) {
+            printf("%8.1f %10.2f %12.3f %14.3f %10.0f\n", result->time,
+                   result->mb_per_sec, result->write_cost,
+                   result->cleaner_share, result->clean_segments);
+            fflush(stdout);
+        }
+
+        before = after;
+        interval_start = now;
+        interval_bytes = 0;
+    }
+
+    return 0;
+}
+
+// mean of the second half of the intervals, once the cleaner has settled
+void steady_state(struct run_result* run, struct interval_result* steady) {
+    int first = run->interval_count / 2;
+    int count = run->interval_count - first;
+    memset(steady, 0, sizeof(struct interval_result));
+    for(int i = first; i < run->interval_count; i++) {
+        steady->mb_per_sec += run->intervals[i].mb_per_sec / count;
+        steady->write_cost += run->intervals[i].write_cost / count;
+        steady->cleaner_share += run->intervals[i].cleaner_share / count;
+        steady->clean_segments += run->intervals[i].clean_segments / count;
+    }
+}
+
+void print_json(struct cleaner_config* config, struct run_result* runs,
+                int run_count) {
+    struct interval_result steady;
+    printf("{\n  \"config\": {\"dir\": \"%s\", \"file_size\": %ld, "
+           "\"io_size\": %d, \"hot_percent\": %d, \"hot_data_percent\": %d, "
+           "\"duration_sec\": %d, \"interval_sec\": %d, \"seed\": %u},\n",
+           config->dir, config->file_size, config->io_size,
+           config->hot_percent, config->hot_data_percent,
+           config->duration_sec, config->interval_sec, config->seed);
+    printf("  \"runs\": [\n");
+    for(int r = 0; r < run_count; r++) {
+        steady_state(&(runs[r]), &steady);
+        printf("    {\"utilization\": %d, \"file_count\": %d,\n"
+               "     \"steady\": {\"mb_per_sec\": %f, \"write_cost\": %f, "
+               "\"cleaner_share\": %f},\n     \"intervals\": [\n",
+               runs[r].utilization, runs[r].file_count, steady.mb_per_sec,
+               steady.write_cost, steady.cleaner_share);
+        for(int i = 0; i < runs[r].interval_count; i++) {
+            printf("       {\"time\": %f, \"mb_per_sec\": %f, "
+                   "\"write_cost\": %f, \"cleaner_share\": %f, "
+                   "\"clean_segments\": %.0f}%s\n",
+                   runs[r].intervals[i].time, runs[r].intervals[i].mb_per_sec,
+                   runs[r].intervals[i].write_cost,
+                   runs[r].intervals[i].cleaner_share,
+                   runs[r].intervals[i].clean_segments,
+                   i + 1 < runs[r].interval_count ? "," : "");
+        }
+        printf("     ]}%s\n", r + 1 < run_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct cleaner_config config;
+    if(parse_args(argc, argv, &config) == -1) {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    long capacity = log_capacity(&config);
+    if(capacity <= 0) {
+        fprintf(stderr, "%s is not a 380LFS mount, set its capacity with -c\n",
+                config.dir);
+
+        return 1;
+    }
+
+    int max_files = (int) (capacity / 100
+            * config.utilizations[config.utilization_count - 1]
+            / config.file_size);
+    unsigned seed = config.seed;
+    int* fds = (int*) calloc(max_files + 1, sizeof(int));
+    char* buffer = (char*) malloc(config.io_size);
+    struct run_result* runs = (struct run_result*)
+            calloc(config.utilization_count, sizeof(struct run_result));
+    if(fds == NULL || buffer == NULL || runs == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return 1;
+    }
+
+    for(int i = 0; i < config.io_size; i++) {
+        buffer[i] = (char) rand_r(&seed);
+    }
+
+    int file_count = 0;
+    struct interval_result steady;
+    for(int r = 0; r < config.utilization_count; r++) {
+        runs[r].utilization = config.utilizations[r];
+        runs[r].file_count = (int) (capacity / 100 * runs[r].utilization
+                                    / config.file_size);
+        if(fill(&config, fds, &file_count, runs[r].file_count, buffer) == -1) {
+            return 1;
+        }
+
+        if(!config.json) {
+            printf("\nUtilization %d%%: %d files of %ld bytes, %s\n",
+                   runs[r].utilization, file_count, config.file_size,
+                   config.hot_percent > 0 ? "hot/cold" : "uniform");
+            printf("%8s %10s %12s %14s %10s\n", "time", "MB/sec",
+                   "write cost", "cleaner share", "clean segs");
+        }
+        if(overwrite(&config, fds, file_count, buffer, &seed,
+                     &(runs[r])) == -1) {
+            return 1;
+        }
+
+        if(!config.json) {
+            steady_state(&(runs[r]), &steady);
+            printf("%-30s: %f\n", "Steady MB/sec", steady.mb_per_sec);
+            printf("%-30s: %f\n", "Steady write cost", steady.write_cost);
+            printf("%-30s: %f\n", "Steady cleaner share",
+                   steady.cleaner_share);
+        }
+    }
+
+    if(config.json) {
+        print_json(&config, runs, config.utilization_count);
+    }
+
+    char name[MAX_PATH];
+    for(int file = 0; file < file_count; file++) {
+        close(fds[file]);
+        if(!config.keep) {
+            snprintf(name, MAX_PATH, FILENAME_FMT, config.dir, file);
+            unlink(name);
+        }
+    }
+    free(fds);
+    free(buffer);
+    free(runs);
+
+    return 0;
+}
@@ -0,0 +1,642 @@
+#include "benchmarks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define MAX_PATH 4096
+#define SMALL_FMT "%s/client%03d_small%05d"
+#define LARGE_FMT "%s/client%03d_large"
+#define MAX_STEPS 16
+
+#define OP_CREATE 0
+#define OP_WRITE 1
+#define OP_READ 2
+#define OP_UNLINK 3
+#define OP_COUNT 4
+
+#define WORKLOAD_SMALL 0
+#define WORKLOAD_LARGE 1
+#define WORKLOAD_MIXED 2
+
+const char* op_names[OP_COUNT] = {"create", "write", "read", "unlink"};
+const char* workload_names[] = {"small", "large", "mixed"};
+
+struct concurrent_config {
+    const char* dir;
+    // client counts to run with, one step each
+    int client_counts[MAX_STEPS];
+    int step_count;
+    int workload;
+    // fork a process per client instead of starting a thread
+    bool processes;
+    // small files each small-file client keeps live
+    int small_files;
+    int small_size;
+    long large_size;
+    int io_size;
+    // percentage of large-file operations that are reads
+    int read_percent;
+    int duration_sec;
+    unsigned seed;
+    bool json;
+};
+
+// filled in by a client, lives in shared memory when clients are processes
+struct client_result {
+    int workload;
+    bool failed;
+    struct timespec start;
+    struct timespec end;
+    long ops;
+    long bytes;
+    struct latency_histogram latency[OP_COUNT];
+};
+
+struct step_shared {
+    pthread_barrier_t barrier;
+    struct client_result clients[];
+};
+
+struct client_args {
+    struct concurrent_config* config;
+    struct step_shared* shared;
+    int client;
+};
+
+struct step_result {
+    int client_count;
+    double elapsed;
+    long ops;
+    long bytes;
+    double min_client_mb;
+    double max_client_mb;
+    struct latency_histogram latency[OP_COUNT];
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [OPTIONS]\n"
+        "    -d DIR     directory to run in, default .\n"
+        "    -c COUNTS  client counts to step through, default 1,2,4,8\n"
+        "    -w LOAD    small, large or mixed clients, default mixed\n"
+        "    -P         fork a process per client, default threads\n"
+        "    -n COUNT   live files per small-file client, default 64\n"
+        "    -s BYTES   small file size, default 8K\n"
+        "    -l BYTES   large file size, default 16M\n"
+        "    -i BYTES   large file I/O size, default 64K\n"
+        "    -m PERCENT large file reads, default 50\n"
+        "    -t SECONDS time per client count, default 10\n"
+        "    -S SEED    random seed, default 1\n"
+        "    -j         JSON output\n"
+        "sizes take a K, M or G suffix\n", name);
+}
+
+long parse_size(const char* arg) {
+    char* end;
+    long size = strtol(arg, &end, 10);
+    if(*end == 'K' || *end == 'k') {
+        size *= KB;
+    } else if(*end == 'M' || *end == 'm') {
+        size *= KB * KB;
+    } else if(*end == 'G' || *end == 'g') {
+        size *= KB * KB * KB;
+    } else if(*end != '\0') {
+        return -1;
+    }
+
+    return size;
+}
+
+int parse_client_counts(char* arg, struct concurrent_config* config) {
+    config->step_count = 0;
+    for(char* value = strtok(arg, ","); value != NULL;
+            value = strtok(NULL, ",")) {
+        if(config->step_count == MAX_STEPS || atoi(value) <= 0) {
+            return -1;
+        }
+
+        config->client_counts[config->step_count++] = atoi(value);
+    }
+
+    return 0;
+}
+
+int parse_workload(const char* arg) {
+    for(int workload = WORKLOAD_SMALL; workload <= WORKLOAD_MIXED;
+            workload++) {
+        if(strcmp(arg, workload_names[workload]) == 0) {
+            return workload;
+        }
+    }
+
+    return -1;
+}
+
+int parse_args(int argc, char* argv[], struct concurrent_config* config) {
+    char default_counts[] = "1,2,4,8";
+    config->dir = ".";
+    parse_client_counts(default_counts, config);
+    config->workload = WORKLOAD_MIXED;
+    config->processes = false;
+    config->small_files = 64;
+    config->small_size = 8 * KB;
+    config->large_size = 16 * KB * KB;
+    config->io_size = 64 * KB;
+    config->read_percent = 50;
+    config->duration_sec = 10;
+    config->seed = 1;
+    config->json = false;
+    int opt;
+    while((opt = getopt(argc, argv, "d:c:w:Pn:s:l:i:m:t:S:jh")) != -1) {
+        switch(opt) {
+        case 'd':
+            config->dir = optarg;
+            break;
+        case 'c':
+            if(parse_client_counts(optarg, config) == -1) {
+                return -1;
+            }
+            break;
+        case 'w':
+            config->workload = parse_workload(optarg);
+            break;
+        case 'P':
+            config->processes = true;
+            break;
+        case 'n':
+            config->small_files = atoi(optarg);
+            break;
+        case 's':
+            config->small_size = (int) parse_size(optarg);
+            break;
+        case 'l':
+            config->large_size = parse_size(optarg);
+            break;
+        case 'i':
+            config->io_size = (int) parse_size(optarg);
+            break;
+        case 'm':
+            config->read_percent = atoi(optarg);
+            break;
+        case 't':
+            config->duration_sec = atoi(optarg);
+            break;
+        case 'S':
+            config->seed = (unsigned) atoi(optarg);
+            break;
+        case 'j':
+            config->json = true;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if(config->workload == -1 || config->step_count == 0
+            || config->small_files <= 0 || config->small_size <= 0
+            || config->io_size <= 0 || config->large_size < config->io_size
+            || config->read_percent < 0 || config->read_percent > 100
+            || config->duration_sec <= 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+bool past(struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec > deadline->tv_sec
+            || (now.tv_sec == deadline->tv_sec
+                && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// write a whole file from buffer in chunks of at most chunk bytes
+int write_file(int fd, char* buffer, long size, int chunk,
+               struct client_result* result) {
+    struct timespec start;
+    int length;
+    for(long offset = 0; offset < size; offset += length) {
+        length = size - offset < chunk ? (int) (size - offset) : chunk;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(pwrite(fd, buffer, length, offset) < length) {
+            perror("write");
+
+            return -1;
+        }
+        record_latency(&(result->latency[OP_WRITE]), &start);
+        result->ops++;
+        result->bytes += length;
+    }
+
+    return 0;
+}
+
+// cycle through small_files slots, replacing the file in each and reading
+// back another, until the deadline
+int small_file_client(struct concurrent_config* config, int client,
+                      char* buffer, unsigned* seed,
+                      struct timespec* deadline,
+                      struct client_result* result) {
+    char name[MAX_PATH];
+    struct timespec start;
+    int fd, slot;
+    long iteration;
+    for(iteration = 0; !past(deadline); iteration++) {
+        slot = (int) (iteration % config->small_files);
+        snprintf(name, MAX_PATH, SMALL_FMT, config->dir, client, slot);
+        if(iteration >= config->small_files) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if(unlink(name) == -1) {
+                perror(name);
+
+                return -1;
+            }
+            record_latency(&(result->latency[OP_UNLINK]), &start);
+            result->ops++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if(fd < 0) {
+            perror(name);
+
+            return -1;
+        }
+        record_latency(&(result->latency[OP_CREATE]), &start);
+        result->ops++;
+        if(write_file(fd, buffer, config->small_size, config->small_size,
+                      result) == -1) {
+            close(fd);
+
+            return -1;
+        }
+        close(fd);
+
+        // read back a file that already exists
+        slot = rand_r(seed) % (iteration < config->small_files
+                               ? slot + 1 : config->small_files);
+        snprintf(name, MAX_PATH, SMALL_FMT, config->dir, client, slot);
+        fd = open(name, O_RDONLY);
+        if(fd < 0) {
+            perror(name);
+
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(pread(fd, buffer, config->small_size, 0) < config->small_size) {
+            perror("read");
+            close(fd);
+
+            return -1;
+        }
+        record_latency(&(result->latency[OP_READ]), &start);
+        result->ops++;
+        result->bytes += config->small_size;
+        close(fd);
+    }
+
+    // leave the directory as it was found
+    long live = iteration < config->small_files
+            ? iteration : config->small_files;
+    for(slot = 0; slot < live; slot++) {
+        snprintf(name, MAX_PATH, SMALL_FMT, config->dir, client, slot);
+        unlink(name);
+    }
+
+    return 0;
+}
+
+// random reads and overwrites of io_size to a file filled before the start
+int large_file_client(struct concurrent_config* config, int fd,
+                      char* buffer, unsigned* seed,
+                      struct timespec* deadline,
+                      struct client_result* result) {
+    long blocks = config->large_size / config->io_size;
+    long offset;
+    bool is_read;
+    struct timespec start;
+    while(!past(deadline)) {
+        offset = (long) (rand_r(seed) % blocks) * config->io_size;
+        is_read = rand_r(seed) % 100 < config->read_percent;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(is_read ? pread(fd, buffer, config->io_size, offset)
+                             < config->io_size
+                   : pwrite(fd, buffer, config->io_size, offset)
+                             < config->io_size) {
+            perror(is_read ? "read" : "write");
+
+            return -1;
+        }
+        record_latency(&(result->latency[is_read ? OP_READ : OP_WRITE]),
+                       &start);
+        result->ops++;
+        result->bytes += config->io_size;
+    }
+
+    return 0;
+}
+
+// set up, wait for every other client, then run until the deadline
+void* run_client(void* arg) {
+    struct client_args* args = (struct client_args*) arg;
+    struct concurrent_config* config = args->config;
+    struct client_result* result = &(args->shared->clients[args->client]);
+    unsigned seed = config->seed + args->client;
+    int size = config->small_size > config->io_size
+            ? config->small_size : config->io_size;
+    char* buffer = (char*) malloc(size);
+    char name[MAX_PATH];
+    int fd = -1;
+    memset(result, 0, sizeof(struct client_result));
+    result->workload = config->workload;
+    if(config->workload == WORKLOAD_MIXED) {
+        result->workload = args->client % 2 == 0
+                ? WORKLOAD_SMALL : WORKLOAD_LARGE;
+    }
+    if(buffer == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        result->failed = true;
+    } else {
+        for(int i = 0; i < size; i++) {
+            buffer[i] = (char) rand_r(&seed);
+        }
+    }
+
+    snprintf(name, MAX_PATH, LARGE_FMT, config->dir, args->client);
+    if(!result->failed && result->workload == WORKLOAD_LARGE) {
+        fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if(fd < 0 || write_file(fd, buffer, config->large_size,
+                                config->io_size, result) == -1) {
+            perror(name);
+            result->failed = true;
+        }
+        memset(result->latency, 0, sizeof(result->latency));
+        result->ops = 0;
+        result->bytes = 0;
+    }
+
+    // every client waits here even after failing, so the others don't hang
+    pthread_barrier_wait(&(args->shared->barrier));
+    clock_gettime(CLOCK_MONOTONIC, &(result->start));
+    struct timespec deadline = result->start;
+    deadline.tv_sec += config->duration_sec;
+    if(!result->failed) {
+        if(result->workload == WORKLOAD_SMALL) {
+            result->failed = small_file_client(config, args->client, buffer,
+                                               &seed, &deadline, result) == -1;
+        } else {
+            result->failed = large_file_client(config, fd, buffer, &seed,
+                                               &deadline, result) == -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &(result->end));
+
+    if(fd >= 0) {
+        close(fd);
+        unlink(name);
+    }
+    free(buffer);
+
+    return NULL;
+}
+
+int start_clients(struct concurrent_config* config, struct step_shared* shared,
+                  int client_count) {
+    struct client_args* args = (struct client_args*)
+            malloc(client_count * sizeof(struct client_args));
+    pthread_t* threads = (pthread_t*) malloc(client_count * sizeof(pthread_t));
+    if(args == NULL || threads == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        free(args);
+        free(threads);
+
+        return -1;
+    }
+
+    pid_t pid;
+    int status = 0;
+    int started = 0;
+    for(int client = 0; client < client_count; client++) {
+        args[client].config = config;
+        args[client].shared = shared;
+        args[client].client = client;
+        if(!config->processes) {
+            if(pthread_create(&(threads[client]), NULL, run_client,
+                              &(args[client])) != 0) {
+                fprintf(stderr, "Failed to start client %d\n", client);
+                status = -1;
+                break;
+            }
+        } else {
+            pid = fork();
+            if(pid == -1) {
+                perror("fork");
+                status = -1;
+                break;
+            }
+            if(pid == 0) {
+                run_client(&(args[client]));
+                _exit(0);
+            }
+        }
+        started++;
+    }
+
+    // a partial start leaves the barrier short, so nothing can be joined
+    if(status == -1) {
+        exit(1);
+    }
+
+    for(int client = 0; client < started; client++) {
+        if(config->processes) {
+            wait(NULL);
+        } else {
+            pthread_join(threads[client], NULL);
+        }
+    }
+    free(args);
+    free(threads);
+
+    return 0;
+}
+
+int run_step(struct concurrent_config* config, int client_count,
+             struct step_result* step) {
+    size_t size = sizeof(struct step_shared)
+            + client_count * sizeof(struct client_result);
+    struct step_shared* shared = (struct step_shared*) mmap(NULL, size,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared == MAP_FAILED) {
+        perror("mmap");
+
+        return -1;
+    }
+
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&(shared->barrier), &attr, client_count);
+    pthread_barrierattr_destroy(&attr);
+    if(start_clients(config, shared, client_count) == -1) {
+        return -1;
+    }
+
+    memset(step, 0, sizeof(struct step_result));
+    step->client_count = client_count;
+    struct timespec first = shared->clients[0].start;
+    struct timespec last = shared->clients[0].end;
+    struct client_result* client;
+    double client_mb;
+    int status = 0;
+    for(int c = 0; c < client_count; c++) {
+        client = &(shared->clients[c]);
+        if(client->failed) {
+            fprintf(stderr, "Client %d failed\n", c);
+            status = -1;
+        }
+        if(elapsed_sec(&(client->start), &first) > 0) {
+            first = client->start;
+        }
+        if(elapsed_sec(&last, &(client->end)) > 0) {
+            last = client->end;
+        }
+
+        client_mb = client->bytes / (double) (KB * KB)
+                / elapsed_sec(&(client->start), &(client->end));
+        if(c == 0 || client_mb < step->min_client_mb) {
+            step->min_client_mb = client_mb;
+        }
+        if(client_mb > step->max_client_mb) {
+            step->max_client_mb = client_mb;
+        }
+        step->ops += client->ops;
+        step->bytes += client->bytes;
+        for(int op = 0; op < OP_COUNT; op++) {
+            merge_latency(&(step->latency[op]), &(client->latency[op]));
+        }
+    }
+    step->elapsed = elapsed_sec(&first, &last);
+
+    pthread_barrier_destroy(&(shared->barrier));
+    munmap(shared, size);
+
+    return status;
+}
+
+void print_step(struct step_result* step, struct step_result* base) {
+    printf("\nClients: %d\n", step->client_count);
+    printf("%-30s: %fs\n", "Elapsed time", step->elapsed);
+    printf("%-30s: %f\n", "ops/sec", step->ops / step->elapsed);
+    printf("%-30s: %f\n", "MB/sec",
+           step->bytes / (double) (KB * KB) / step->elapsed);
+    printf("%-30s: %f\n", "Speedup over first step",
+           (step->ops / step->elapsed) / (base->ops / base->elapsed));
+    printf("%-30s: %f - %f\n", "Per-client MB/sec",
+           step->min_client_mb, step->max_client_mb);
+    printf("%-10s %10s %12s %12s %12s %12s\n", "op", "count", "p50 us",
+           "p99 us", "p99.9 us", "max us");
+    struct latency_histogram* histogram;
+    for(int op = 0; op < OP_COUNT; op++) {
+        histogram = &(step->latency[op]);
+        if(histogram->count == 0) {
+            continue;
+        }
+
+        printf("%-10s %10lu %12.1f %12.1f %12.1f %12.1f\n", op_names[op],
+               (unsigned long) histogram->count,
+               latency_percentile(histogram, 0.5) / 1000.0,
+               latency_percentile(histogram, 0.99) / 1000.0,
+               latency_percentile(histogram, 0.999) / 1000.0,
+               histogram->max_ns / 1000.0);
+    }
+}
+
+void print_json(struct concurrent_config* config, struct step_result* steps,
+                int step_count) {
+    printf("{\n  \"config\": {\"dir\": \"%s\", \"workload\": \"%s\", "
+           "\"clients\": \"%s\", \"small_files\": %d, \"small_size\": %d, "
+           "\"large_size\": %ld, \"io_size\": %d, \"read_percent\": %d, "
+           "\"duration_sec\": %d, \"seed\": %u},\n", config->dir,
+           workload_names[config->workload],
+           config->processes ? "processes" : "threads", config->small_files,
+           config->small_size, config->large_size, config->io_size,
+           config->read_percent, config->duration_sec, config->seed);
+    printf("  \"steps\": [\n");
+    struct latency_histogram* histogram;
+    for(int s = 0; s < step_count; s++) {
+        printf("    {\"clients\": %d, \"elapsed_sec\": %f, \"ops\": %ld, "
+               "\"bytes\": %ld, \"ops_per_sec\": %f, \"mb_per_sec\": %f, "
+               "\"speedup\": %f,\n     \"min_client_mb_per_sec\": %f, "
+               "\"max_client_mb_per_sec\": %f,\n     \"latency_us\": {\n",
+               steps[s].client_count, steps[s].elapsed, steps[s].ops,
+               steps[s].bytes, steps[s].ops / steps[s].elapsed,
+               steps[s].bytes / (double) (KB * KB) / steps[s].elapsed,
+               (steps[s].ops / steps[s].elapsed)
+                       / (steps[0].ops / steps[0].elapsed),
+               steps[s].min_client_mb, steps[s].max_client_mb);
+        for(int op = 0; op < OP_COUNT; op++) {
+            histogram = &(steps[s].latency[op]);
+            printf("       \"%s\": {\"count\": %lu, \"mean\": %.1f, "
+                   "\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+                   "\"max\": %.1f}%s\n", op_names[op],
+                   (unsigned long) histogram->count,
+                   histogram->count == 0 ? 0.0
+                           : histogram->total_ns / 1000.0 / histogram->count,
+                   latency_percentile(histogram, 0.5) / 1000.0,
+                   latency_percentile(histogram, 0.99) / 1000.0,
+                   latency_percentile(histogram, 0.999) / 1000.0,
+                   histogram->max_ns / 1000.0, op + 1 < OP_COUNT ? "," : "");
+        }
+        printf("     }}%s\n", s + 1 < step_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct concurrent_config config;
+    if(parse_args(argc, argv, &config) == -1) {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    struct step_result* steps = (struct step_result*)
+            calloc(config.step_count, sizeof(struct step_result));
+    if(steps == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return 1;
+    }
+
+    if(!config.json) {
+        printf("Concurrent benchmark: %s workload, one %s per client\n",
+               workload_names[config.workload],
+               config.processes ? "process" : "thread");
+    }
+    for(int s = 0; s < config.step_count; s++) {
+        if(run_step(&config, config.client_counts[s], &(steps[s])) == -1) {
+            return 1;
+        }
+
+        if(!config.json) {
+            print_step(&(steps[s]), &(steps[0]));
+        }
+    }
+
+    if(config.json) {
+        print_json(&config, steps, config.step_count);
+    }
+    free(steps);
+
+    return 0;
+}
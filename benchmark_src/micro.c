@@ -0,0 +1,898 @@
+#include "../src/lfs.h"
+#include "../src/metadata_helpers.h"
+#include "../src/segments.h"
+#include "../src/clean_policy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+
+#define KB (1 << 10)
+#define MAX_PATH 4096
+#define LOG_FMT "%s/micro%d.log"
+#define FILENAME_FMT "/micro%06d"
+#define MAX_NAME 32
+#define MAX_VALUES 16
+#define MAX_RESULTS 128
+// a benchmark runs at least min_time, but stops after this many times it in
+// wall clock time, setup and commits included
+#define MAX_WALL_FACTOR 10
+// appends start over at an empty file once it is this big
+#define APPEND_MAX_BLOCKS 4096
+
+// allocations made by the benchmark and the library, counted by linking with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=posix_memalign; calls
+// libc makes internally aren't seen
+uint64_t allocation_count;
+
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void*, size_t);
+int __real_posix_memalign(void**, size_t, size_t);
+
+void* __wrap_malloc(size_t size) {
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void** ptr, size_t alignment, size_t size) {
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+struct micro_config {
+    const char* dir;
+    off_t log_size;
+    // directory sizes for name lookups, ascending
+    int file_counts[MAX_VALUES];
+    int file_count_count;
+    // file sizes in blocks for range reads
+    int block_counts[MAX_VALUES];
+    int block_count_count;
+    // segment table sizes and utilizations (percent) for the synthetic tables
+    int segment_counts[MAX_VALUES];
+    int segment_count_count;
+    int utilizations[MAX_VALUES];
+    int utilization_count;
+    // segments of a synthetic table that are clean, in percent
+    int clean_percent;
+    // size of the file overwritten by the write benchmark
+    long write_file_size;
+    // only run benchmarks whose name starts with this, NULL for all
+    const char* filter;
+    double min_time;
+    unsigned seed;
+    bool json;
+};
+
+struct micro_result {
+    char name[MAX_NAME];
+    char params[MAX_NAME];
+    long ops;
+    uint64_t ns;
+    uint64_t allocations;
+};
+
+// start of a timed section
+struct micro_timer {
+    struct timespec start;
+    uint64_t allocations;
+};
+
+// one benchmark: runs ops more operations and adds their time to result
+struct micro_bench {
+    const char* name;
+    int (*run)(struct micro_bench*, struct micro_result*, long);
+    struct micro_config* config;
+    struct lfs_data* data;
+    unsigned seed;
+    // lookups: names of the files in the directory
+    char (*names)[MAX_NAME];
+    int file_count;
+    // range reads and writes: the file and its size in blocks
+    const char* path;
+    int block_count;
+    char* buffer;
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [OPTIONS]\n"
+        "    -d DIR       directory for the benchmark log, default /tmp\n"
+        "    -l BYTES     log size, default 1G\n"
+        "    -f COUNTS    directory sizes for lookups, default 100,1000,10000\n"
+        "    -b COUNTS    file sizes in blocks for range reads, "
+        "default 16,256,4096\n"
+        "    -S COUNTS    segment table sizes, default 4096,131072\n"
+        "    -u PERCENTS  segment table utilizations, default 50,80,95\n"
+        "    -c PERCENT   clean segments in a segment table, default 2\n"
+        "    -s BYTES     size of the overwritten file, default 4M\n"
+        "    -B NAME      only run benchmarks whose name starts with NAME\n"
+        "    -t SECONDS   minimum time per benchmark, default 0.5\n"
+        "    -r SEED      random seed, default 1\n"
+        "    -j           JSON output\n"
+        "sizes take a K, M or G suffix\n", name);
+}
+
+long parse_size(const char* arg) {
+    char* end;
+    long size = strtol(arg, &end, 10);
+    if(*end == 'K' || *end == 'k') {
+        size *= KB;
+    } else if(*end == 'M' || *end == 'm') {
+        size *= KB * KB;
+    } else if(*end == 'G' || *end == 'g') {
+        size *= KB * KB * KB;
+    } else if(*end != '\0') {
+        return -1;
+    }
+
+    return size;
+}
+
+// comma separated positive integers, ascending
+int parse_list(char* arg, int* values, int* count) {
+    *count = 0;
+    for(char* value = strtok(arg, ","); value != NULL;
+            value = strtok(NULL, ",")) {
+        if(*count == MAX_VALUES) {
+            return -1;
+        }
+
+        values[*count] = atoi(value);
+        if(values[*count] <= 0
+                || (*count > 0 && values[*count] <= values[*count - 1])) {
+            return -1;
+        }
+        (*count)++;
+    }
+
+    return *count > 0 ? 0 : -1;
+}
+
+int parse_args(int argc, char* argv[], struct micro_config* config) {
+    char default_file_counts[] = "100,1000,10000";
+    char default_block_counts[] = "16,256,4096";
+    char default_segment_counts[] = "4096,131072";
+    char default_utilizations[] = "50,80,95";
+    config->dir = "/tmp";
+    config->log_size = (off_t) GB;
+    parse_list(default_file_counts, config->file_counts,
+               &(config->file_count_count));
+    parse_list(default_block_counts, config->block_counts,
+               &(config->block_count_count));
+    parse_list(default_segment_counts, config->segment_counts,
+               &(config->segment_count_count));
+    parse_list(default_utilizations, config->utilizations,
+               &(config->utilization_count));
+    config->clean_percent = 2;
+    config->write_file_size = 4 * KB * KB;
+    config->filter = NULL;
+    config->min_time = 0.5;
+    config->seed = 1;
+    config->json = false;
+    int opt;
+    int result = 0;
+    while((opt = getopt(argc, argv, "d:l:f:b:S:u:c:s:B:t:r:jh")) != -1) {
+        switch(opt) {
+        case 'd':
+            config->dir = optarg;
+            break;
+        case 'l':
+            config->log_size = parse_size(optarg);
+            break;
+        case 'f':
+            result |= parse_list(optarg, config->file_counts,
+                                 &(config->file_count_count));
+            break;
+        case 'b':
+            result |= parse_list(optarg, config->block_counts,
+                                 &(config->block_count_count));
+            break;
+        case 'S':
+            result |= parse_list(optarg, config->segment_counts,
+                                 &(config->segment_count_count));
+            break;
+        case 'u':
+            result |= parse_list(optarg, config->utilizations,
+                                 &(config->utilization_count));
+            break;
+        case 'c':
+            config->clean_percent = atoi(optarg);
+            break;
+        case 's':
+            config->write_file_size = parse_size(optarg);
+            break;
+        case 'B':
+            config->filter = optarg;
+            break;
+        case 't':
+            config->min_time = atof(optarg);
+            break;
+        case 'r':
+            config->seed = (unsigned) atoi(optarg);
+            break;
+        case 'j':
+            config->json = true;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if(result == -1 || config->log_size < 64 * DEFAULT_SEGMENT_SIZE
+            || config->clean_percent <= 0 || config->clean_percent >= 100
+            || config->write_file_size < BLOCK_SIZE
+            || config->write_file_size > config->log_size / 4
+            || config->min_time <= 0) {
+        return -1;
+    }
+
+    for(int i = 0; i < config->utilization_count; i++) {
+        if(config->utilizations[i] >= 100) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+double elapsed_sec(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec)
+            + (double) (end->tv_nsec - start->tv_nsec) / NSEC_PER_SEC;
+}
+
+void timer_start(struct micro_timer* timer) {
+    timer->allocations = allocation_count;
+    clock_gettime(CLOCK_MONOTONIC, &(timer->start));
+}
+
+void timer_stop(struct micro_timer* timer, struct micro_result* result,
+                long ops) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->ns += (uint64_t) (end.tv_sec - timer->start.tv_sec) * NSEC_PER_SEC
+            + end.tv_nsec - timer->start.tv_nsec;
+    result->allocations += allocation_count - timer->allocations;
+    result->ops += ops;
+}
+
+// whether any of the benchmarks in names is selected by the filter, so their
+// setup can be skipped when none is
+bool selected(struct micro_config* config, const char* names[], int count) {
+    for(int i = 0; i < count; i++) {
+        if(config->filter == NULL
+                || strncmp(names[i], config->filter,
+                           strlen(config->filter)) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// run bench in growing batches until it has been timed for min_time, or has
+// taken MAX_WALL_FACTOR times that in all
+int run_bench(struct micro_bench* bench, const char* params,
+              struct micro_result* results, int* result_count) {
+    struct micro_config* config = bench->config;
+    if(!selected(config, &(bench->name), 1)) {
+        return 0;
+    }
+
+    if(*result_count == MAX_RESULTS) {
+        fprintf(stderr, "too many results\n");
+
+        return -1;
+    }
+
+    struct micro_result* result = &(results[(*result_count)++]);
+    memset(result, 0, sizeof(struct micro_result));
+    snprintf(result->name, MAX_NAME, "%s", bench->name);
+    snprintf(result->params, MAX_NAME, "%s", params);
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long ops = 1; ; ops *= 2) {
+        if(bench->run(bench, result, ops) == -1) {
+            fprintf(stderr, "%s (%s) failed\n", bench->name, params);
+
+            return -1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if((double) result->ns / NSEC_PER_SEC >= config->min_time
+                || elapsed_sec(&start, &now)
+                   >= config->min_time * MAX_WALL_FACTOR) {
+            break;
+        }
+    }
+
+    if(!config->json) {
+        printf("%-28s %-20s %10ld %14.1f %10.2f\n", result->name,
+               result->params, result->ops,
+               (double) result->ns / result->ops,
+               (double) result->allocations / result->ops);
+    }
+
+    return 0;
+}
+
+// name lookups in the root directory, of files that exist (hits) or don't
+int bench_lookup_hit(struct micro_bench* bench, struct micro_result* result,
+                     long ops) {
+    struct superblock sblock;
+    if(get_superblock(bench->data, &sblock) == NULL) {
+        return -1;
+    }
+
+    struct micro_timer timer;
+    timer_start(&timer);
+    for(long i = 0; i < ops; i++) {
+        int file = rand_r(&(bench->seed)) % bench->file_count;
+        if(get_inumber(bench->data, bench->names[file], &sblock, NULL,
+                       NULL) == -1) {
+            return -1;
+        }
+    }
+    timer_stop(&timer, result, ops);
+
+    return 0;
+}
+
+int bench_lookup_miss(struct micro_bench* bench, struct micro_result* result,
+                      long ops) {
+    struct superblock sblock;
+    if(get_superblock(bench->data, &sblock) == NULL) {
+        return -1;
+    }
+
+    struct micro_timer timer;
+    timer_start(&timer);
+    for(long i = 0; i < ops; i++) {
+        if(get_inumber(bench->data, "/missing", &sblock, NULL, NULL) != -1) {
+            return -1;
+        }
+    }
+    timer_stop(&timer, result, ops);
+
+    return 0;
+}
+
+// the whole of a file, a run of blocks at a time
+int bench_read_range(struct micro_bench* bench, struct micro_result* result,
+                     long ops) {
+    struct superblock sblock;
+    struct inode file;
+    if(get_superblock(bench->data, &sblock) == NULL
+            || get_inumber(bench->data, bench->path, &sblock, NULL,
+                           &file) == -1) {
+        return -1;
+    }
+
+    struct micro_timer timer;
+    timer_start(&timer);
+    for(long i = 0; i < ops; i++) {
+        if(read_block_range(bench->data, 0, bench->block_count - 1, &file,
+                            bench->buffer) == -1) {
+            return -1;
+        }
+    }
+    timer_stop(&timer, result, ops);
+
+    return 0;
+}
+
+// a block written by lfs_write_helper at offset, the transaction around it
+// isn't timed
+int timed_write(struct micro_bench* bench, struct micro_result* result,
+                struct inode* file, off_t offset) {
+    struct superblock sblock;
+    struct log_txn txn;
+    if(get_superblock(bench->data, &sblock) == NULL
+            || get_inumber(bench->data, bench->path, &sblock, NULL,
+                           file) == -1
+            || txn_begin(&txn, bench->data, &sblock) == -1) {
+        return -1;
+    }
+
+    txn_set_data_head(&txn, file);
+    struct micro_timer timer;
+    timer_start(&timer);
+    int written = lfs_write_helper(&txn, file, bench->buffer, BLOCK_SIZE,
+                                   offset);
+    timer_stop(&timer, result, 1);
+    if(written != BLOCK_SIZE) {
+        txn_abort(&txn);
+
+        return -1;
+    }
+
+    return txn_commit(&txn, true);
+}
+
+int bench_write_append(struct micro_bench* bench,
+                       struct micro_result* result, long ops) {
+    struct inode file;
+    struct superblock sblock;
+    if(get_superblock(bench->data, &sblock) == NULL
+            || get_inumber(bench->data, bench->path, &sblock, NULL,
+                           &file) == -1) {
+        return -1;
+    }
+
+    for(long i = 0; i < ops; i++) {
+        if(file.statbuf.st_size >= (off_t) APPEND_MAX_BLOCKS * BLOCK_SIZE) {
+            if(lfs_truncate(bench->data, bench->path, 0) < 0) {
+                return -1;
+            }
+            file.statbuf.st_size = 0;
+        }
+
+        if(timed_write(bench, result, &file, file.statbuf.st_size) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int bench_write_overwrite(struct micro_bench* bench,
+                          struct micro_result* result, long ops) {
+    struct inode file;
+    for(long i = 0; i < ops; i++) {
+        int block = rand_r(&(bench->seed)) % bench->block_count;
+        if(timed_write(bench, result, &file,
+                       (off_t) block * BLOCK_SIZE) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// allocating blocks for a log head: the rest of its segment, then the next
+// clean one, the head following the blocks it allocates
+int bench_increment_tail(struct micro_bench* bench,
+                         struct micro_result* result, long ops) {
+    struct lfs_data* data = bench->data;
+    off_t first = find_next_clean_segment(data, 0, data->heads);
+    data->heads[LOG_HEAD_HOT] = first;
+    struct micro_timer timer;
+    timer_start(&timer);
+    for(long i = 0; i < ops; i++) {
+        data->heads[LOG_HEAD_HOT] = increment_tail(data,
+                data->heads[LOG_HEAD_HOT], data->heads);
+        if(data->heads[LOG_HEAD_HOT] == -1) {
+            data->heads[LOG_HEAD_HOT] = first;
+        }
+    }
+    timer_stop(&timer, result, ops);
+
+    return 0;
+}
+
+// searches for a clean segment from random places in the log
+int bench_find_clean(struct micro_bench* bench, struct micro_result* result,
+                     long ops) {
+    struct lfs_data* data = bench->data;
+    struct micro_timer timer;
+    timer_start(&timer);
+    for(long i = 0; i < ops; i++) {
+        off_t tail = (off_t) (rand_r(&(bench->seed)) % data->segment_count)
+                * data->segment_size;
+        if(find_next_clean_segment(data, tail, data->heads) == -1) {
+            return -1;
+        }
+    }
+    timer_stop(&timer, result, ops);
+
+    return 0;
+}
+
+int bench_select_victims(struct micro_bench* bench,
+                         struct micro_result* result, long ops) {
+    int victims[SEGMENTS_PER_CLEAN];
+    struct micro_timer timer;
+    timer_start(&timer);
+    for(long i = 0; i < ops; i++) {
+        if(select_victims(bench->data, victims, SEGMENTS_PER_CLEAN) <= 0) {
+            return -1;
+        }
+    }
+    timer_stop(&timer, result, ops);
+
+    return 0;
+}
+
+// a segment table of segment_count segments, clean_percent of them clean and
+// each block of the others live with utilization percent probability,
+// written up to a day ago
+struct lfs_data* synthetic_table(struct micro_config* config,
+                                 int segment_count, int utilization,
+                                 unsigned* seed) {
+    struct lfs_data* data = (struct lfs_data*)
+            calloc(1, sizeof(struct lfs_data));
+    if(data == NULL) {
+        return NULL;
+    }
+
+    set_segment_size(data, DEFAULT_SEGMENT_SIZE);
+    data->segsums = (struct segment_summary*)
+            calloc(segment_count, data->segsum_size);
+    if(data->segsums == NULL) {
+        free(data);
+
+        return NULL;
+    }
+
+    init_clean_config(&(data->clean_config));
+    data->segment_count = segment_count;
+    data->prologue_segments = 1;
+    data->log_size = (off_t) segment_count * data->segment_size;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for(int seg = data->prologue_segments; seg < segment_count; seg++) {
+        struct segment_summary* segsum = SEGSUM(data, seg);
+        if(rand_r(seed) % 100 < config->clean_percent) {
+            data->clean_segments++;
+            continue;
+        }
+
+        for(int block = 0; block < BLOCKS_PER_SEGMENT(data); block++) {
+            if(rand_r(seed) % 100 < utilization) {
+                segsum->entries[block].file_owner = 1;
+                segsum->live_bytes += BLOCK_SIZE;
+            }
+        }
+        if(segsum->live_bytes == 0) {
+            // keep the clean fraction at clean_percent
+            segsum->entries[0].file_owner = 1;
+            segsum->live_bytes = BLOCK_SIZE;
+        }
+        segsum->last_write_time.tv_sec = now.tv_sec - rand_r(seed) % 86400;
+    }
+    if(data->clean_segments == 0) {
+        // the allocation benchmarks need somewhere to go
+        memset(SEGSUM(data, segment_count - 1), 0, data->segsum_size);
+        data->clean_segments = 1;
+    }
+    // the heads other than the one allocating stay in the prologue
+    for(int head = 0; head < LOG_HEAD_COUNT; head++) {
+        data->heads[head] = 0;
+    }
+
+    return data;
+}
+
+void free_table(struct lfs_data* data) {
+    free(data->segsums);
+    free(data);
+}
+
+int run_table_benches(struct micro_config* config,
+                      struct micro_result* results, int* result_count) {
+    const char* policies[] = { "greedy", "cost-benefit" };
+    const char* names[] = { "increment_tail", "find_next_clean_segment",
+                            "select_victims/greedy",
+                            "select_victims/cost-benefit" };
+    if(!selected(config, names, 4)) {
+        return 0;
+    }
+
+    struct micro_bench bench;
+    memset(&bench, 0, sizeof(struct micro_bench));
+    bench.config = config;
+    bench.seed = config->seed;
+    char params[MAX_NAME];
+    for(int s = 0; s < config->segment_count_count; s++) {
+        for(int u = 0; u < config->utilization_count; u++) {
+            bench.data = synthetic_table(config, config->segment_counts[s],
+                                         config->utilizations[u],
+                                         &(bench.seed));
+            if(bench.data == NULL) {
+                fprintf(stderr, "malloc failed\n");
+
+                return -1;
+            }
+
+            snprintf(params, MAX_NAME, "%d segs %d%%",
+                     config->segment_counts[s], config->utilizations[u]);
+            bench.name = names[0];
+            bench.run = bench_increment_tail;
+            if(run_bench(&bench, params, results, result_count) == -1) {
+                return -1;
+            }
+
+            bench.name = names[1];
+            bench.run = bench_find_clean;
+            if(run_bench(&bench, params, results, result_count) == -1) {
+                return -1;
+            }
+
+            for(int p = 0; p < 2; p++) {
+                set_clean_option(&(bench.data->clean_config), "clean_policy",
+                                 policies[p]);
+                bench.name = names[2 + p];
+                bench.run = bench_select_victims;
+                if(run_bench(&bench, params, results, result_count) == -1) {
+                    return -1;
+                }
+            }
+            free_table(bench.data);
+        }
+    }
+
+    return 0;
+}
+
+// the log for the benchmarks that go through the filesystem, any previous one
+// is replaced
+struct lfs_data* open_log(struct micro_config* config, char* name) {
+    snprintf(name, MAX_PATH, LOG_FMT, config->dir, (int) getpid());
+    unlink(name);
+
+    return lfs_open_log(name, config->log_size);
+}
+
+int create_file(struct lfs_data* data, const char* path, const char* buffer,
+                size_t size) {
+    struct open_file* file;
+    if(lfs_create(data, path, S_IFREG | 0644, &file) != 0) {
+        fprintf(stderr, "failed to create %s\n", path);
+
+        return -1;
+    }
+
+    int written = size > 0 ? lfs_write(data, file, buffer, size, 0) : 0;
+    lfs_release(data, file);
+
+    return written == (int) size ? 0 : -1;
+}
+
+int run_lookup_benches(struct micro_config* config,
+                       struct micro_result* results, int* result_count) {
+    const char* names[] = { "get_inumber/hit", "get_inumber/miss" };
+    if(!selected(config, names, 2)) {
+        return 0;
+    }
+
+    int max_files = config->file_counts[config->file_count_count - 1];
+    char log_name[MAX_PATH];
+    struct micro_bench bench;
+    memset(&bench, 0, sizeof(struct micro_bench));
+    bench.config = config;
+    bench.seed = config->seed;
+    bench.names = calloc(max_files, MAX_NAME);
+    bench.data = open_log(config, log_name);
+    if(bench.names == NULL || bench.data == NULL) {
+        fprintf(stderr, "failed to set up %s\n", log_name);
+
+        return -1;
+    }
+
+    char params[MAX_NAME];
+    for(int f = 0; f < config->file_count_count; f++) {
+        for(; bench.file_count < config->file_counts[f]; bench.file_count++) {
+            snprintf(bench.names[bench.file_count], MAX_NAME, FILENAME_FMT,
+                     bench.file_count);
+            if(create_file(bench.data, bench.names[bench.file_count], NULL,
+                           0) == -1) {
+                return -1;
+            }
+        }
+
+        snprintf(params, MAX_NAME, "%d files", bench.file_count);
+        bench.name = names[0];
+        bench.run = bench_lookup_hit;
+        if(run_bench(&bench, params, results, result_count) == -1) {
+            return -1;
+        }
+
+        bench.name = names[1];
+        bench.run = bench_lookup_miss;
+        if(run_bench(&bench, params, results, result_count) == -1) {
+            return -1;
+        }
+    }
+    lfs_close_log(bench.data);
+    unlink(log_name);
+    free(bench.names);
+
+    return 0;
+}
+
+// a file of block_count blocks laid out in one run, and one with each of its
+// blocks in a run of its own (written a block at a time, interleaved with
+// another file's)
+int make_range_files(struct lfs_data* data, int block_count, char* buffer) {
+    struct open_file* frag;
+    struct open_file* filler;
+    if(create_file(data, "/contiguous", buffer,
+                   (size_t) block_count * BLOCK_SIZE) == -1
+            || lfs_create(data, "/fragmented", S_IFREG | 0644, &frag) != 0) {
+        return -1;
+    }
+
+    if(lfs_create(data, "/filler", S_IFREG | 0644, &filler) != 0) {
+        lfs_release(data, frag);
+
+        return -1;
+    }
+
+    int result = 0;
+    for(int block = 0; block < block_count && result == 0; block++) {
+        off_t offset = (off_t) block * BLOCK_SIZE;
+        if(lfs_write(data, frag, buffer, BLOCK_SIZE, offset) != BLOCK_SIZE
+                || lfs_write(data, filler, buffer, BLOCK_SIZE,
+                             offset) != BLOCK_SIZE) {
+            result = -1;
+        }
+    }
+    lfs_release(data, frag);
+    lfs_release(data, filler);
+
+    return result;
+}
+
+int run_file_benches(struct micro_config* config,
+                     struct micro_result* results, int* result_count) {
+    const char* names[] = { "read_block_range/contiguous",
+                            "read_block_range/fragmented",
+                            "lfs_write_helper/append",
+                            "lfs_write_helper/overwrite" };
+    if(!selected(config, names, 4)) {
+        return 0;
+    }
+
+    int max_blocks = config->block_counts[config->block_count_count - 1];
+    int write_blocks = (int) (config->write_file_size / BLOCK_SIZE);
+    if(write_blocks > max_blocks) {
+        max_blocks = write_blocks;
+    }
+
+    char log_name[MAX_PATH];
+    struct micro_bench bench;
+    memset(&bench, 0, sizeof(struct micro_bench));
+    bench.config = config;
+    bench.seed = config->seed;
+    bench.buffer = (char*) malloc((size_t) max_blocks * BLOCK_SIZE);
+    bench.data = open_log(config, log_name);
+    if(bench.buffer == NULL || bench.data == NULL) {
+        fprintf(stderr, "failed to set up %s\n", log_name);
+
+        return -1;
+    }
+
+    for(long i = 0; i < (long) max_blocks * BLOCK_SIZE; i++) {
+        bench.buffer[i] = (char) rand_r(&(bench.seed));
+    }
+
+    char params[MAX_NAME];
+    for(int b = 0; b < config->block_count_count; b++) {
+        bench.block_count = config->block_counts[b];
+        if(make_range_files(bench.data, bench.block_count,
+                            bench.buffer) == -1) {
+            fprintf(stderr, "failed to write the range files\n");
+
+            return -1;
+        }
+
+        snprintf(params, MAX_NAME, "%d blocks", bench.block_count);
+        bench.name = names[0];
+        bench.path = "/contiguous";
+        bench.run = bench_read_range;
+        if(run_bench(&bench, params, results, result_count) == -1) {
+            return -1;
+        }
+
+        bench.name = names[1];
+        bench.path = "/fragmented";
+        if(run_bench(&bench, params, results, result_count) == -1) {
+            return -1;
+        }
+
+        lfs_unlink(bench.data, "/contiguous");
+        lfs_unlink(bench.data, "/fragmented");
+        lfs_unlink(bench.data, "/filler");
+    }
+
+    bench.block_count = write_blocks;
+    if(create_file(bench.data, "/append", NULL, 0) == -1
+            || create_file(bench.data, "/overwrite", bench.buffer,
+                           (size_t) write_blocks * BLOCK_SIZE) == -1) {
+        return -1;
+    }
+
+    snprintf(params, MAX_NAME, "%d blocks", APPEND_MAX_BLOCKS);
+    bench.name = names[2];
+    bench.path = "/append";
+    bench.run = bench_write_append;
+    if(run_bench(&bench, params, results, result_count) == -1) {
+        return -1;
+    }
+
+    snprintf(params, MAX_NAME, "%d blocks", write_blocks);
+    bench.name = names[3];
+    bench.path = "/overwrite";
+    bench.run = bench_write_overwrite;
+    if(run_bench(&bench, params, results, result_count) == -1) {
+        return -1;
+    }
+
+    lfs_close_log(bench.data);
+    unlink(log_name);
+    free(bench.buffer);
+
+    return 0;
+}
+
+void print_json(struct micro_config* config, struct micro_result* results,
+                int result_count) {
+    printf("{\n  \"config\": {\"log_size\": %ld, \"clean_percent\": %d, "
+           "\"write_file_size\": %ld, \"min_time\": %f, \"seed\": %u},\n",
+           (long) config->log_size, config->clean_percent,
+           config->write_file_size, config->min_time, config->seed);
+    printf("  \"results\": [\n");
+    for(int i = 0; i < result_count; i++) {
+        printf("    {\"benchmark\": \"%s\", \"params\": \"%s\", "
+               "\"ops\": %ld, \"ns_per_op\": %f, \"allocs_per_op\": %f}%s\n",
+               results[i].name, results[i].params, results[i].ops,
+               (double) results[i].ns / results[i].ops,
+               (double) results[i].allocations / results[i].ops,
+               i + 1 < result_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct micro_config config;
+    if(parse_args(argc, argv, &config) == -1) {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    struct micro_result* results = (struct micro_result*)
+            calloc(MAX_RESULTS, sizeof(struct micro_result));
+    if(results == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return 1;
+    }
+
+    if(!config.json) {
+        printf("%-28s %-20s %10s %14s %10s\n", "benchmark", "parameters",
+               "ops", "ns/op", "allocs/op");
+    }
+    int result_count = 0;
+    if(run_lookup_benches(&config, results, &result_count) == -1
+            || run_file_benches(&config, results, &result_count) == -1
+            || run_table_benches(&config, results, &result_count) == -1) {
+        return 1;
+    }
+
+    if(config.json) {
+        print_json(&config, results, result_count);
+    }
+    free(results);
+
+    return 0;
+}
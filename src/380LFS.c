@@ -1,3 +1,5 @@
+#define FUSE_USE_VERSION 26
+
 #include "380LFS.h"
 #include "metadata_helpers.h"
 #include "file_io_ops.h"
@@ -5,51 +7,338 @@
 #include "metadata_ops.h"
 #include "fs_ops.h"
 #include "link_ops.h"
+#include "clean_policy.h"
+#include "segments.h"
+#include "latency.h"
 
 #include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// the mount's filesystem, only valid on the thread running an operation
+#define PRIVATE_DATA ((struct lfs_data*) fuse_get_context()->private_data)
+#define OPEN_FILE(fi) ((struct open_file*) (fi)->fh)
+
+// the core knows nothing of FUSE: every operation goes through a wrapper that
+// hands it the mount's lfs_data and open file, and records its latency
+static void* mount_log(struct fuse_conn_info* conn) {
+    struct lfs_data* data = PRIVATE_DATA;
+    if(lfs_init(data) == -1) {
+        fprintf(stderr, "init: unable to mount log file %s\n", data->log_name);
+
+        exit(-1);
+    }
+
+    return data;
+}
+
+static void unmount_log(void* private_data) {
+    lfs_close_log((struct lfs_data*) private_data);
+}
+
+static int timed_getattr(const char* path, struct stat* statbuf) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_GETATTR, &start,
+                          lfs_getattr(data, path, statbuf));
+}
+
+static int timed_access(const char* path, int mask) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_ACCESS, &start,
+                          lfs_access(data, path, mask));
+}
+
+static int timed_create(const char* path, mode_t mode,
+                        struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+    struct open_file* file = NULL;
+    int result = lfs_create(data, path, mode, &file);
+    fi->fh = (uint64_t) file;
+
+    return record_latency(data, LATENCY_CREATE, &start, result);
+}
+
+static int timed_utime(const char* path, struct utimbuf* ubuf) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_UTIME, &start,
+                          lfs_utime(data, path, ubuf));
+}
+
+static int timed_truncate(const char* path, off_t new_size) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_TRUNCATE, &start,
+                          lfs_truncate(data, path, new_size));
+}
+
+static int timed_setxattr(const char* path, const char* name,
+                          const char* value, size_t size, int flags) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_SETXATTR, &start,
+                          lfs_setxattr(data, path, name, value, size, flags));
+}
+
+static int timed_getxattr(const char* path, const char* name,
+                          char* value, size_t size) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_GETXATTR, &start,
+                          lfs_getxattr(data, path, name, value, size));
+}
+
+static int timed_unlink(const char* path) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_UNLINK, &start,
+                          lfs_unlink(data, path));
+}
+
+static int timed_open(const char* path, struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+    struct open_file* file = NULL;
+    int result = lfs_open(data, path, fi->flags, &file);
+    fi->fh = (uint64_t) file;
+    if(result == 0 && file->stats != NULL) {
+        // the stats file's size changes between getattr and open, reads must
+        // not be cut short (or cached) by the kernel
+        fi->direct_io = 1;
+    }
+
+    return record_latency(data, LATENCY_OPEN, &start, result);
+}
+
+static int timed_read(const char* path, char* buf, size_t size,
+                      off_t offset, struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_READ, &start,
+                          lfs_read(data, OPEN_FILE(fi), buf, size, offset));
+}
+
+static int timed_write(const char* path, const char* buf, size_t size,
+                       off_t offset, struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_WRITE, &start,
+                          lfs_write(data, OPEN_FILE(fi), buf, size, offset));
+}
+
+static int timed_fsync(const char* path, int datasync,
+                       struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_FSYNC, &start,
+                          lfs_fsync(data, OPEN_FILE(fi), datasync));
+}
+
+static int timed_flush(const char* path, struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_FLUSH, &start,
+                          lfs_flush(data, OPEN_FILE(fi)));
+}
+
+static int timed_release(const char* path, struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_RELEASE, &start,
+                          lfs_release(data, OPEN_FILE(fi)));
+}
+
+static int timed_opendir(const char* path, struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+    struct open_file* file = NULL;
+    int result = lfs_opendir(data, path, &file);
+    fi->fh = (uint64_t) file;
+
+    return record_latency(data, LATENCY_OPENDIR, &start, result);
+}
+
+static int timed_releasedir(const char* path,
+                            struct fuse_file_info* fi) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_RELEASEDIR, &start,
+                          lfs_releasedir(data, OPEN_FILE(fi)));
+}
+
+static int timed_statfs(const char* path, struct statvfs* statv) {
+    struct lfs_data* data = PRIVATE_DATA;
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_STATFS, &start,
+                          lfs_statfs(data, path, statv));
+}
 
 struct fuse_operations lfs_oper = {
-    .init = lfs_init,
-    .getattr = lfs_getattr,
-    .access = lfs_access,
-    .create = lfs_create,
-    .utime = lfs_utime,
-    .truncate = lfs_truncate,
-    .unlink = lfs_unlink,
-    .open = lfs_open,
-    .read = lfs_read,
-    .write = lfs_write,
-    .fsync = lfs_fsync,
-    .flush = lfs_flush,
-    .release = lfs_release,
-    .opendir = lfs_opendir,
-    .releasedir = lfs_releasedir,
-    .statfs = lfs_statfs,
-    .destroy = lfs_destroy
+    .init = mount_log,
+    .getattr = timed_getattr,
+    .access = timed_access,
+    .create = timed_create,
+    .utime = timed_utime,
+    .truncate = timed_truncate,
+    .setxattr = timed_setxattr,
+    .getxattr = timed_getxattr,
+    .unlink = timed_unlink,
+    .open = timed_open,
+    .read = timed_read,
+    .write = timed_write,
+    .fsync = timed_fsync,
+    .flush = timed_flush,
+    .release = timed_release,
+    .opendir = timed_opendir,
+    .releasedir = timed_releasedir,
+    .statfs = timed_statfs,
+    .destroy = unmount_log
+};
+
+#define CLEAN_OPTION_KEY 1
+#define PREALLOC_OPTION_KEY 2
+#define LOG_DIRECT_OPTION_KEY 3
+#define SEGMENT_SIZE_OPTION_KEY 4
+#define CLEAN_OPTION_NAME_MAX 32
+
+static const struct fuse_opt lfs_opts[] = {
+    FUSE_OPT_KEY("clean_policy=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_start=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_stop=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_batch=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_min_age=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_relocate=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_threads=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("clean_punch_rate=", CLEAN_OPTION_KEY),
+    FUSE_OPT_KEY("prealloc=", PREALLOC_OPTION_KEY),
+    FUSE_OPT_KEY("log_direct", LOG_DIRECT_OPTION_KEY),
+    FUSE_OPT_KEY("segment_size=", SEGMENT_SIZE_OPTION_KEY),
+    FUSE_OPT_END
 };
 
+// 380LFS options are consumed here, everything else is passed on to FUSE
+static int lfs_opt_proc(void* private_data, const char* arg, int key,
+                        struct fuse_args* outargs) {
+    struct lfs_data* data = (struct lfs_data*) private_data;
+    if(key == LOG_DIRECT_OPTION_KEY) {
+        data->direct_io = true;
+
+        return 0;
+    }
+
+    if(key == PREALLOC_OPTION_KEY) {
+        const char* mode = strchr(arg, '=') + 1;
+        if(strcmp(mode, "none") == 0) {
+            data->prealloc = PREALLOC_NONE;
+        } else if(strcmp(mode, "full") == 0) {
+            data->prealloc = PREALLOC_FULL;
+        } else if(strcmp(mode, "ahead") == 0) {
+            data->prealloc = PREALLOC_AHEAD;
+        } else {
+            fprintf(stderr, "invalid option %s\n", arg);
+
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if(key == SEGMENT_SIZE_OPTION_KEY) {
+        // bytes, or KB/MB with a K/M suffix; only a new log uses it
+        char* end;
+        long size = strtol(strchr(arg, '=') + 1, &end, 10);
+        if(*end == 'K' || *end == 'k') {
+            size *= 1 << 10;
+            end++;
+        } else if(*end == 'M' || *end == 'm') {
+            size *= 1 << 20;
+            end++;
+        }
+        if(*end != '\0' || size < MIN_SEGMENT_SIZE
+                || size > MAX_SEGMENT_SIZE) {
+            fprintf(stderr, "invalid option %s\n", arg);
+
+            return -1;
+        }
+
+        data->segment_size = (int) size;
+
+        return 0;
+    }
+
+    if(key != CLEAN_OPTION_KEY) {
+        return 1;
+    }
+
+    char name[CLEAN_OPTION_NAME_MAX];
+    const char* value = strchr(arg, '=');
+    size_t name_length = value - arg;
+    if(name_length >= CLEAN_OPTION_NAME_MAX) {
+        return -1;
+    }
+
+    memcpy(name, arg, name_length);
+    name[name_length] = '\0';
+    if(set_clean_option(&(data->clean_config), name, value + 1) != 0) {
+        fprintf(stderr, "invalid option %s\n", arg);
+
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     if(argc < 4) {
         fprintf(stderr, 
-            "Usage: %s -s [FUSE OPTS]... [MOUNTDIR] [LOGFILE] [SIZE (GB)]\n",
+            "Usage: %s -s [FUSE OPTS]... [MOUNTDIR] [LOGFILE] [SIZE (GB)]\n"
+            "cleaning options (-o, thresholds in segments or N%%):\n"
+            "    clean_policy=greedy|cost-benefit|age-threshold\n"
+            "    clean_start=N clean_stop=N clean_batch=N clean_min_age=SEC\n"
+            "    clean_relocate=read|copy_range clean_threads=N\n"
+            "    clean_punch_rate=SEGMENTS_PER_SEC\n"
+            "log file options (-o):\n"
+            "    prealloc=none|full|ahead log_direct\n"
+            "    segment_size=BYTES|NK|NM (new logs only, a power of two from\n"
+            "    64K to 64M)\n",
                 argv[0]);
         
         return 1;
     }
     
-    struct lfs_data* data = (struct lfs_data*) malloc(sizeof(struct lfs_data));
+    struct lfs_data* data = lfs_alloc(argv[argc - 2],
+                                      (off_t) atoi(argv[argc - 1]) * GB);
     if(data == NULL) {
-        fprintf(stderr, "malloc failed");
-
-        return -1;
+        return 1;
     }
 
-    data->log_name = argv[argc - 2];
-    data->log_size = (off_t) (atoi(argv[argc - 1]) * GB);
     argc -= 2;
     argv[argc] = NULL;
-    
-    return fuse_main(argc, argv, &lfs_oper, data);
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if(fuse_opt_parse(&args, data, lfs_opts, lfs_opt_proc) == -1) {
+        return 1;
+    }
+
+    int status = fuse_main(args.argc, args.argv, &lfs_oper, data);
+    fuse_opt_free_args(&args);
+
+    return status;
 }
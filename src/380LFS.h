@@ -1,13 +1,12 @@
 #ifndef _380LFS_H_
 #define _380LFS_H_
 
-#define FUSE_USE_VERSION 26
-
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
-#define PRIVATE_DATA ((struct lfs_data*) fuse_get_context()->private_data)
-
 #define GB (1 << 30)
 #define BLOCK_SIZE (1 << 12)
 #define OFFSETS_PER_BLOCK (BLOCK_SIZE / 8)
@@ -18,13 +17,21 @@
 #define MAX_FILE_SIZE (BLOCK_SIZE * MAX_BLOCK_COUNT)
 #define MAX_FILENAME 252
 #define MAX_INUMBER ((OFFSETS_PER_BLOCK - 1) * (OFFSETS_PER_BLOCK - 1))
+// files up to this size are stored in their inode block, no data blocks
+#define INLINE_DATA_SIZE (BLOCK_SIZE - 512)
 
-#define SEGMENT_SIZE (1 << 20)
-#define BLOCKS_PER_SEGMENT (SEGMENT_SIZE / BLOCK_SIZE)
+// segment size of a new log, a power of two between the limits; every log
+// records its own in the superblock and is mounted with it
+#define DEFAULT_SEGMENT_SIZE (1 << 20)
+#define MIN_SEGMENT_SIZE (1 << 16)
+#define MAX_SEGMENT_SIZE (1 << 26)
+#define BLOCKS_PER_SEGMENT(data) ((data)->segment_size / BLOCK_SIZE)
 
 // round up/down to the nearest multiple of BLOCK_SIZE
 #define ROUND_DOWN_BLOCK(size) ((size) / BLOCK_SIZE * BLOCK_SIZE)
 #define ROUND_UP_BLOCK(size) ROUND_DOWN_BLOCK((size) + BLOCK_SIZE)
+// number of blocks needed to hold size bytes
+#define BLOCK_COUNT(size) (((size) + BLOCK_SIZE - 1) / BLOCK_SIZE)
 
 #define ROOT_INUMBER 0
 #define INODE_TO_IMAP(inumber) (inumber / (OFFSETS_PER_BLOCK - 1))
@@ -47,19 +54,127 @@ struct segsum_entry {
 struct segment_summary {
     int live_bytes;
     struct timespec last_write_time;
-    struct segsum_entry entries[BLOCKS_PER_SEGMENT];
+    // BLOCKS_PER_SEGMENT of them
+    struct segsum_entry entries[];
+};
+
+// summaries are kept (and stored) back to back, segsum_size bytes apart
+#define SEGSUM(data, segment) ((struct segment_summary*) \
+        ((char*) (data)->segsums + (size_t) (segment) * (data)->segsum_size))
+
+struct clean_policy;
+struct latency_histogram;
+
+// a cleaning threshold, a number of segments or a percentage of the log
+struct clean_tunable {
+    double value;
+    bool percent;
 };
 
+struct clean_config {
+    const struct clean_policy* policy;
+    // clean below start clean segments, until there are stop
+    struct clean_tunable start;
+    struct clean_tunable stop;
+    // victims relocated per pass
+    struct clean_tunable batch;
+    int min_age_sec;
+    // RELOCATE_*
+    int relocate;
+    // threads reading victim segments
+    int threads;
+    // clean segments punched out of the log file per second, 0 for never
+    int punch_rate;
+};
+
+// counters reported through the stats file, the mount is single threaded so
+// they're updated without locking
+struct lfs_stats {
+    uint64_t user_bytes_written;
+    uint64_t user_bytes_read;
+    // blocks appended by transactions, including relocations
+    uint64_t log_bytes_written;
+    uint64_t checkpoint_bytes_written;
+    uint64_t checkpoints;
+    // calls to clean(), and victim batches relocated by them
+    uint64_t clean_runs;
+    uint64_t clean_passes;
+    uint64_t segments_cleaned;
+    uint64_t blocks_relocated;
+    // inode blocks taken from the log, each holds up to INODE_SLOTS_PER_BLOCK
+    // records
+    uint64_t inode_blocks;
+    uint64_t clean_time_ns;
+    uint64_t segments_punched;
+    uint64_t readahead_hits;
+    uint64_t readahead_misses;
+    uint64_t blocks_prefetched;
+};
+
+// log heads, each appends to a segment of its own so that blocks with similar
+// lifetimes share segments
+#define LOG_HEAD_HOT 0
+#define LOG_HEAD_COLD 1
+// blocks relocated by the cleaner
+#define LOG_HEAD_CLEAN 2
+// inodes, imaps and indirect blocks
+#define LOG_HEAD_META 3
+#define LOG_HEAD_COUNT 4
+
 struct lfs_data {
     char* log_name;
     off_t log_size;
     int fd;
-    off_t tail;
+    // PREALLOC_*
+    int prealloc;
+    // log opened with O_DIRECT, bypassing the host page cache
+    bool direct_io;
+    // offset each log head writes its next block to
+    off_t heads[LOG_HEAD_COUNT];
+    // bytes per segment, chosen when the log is created
+    int segment_size;
+    // bytes per segment summary, entries included
+    size_t segsum_size;
     int file_count;
     int max_inumber;
+    // inumbers in use and how many of each imap's, built from the imaps by
+    // the first create, NULL until then
+    bool* inumber_used;
+    int* imap_live;
     int segment_count;
+    int prologue_segments;
     int clean_segments;
+    struct clean_config clean_config;
     struct segment_summary* segsums;
+    // in-memory superblock, written to the log only at checkpoints
+    struct superblock* sblock;
+    // segment summaries changed since the last checkpoint
+    bool* segsum_dirty;
+    // segment summaries the region written next holds an older version of
+    bool* segsum_behind;
+    // bumped by every commit that changes the log, and copied to
+    // durable_generation by the checkpoint that covers it
+    unsigned long log_generation;
+    unsigned long durable_generation;
+    // region the next checkpoint goes to and generation of the last one
+    int checkpoint_region;
+    uint64_t checkpoint_generation;
+    // generation the next new inode gets
+    uint32_t inode_generation;
+    struct timespec last_checkpoint;
+    // inode block on the META head that later transactions keep adding records
+    // to, rewriting it in place, until the next checkpoint closes it; -1 if
+    // none is open, inode_block holds its contents
+    off_t inode_block_offset;
+    char* inode_block;
+    int inode_block_slots;
+    // clean segments whose space hasn't been given back to the host yet
+    bool* punch_pending;
+    double punch_budget;
+    struct timespec last_punch;
+    struct lfs_stats stats;
+    // one per LATENCY_* operation
+    struct latency_histogram* latency;
 };
 
 struct superblock {
@@ -68,6 +183,13 @@ struct superblock {
     off_t inode_map_blocks[OFFSETS_PER_BLOCK - 1];
 };
 
+// written to a checkpoint region once the rest of it is on disk; a mount loads
+// the region with the highest generation whose checksum matches
+struct checkpoint_commit {
+    uint64_t generation;
+    uint64_t checksum;
+};
+
 //TODO: keep all inode_maps in memory like real LFS
 struct inode_map {
     off_t offset;
@@ -79,8 +201,35 @@ struct inode {
     struct stat statbuf;
     off_t direct_blocks[DIRECT_BLOCK_COUNT];
     off_t double_indirect_block;
+    // tells the files that held the same inumber apart; 32 bits, so the
+    // record of an empty file still fits one inode slot
+    uint32_t generation;
+    // bumped by every transaction that dirties the inode, 32 bits for the
+    // same reason
+    uint32_t version;
+    // TEMPERATURE_*, set through the user.lfs.temperature xattr
+    int temperature;
+    // file contents while the file has no data blocks (st_blocks == 0)
+    char inline_data[INLINE_DATA_SIZE];
 };
 
+#define INODE_IS_INLINE(file) ((file)->statbuf.st_blocks == 0)
+
+// placement hint for a file's data blocks, auto picks a head from block age
+#define TEMPERATURE_AUTO 0
+#define TEMPERATURE_HOT 1
+#define TEMPERATURE_COLD 2
+
+// inodes are packed into inode blocks in fixed size slots, an imap entry is the
+// log offset of the first slot of an inode's record
+#define INODE_SLOT_SIZE 256
+#define INODE_SLOTS_PER_BLOCK (BLOCK_SIZE / INODE_SLOT_SIZE)
+#define INODE_SLOT(offset) ((offset) % BLOCK_SIZE / INODE_SLOT_SIZE)
+#define INODE_HEADER_SIZE offsetof(struct inode, inline_data)
+// bytes of an inode that are written to the log (header + inline data)
+#define INODE_RECORD_SIZE(file) (INODE_HEADER_SIZE \
+        + (INODE_IS_INLINE(file) ? (size_t) (file)->statbuf.st_size : 0))
+
 struct dir_entry {
     int inumber;
     char name[MAX_FILENAME];
@@ -90,9 +239,41 @@ struct dir_block {
     struct dir_entry entries[16];
 };
 
+// blocks [start_block, start_block + block_count) of a file, read while its
+// inode was at inode_version; writing the file or relocating its blocks
+// bumps the version, so a different one means the copy may be stale
+struct block_cache {
+    char* buffer;
+    int start_block;
+    int block_count;
+    uint32_t inode_version;
+};
+
+// sequential stream detection and prefetching for one open file
+struct readahead {
+    // offset the next read of a sequential stream starts at
+    off_t next_offset;
+    // blocks the next prefetch reads
+    int window;
+    struct block_cache cache;
+    // prefetch running on thread, it replaces cache once it has been joined
+    struct block_cache pending;
+    off_t* pending_offsets;
+    int pending_status;
+    bool in_flight;
+    pthread_t thread;
+    struct lfs_data* data;
+};
+
 struct open_file {
     struct inode file_inode;
+    // generation of the file that was opened, its inumber may be reused
+    uint32_t generation;
     int flags;
+    struct readahead readahead;
+    // contents of the stats file when it was opened, NULL for other files
+    char* stats;
+    int stats_size;
 };
 
 #endif
@@ -0,0 +1,219 @@
+#include "380LFS.h"
+#include "clean_policy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+// least utilized segments first
+static double greedy_score(double utilization, double age,
+                           struct clean_config* config) {
+    return 1 - utilization;
+}
+
+// (1-u)*age/(1+u): free space weighted by how long it is likely to stay free
+static double cost_benefit_score(double utilization, double age,
+                                 struct clean_config* config) {
+    return (1 - utilization) * age / (1 + utilization);
+}
+
+// greedy, but leaves recently written segments alone so their blocks have a
+// chance to die before they are copied
+static double age_threshold_score(double utilization, double age,
+                                  struct clean_config* config) {
+    if(age < config->min_age_sec) {
+        return -1;
+    }
+
+    return 1 - utilization;
+}
+
+static const struct clean_policy clean_policies[] = {
+    { "greedy", greedy_score },
+    { "cost-benefit", cost_benefit_score },
+    { "age-threshold", age_threshold_score }
+};
+
+#define CLEAN_POLICY_COUNT \
+        (sizeof(clean_policies) / sizeof(struct clean_policy))
+
+void init_clean_config(struct clean_config* config) {
+    memset(config, 0, sizeof(struct clean_config));
+    set_clean_option(config, "clean_policy", DEFAULT_CLEAN_POLICY);
+    config->start.value = START_CLEAN_SEGMENT_THRESHOLD;
+    config->stop.value = STOP_CLEAN_SEGMENT_THRESHOLD;
+    config->batch.value = SEGMENTS_PER_CLEAN;
+    config->min_age_sec = MIN_CLEAN_AGE_SEC;
+    config->relocate = DEFAULT_CLEAN_RELOCATE;
+    config->threads = CLEAN_READ_THREADS;
+    config->punch_rate = DEFAULT_PUNCH_RATE;
+}
+
+// a number of segments, or a percentage of the log's segments ending in %
+static int parse_tunable(const char* value, struct clean_tunable* tunable) {
+    char* end;
+    double parsed = strtod(value, &end);
+    bool percent = *end == '%';
+    if(percent) {
+        end++;
+    }
+    if(end == value || *end != '\0' || parsed < 0
+            || (percent && parsed > 100)) {
+        return -EINVAL;
+    }
+
+    tunable->value = parsed;
+    tunable->percent = percent;
+
+    return 0;
+}
+
+// returns 0, -ENOTSUP for an unknown option or -EINVAL for a bad value
+int set_clean_option(struct clean_config* config, const char* name,
+                     const char* value) {
+    if(strcmp(name, "clean_policy") == 0) {
+        for(int i = 0; i < CLEAN_POLICY_COUNT; i++) {
+            if(strcmp(value, clean_policies[i].name) == 0) {
+                config->policy = &(clean_policies[i]);
+
+                return 0;
+            }
+        }
+
+        return -EINVAL;
+    }
+
+    if(strcmp(name, "clean_start") == 0) {
+        return parse_tunable(value, &(config->start));
+    }
+
+    if(strcmp(name, "clean_stop") == 0) {
+        return parse_tunable(value, &(config->stop));
+    }
+
+    if(strcmp(name, "clean_batch") == 0) {
+        return parse_tunable(value, &(config->batch));
+    }
+
+    if(strcmp(name, "clean_min_age") == 0) {
+        char* end;
+        long seconds = strtol(value, &end, 10);
+        if(end == value || *end != '\0' || seconds < 0) {
+            return -EINVAL;
+        }
+
+        config->min_age_sec = (int) seconds;
+
+        return 0;
+    }
+
+    if(strcmp(name, "clean_threads") == 0) {
+        char* end;
+        long threads = strtol(value, &end, 10);
+        if(end == value || *end != '\0' || threads < 1
+                || threads > MAX_CLEAN_READ_THREADS) {
+            return -EINVAL;
+        }
+
+        config->threads = (int) threads;
+
+        return 0;
+    }
+
+    if(strcmp(name, "clean_punch_rate") == 0) {
+        char* end;
+        long rate = strtol(value, &end, 10);
+        if(end == value || *end != '\0' || rate < 0 || rate > INT_MAX) {
+            return -EINVAL;
+        }
+
+        config->punch_rate = (int) rate;
+
+        return 0;
+    }
+
+    if(strcmp(name, "clean_relocate") == 0) {
+        if(strcmp(value, "read") == 0) {
+            config->relocate = RELOCATE_READ;
+        } else if(strcmp(value, "copy_range") == 0) {
+            config->relocate = RELOCATE_COPY_RANGE;
+        } else {
+            return -EINVAL;
+        }
+
+        return 0;
+    }
+
+    return -ENOTSUP;
+}
+
+static int format_tunable(struct clean_tunable* tunable, char* buf,
+                          size_t size) {
+    return snprintf(buf, size, tunable->percent ? "%g%%" : "%g",
+                    tunable->value);
+}
+
+// writes the option's value to buf like snprintf, -ENOTSUP if there is no
+// such option
+int get_clean_option(struct clean_config* config, const char* name,
+                     char* buf, size_t size) {
+    if(strcmp(name, "clean_policy") == 0) {
+        return snprintf(buf, size, "%s", config->policy->name);
+    }
+
+    if(strcmp(name, "clean_start") == 0) {
+        return format_tunable(&(config->start), buf, size);
+    }
+
+    if(strcmp(name, "clean_stop") == 0) {
+        return format_tunable(&(config->stop), buf, size);
+    }
+
+    if(strcmp(name, "clean_batch") == 0) {
+        return format_tunable(&(config->batch), buf, size);
+    }
+
+    if(strcmp(name, "clean_min_age") == 0) {
+        return snprintf(buf, size, "%d", config->min_age_sec);
+    }
+
+    if(strcmp(name, "clean_threads") == 0) {
+        return snprintf(buf, size, "%d", config->threads);
+    }
+
+    if(strcmp(name, "clean_punch_rate") == 0) {
+        return snprintf(buf, size, "%d", config->punch_rate);
+    }
+
+    if(strcmp(name, "clean_relocate") == 0) {
+        return snprintf(buf, size, "%s", config->relocate == RELOCATE_COPY_RANGE
+                                                 ? "copy_range" : "read");
+    }
+
+    return -ENOTSUP;
+}
+
+// number of segments a threshold stands for in this log
+int clean_threshold(struct lfs_data* data, struct clean_tunable* tunable) {
+    if(!tunable->percent) {
+        return (int) tunable->value;
+    }
+
+    int log_segments = data->segment_count - data->prologue_segments;
+
+    return (int) (tunable->value * log_segments / 100);
+}
+
+// -EINVAL if the stop threshold resolves to fewer clean segments than the
+// start threshold in this log, the cleaner would then stop as soon as it
+// starts
+int check_clean_thresholds(struct lfs_data* data) {
+    if(clean_threshold(data, &(data->clean_config.stop))
+            < clean_threshold(data, &(data->clean_config.start))) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _CLEAN_POLICY_H_
+#define _CLEAN_POLICY_H_
+
+#include "380LFS.h"
+
+#include <stddef.h>
+
+// defaults for the cleaning options, thresholds are numbers of segments
+#define DEFAULT_CLEAN_POLICY "cost-benefit"
+// clean when number of clean segments falls below threshold
+#define START_CLEAN_SEGMENT_THRESHOLD 20
+// number of dirty segments to clean per iteration
+#define SEGMENTS_PER_CLEAN 20
+// stop cleaning once number of clean segments falls above threshold
+#define STOP_CLEAN_SEGMENT_THRESHOLD 75
+// age-threshold leaves segments written less than this many seconds ago
+#define MIN_CLEAN_AGE_SEC 60
+
+// how the cleaner moves live data blocks: through user space, or with
+// copy_file_range inside the kernel (only metadata is read)
+#define RELOCATE_READ 0
+#define RELOCATE_COPY_RANGE 1
+#define DEFAULT_CLEAN_RELOCATE RELOCATE_READ
+// victim segments read in parallel
+#define CLEAN_READ_THREADS 4
+#define MAX_CLEAN_READ_THREADS 64
+// bytes of victims read at once, fewer victims per batch with large segments
+#define MAX_CLEAN_BUFFER_SIZE (1 << 28)
+// hole punching of clean segments is off unless a rate is given
+#define DEFAULT_PUNCH_RATE 0
+
+// options can be given at mount time (-o clean_start=10%) or changed on the
+// mounted root through xattrs (user.lfs.clean_start)
+#define LFS_XATTR_PREFIX "user.lfs."
+#define CLEAN_OPTION_PREFIX "clean_"
+
+// victim selection: segments with the highest score are cleaned first, those
+// scoring 0 or less are left alone
+struct clean_policy {
+    const char* name;
+    // utilization, age in seconds
+    double (*score)(double, double, struct clean_config*);
+};
+
+void init_clean_config(struct clean_config*);
+int set_clean_option(struct clean_config*, const char*, const char*);
+int get_clean_option(struct clean_config*, const char*, char*, size_t);
+int clean_threshold(struct lfs_data*, struct clean_tunable*);
+int check_clean_thresholds(struct lfs_data*);
+
+#endif
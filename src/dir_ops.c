@@ -3,16 +3,17 @@
 #include "file_io_ops.h"
 #include "metadata_ops.h"
 
-#include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 
-int lfs_opendir(const char* path, struct fuse_file_info* fi) {
-    return lfs_open("/", fi);
+int lfs_opendir(struct lfs_data* data, const char* path,
+                struct open_file** fh) {
+    return lfs_open(data, "/", O_RDONLY, fh);
 }
 
-int lfs_releasedir(const char* path, struct fuse_file_info* fi) {
-    return lfs_release("/", fi);
+int lfs_releasedir(struct lfs_data* data, struct open_file* file) {
+    return lfs_release(data, file);
 }
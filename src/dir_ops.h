@@ -3,15 +3,11 @@
 
 #include "380LFS.h"
 
-#include <fuse.h>
+#include <sys/types.h>
 
-int lfs_opendir(const char*, struct fuse_file_info*);
-int lfs_readdir(const char*, void*, fuse_fill_dir_t, off_t,
-                struct fuse_file_info*);
-int lfs_mkdir(const char*, mode_t);
-int lfs_rmdir(const char*);
-int lfs_fsyncdir(const char*, int, struct fuse_file_info*);
-int lfs_releasedir(const char*, struct fuse_file_info*);
-int lfs_unlink(const char*);
+int lfs_opendir(struct lfs_data*, const char*, struct open_file**);
+int lfs_mkdir(struct lfs_data*, const char*, mode_t);
+int lfs_rmdir(struct lfs_data*, const char*);
+int lfs_releasedir(struct lfs_data*, struct open_file*);
 
 #endif
@@ -1,7 +1,9 @@
 #include "file_io_ops.h"
 #include "metadata_helpers.h"
+#include "log_io.h"
+#include "readahead.h"
+#include "stats.h"
 
-#include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -9,123 +11,133 @@
 #include <unistd.h>
 #include <errno.h>
 
-int lfs_create(const char* path, mode_t mode, struct fuse_file_info* fi) {
+int lfs_create(struct lfs_data* data, const char* path, mode_t mode,
+               struct open_file** fh) {
+    if(is_stats_path(path)) {
+        return -EEXIST;
+    }
+
     struct superblock sblock;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
 
-    int inumber = alloc_inumber(&sblock);
+    int inumber = alloc_inumber(data, &sblock);
     if(inumber >= MAX_INUMBER) {
         fprintf(stderr, "create: cannot allocate an inumber for %s\n", path);
         
         return -1;
     }
     
-    PRIVATE_DATA->file_count++;
-    
-    struct inode_map root_imap;
     struct inode root;
-    if(get_imap(ROOT_INUMBER, &sblock, &root_imap) == NULL
-            || get_inode(ROOT_INUMBER, &sblock, &root) == NULL) {
+    if(get_inode(data, ROOT_INUMBER, &sblock, &root) == NULL) {
         return -1;
     }
     
+    // new root data, new inode, new root inode, imap(s): one log append
+    struct log_txn txn;
+    if(txn_begin(&txn, data, &sblock) == -1) {
+        return -1;
+    }
+
     struct dir_entry d_entry;
+    memset(&d_entry, 0, sizeof(struct dir_entry));
     d_entry.inumber = inumber;
-    strncpy(d_entry.name, path, MAX_FILENAME);
-    if(lfs_write_helper(&sblock, &root_imap, &root, (char*) &d_entry, 
+    strncpy(d_entry.name, path, MAX_FILENAME - 1);
+    if(lfs_write_helper(&txn, &root, (char*) &d_entry, 
                         sizeof(struct dir_entry), 
                         root.statbuf.st_size) < sizeof(struct dir_entry)) {
+        txn_abort(&txn);
+
         return -1;
     }
 
     // create new inode for new file
-    struct inode_map new_file_imap;
     struct inode new_file;
-    if(get_imap(inumber, &sblock, &new_file_imap) == NULL) {
-        return -1;
-    }
-
+    memset(&new_file, 0, sizeof(struct inode));
     memcpy(&(new_file.statbuf), &(root.statbuf), sizeof(struct stat));
+    new_file.offset = (off_t) -1;
+    new_file.double_indirect_block = (off_t) -1;
     new_file.statbuf.st_ino = inumber;
     new_file.statbuf.st_mode = mode;
     new_file.statbuf.st_nlink = 1;
     new_file.statbuf.st_size = 0;
     new_file.statbuf.st_blocks = 0;
-    
-    // new inode, new root, new root inode, (new file imap), root imap
-    char write_buffer[2 * BLOCK_SIZE];
-    // 4 or 5 blocks
-    struct segsum_entry entries[2];
-    off_t old_offsets[2];
-    // new inode
-    entries[0].file_owner = inumber;
-    entries[0].file_offset = SEGSUM_METADATA;
-    old_offsets[0] = -1;
-    // new file imap
-    entries[1].file_owner = SEGSUM_METADATA;
-    entries[1].file_offset = INODE_TO_IMAP(inumber);
-    old_offsets[1] = new_file_imap.offset;
-
-    int pos = 0;
-    off_t tail = PRIVATE_DATA->tail;
-    new_file.offset = tail;
-    memcpy(write_buffer + pos, &new_file, BLOCK_SIZE);
-    pos += BLOCK_SIZE;
-    new_file_imap.inode_blocks[INODE_TO_IMAP_INDEX(inumber)] = tail;
-    tail = increment_tail(tail);
-    new_file_imap.offset = tail;
-    memcpy(write_buffer + pos, &new_file_imap, BLOCK_SIZE);
-    pos += BLOCK_SIZE;
-    sblock.inode_map_blocks[INODE_TO_IMAP(inumber)] = tail;
-    tail = increment_tail(tail);
-    if(log_append(&sblock, write_buffer, 2 * BLOCK_SIZE, entries, 
-                  true) == -1) {
+    new_file.generation = data->inode_generation++;
+    if(txn_dirty_inode(&txn, &new_file) == -1
+            || txn_commit(&txn, true) == -1) {
         return -1;
     }
 
-    clear_segsum_entries(old_offsets, 2);
+    data->file_count++;
+    use_inumber(data, inumber);
 
-    return init_fh(&new_file, &(fi->fh));
+    return init_fh(data, &new_file, fh);
 }
 
-int lfs_open(const char* path, struct fuse_file_info* fi) {
+int lfs_open(struct lfs_data* data, const char* path, int flags,
+             struct open_file** fh) {
+    if(is_stats_path(path)) {
+        return open_stats(data, flags, fh);
+    }
+
     struct superblock sblock;
     struct inode file;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
     
-    int inumber = get_inumber(path, &sblock, NULL, &file);
+    int inumber = get_inumber(data, path, &sblock, NULL, &file);
     if(inumber == -1) {
         fprintf(stderr, "open: file %s not found\n", path);
 
         return -1;
     }
     
-    return init_fh(&file, &(fi->fh));
+    if(init_fh(data, &file, fh) == -1) {
+        return -1;
+    }
+
+    (*fh)->flags = flags;
+
+    return 0;
 }
 
-int lfs_read(const char* path, char* buf, size_t size, off_t offset,
-             struct fuse_file_info* fi) {
+int lfs_read(struct lfs_data* data, struct open_file* file, char* buf,
+             size_t size, off_t offset) {
     //TODO: all error checking
+    if(file->stats != NULL) {
+        return read_stats(file, buf, size, offset);
+    }
+
     struct superblock sblock;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
     
-    struct open_file* file = (struct open_file*) fi->fh;
     int inumber = file->file_inode.statbuf.st_ino;
-    if(get_inode(inumber, &sblock, &(file->file_inode)) == NULL) {
-        return -1;
+    int status = get_open_inode(data, &sblock, file);
+    if(status < 0) {
+        return status;
     }
 
-    if(size == 0 || offset >= file->file_inode.statbuf.st_size) {
+    off_t file_size = file->file_inode.statbuf.st_size;
+    if(size == 0 || offset >= file_size) {
         return 0;
     }
+
+    if(offset + size > file_size) {
+        // short read at end of file
+        size = file_size - offset;
+    }
+
+    if(INODE_IS_INLINE(&(file->file_inode))) {
+        memcpy(buf, file->file_inode.inline_data + offset, size);
+        data->stats.user_bytes_read += size;
+
+        return size;
+    }
     
-    int fd = PRIVATE_DATA->fd;
     int current_block = (int) offset / BLOCK_SIZE;
     int end_block = (int) (offset + size - 1) / BLOCK_SIZE;
     if(end_block >= MAX_BLOCK_COUNT) {
@@ -133,22 +145,30 @@ int lfs_read(const char* path, char* buf, size_t size, off_t offset,
     }
 
     int read_buffer_size = (end_block - current_block + 1) * BLOCK_SIZE;
-    char* read_buffer = (char*) malloc(read_buffer_size);
+    char* read_buffer = (char*) alloc_log_buffer(read_buffer_size);
     if(read_buffer == NULL) {
         fprintf(stderr, "read: malloc failed\n");
 
         return -1;
     }
 
-    int read_result = read_block_range(current_block, end_block,
+    struct readahead* ra = &(file->readahead);
+    int read_result = read_buffer_size;
+    if(readahead_read(ra, &(file->file_inode), current_block, end_block,
+                      read_buffer) == 0) {
+        data->stats.readahead_hits++;
+    } else {
+        data->stats.readahead_misses++;
+        read_result = read_block_range(data, current_block, end_block,
                                        &(file->file_inode), read_buffer);
+    }
     if(read_result < read_buffer_size) {
         if(read_result <= 0) {
-            fprintf(stderr, "failed to read block %d of file %s\n",
-                    -read_result, path);
+            fprintf(stderr, "failed to read block %d of inode %d\n",
+                    -read_result, inumber);
         } else {
-            fprintf(stderr, "failed to read blocks %d to %d of file %s\n",
-                    current_block, end_block, path);
+            fprintf(stderr, "failed to read blocks %d to %d of inode %d\n",
+                    current_block, end_block, inumber);
         }
         free(read_buffer);
 
@@ -158,38 +178,64 @@ int lfs_read(const char* path, char* buf, size_t size, off_t offset,
     off_t starting_point = ROUND_DOWN_BLOCK(offset);
     memcpy(buf, read_buffer + (offset - starting_point), size);
     free(read_buffer);
+    readahead_advance(ra, &(file->file_inode), offset, size);
+    data->stats.user_bytes_read += size;
 
     return size;
 }
 
-int lfs_write(const char* path, const char* buf, size_t size, off_t offset,
-              struct fuse_file_info* fi) {
+int lfs_write(struct lfs_data* data, struct open_file* file, const char* buf,
+              size_t size, off_t offset) {
+    if(file->stats != NULL) {
+        return -EBADF;
+    }
+
     struct superblock sblock;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
-    struct open_file* file = (struct open_file*) fi->fh;
-    struct inode_map imap;
-    int inumber = file->file_inode.statbuf.st_ino;
-    if(get_inode(inumber, &sblock, &(file->file_inode)) == NULL
-            || get_imap(inumber, &sblock, &imap) == NULL) {
+    int status = get_open_inode(data, &sblock, file);
+    if(status < 0) {
+        return status;
+    }
+
+    struct log_txn txn;
+    if(txn_begin(&txn, data, &sblock) == -1) {
+        return -1;
+    }
+
+    txn_set_data_head(&txn, &(file->file_inode));
+    int bytes_written = lfs_write_helper(&txn, &(file->file_inode), buf, size,
+                                         offset);
+    if(bytes_written <= 0) {
+        txn_abort(&txn);
+
+        return bytes_written;
+    }
+
+    if(txn_commit(&txn, true) == -1) {
         return -1;
     }
 
-    return lfs_write_helper(&sblock, &imap, &(file->file_inode), buf, size,
-                            offset);
+    data->stats.user_bytes_written += bytes_written;
+
+    return bytes_written;
 }
 
-int lfs_flush(const char *path, struct fuse_file_info *fi) {
+int lfs_flush(struct lfs_data* data, struct open_file* file) {
+    // every write already reached the log file, durability is up to fsync
     return 0;
 }
 
-int lfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
-    return 0;
+int lfs_fsync(struct lfs_data* data, struct open_file* file, int datasync) {
+    // the checkpoint covers every file, so datasync makes no difference
+    return sync_checkpoint(data);
 }
 
-int lfs_release(const char* path, struct fuse_file_info* fi) {
-    free((struct open_file*) fi->fh);
+int lfs_release(struct lfs_data* data, struct open_file* file) {
+    free_readahead(&(file->readahead));
+    free(file->stats);
+    free(file);
 
     return 0;
 }
@@ -3,14 +3,15 @@
 
 #include "380LFS.h"
 
-#include <fuse.h>
+#include <stddef.h>
+#include <sys/types.h>
 
-int lfs_create(const char*, mode_t, struct fuse_file_info*);
-int lfs_open(const char*, struct fuse_file_info*);
-int lfs_read(const char*, char*, size_t, off_t, struct fuse_file_info*);
-int lfs_write(const char*, const char*, size_t, off_t, struct fuse_file_info*);
-int lfs_flush(const char*, struct fuse_file_info*);
-int lfs_fsync(const char*, int, struct fuse_file_info*);
-int lfs_release(const char*, struct fuse_file_info*);
+int lfs_create(struct lfs_data*, const char*, mode_t, struct open_file**);
+int lfs_open(struct lfs_data*, const char*, int, struct open_file**);
+int lfs_read(struct lfs_data*, struct open_file*, char*, size_t, off_t);
+int lfs_write(struct lfs_data*, struct open_file*, const char*, size_t, off_t);
+int lfs_flush(struct lfs_data*, struct open_file*);
+int lfs_fsync(struct lfs_data*, struct open_file*, int);
+int lfs_release(struct lfs_data*, struct open_file*);
 
 #endif
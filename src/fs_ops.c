@@ -1,25 +1,95 @@
+// fallocate, O_DIRECT
+#define _GNU_SOURCE
+
 #include "380LFS.h"
 #include "fs_ops.h"
 #include "metadata_helpers.h"
 #include "segments.h"
+#include "log_io.h"
+#include "latency.h"
+#include "clean_policy.h"
+#include "metadata_ops.h"
 
-#include <fuse.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
-void* lfs_init(struct fuse_conn_info* conn) {
-    struct lfs_data* data = PRIVATE_DATA;
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; // rw-r--r--
-    data->fd = open(data->log_name, O_CREAT | O_RDWR, mode);
-    data->segment_count = data->log_size / SEGMENT_SIZE;
+// defaults for everything lfs_init doesn't load or compute, options can be
+// changed in between
+struct lfs_data* lfs_alloc(const char* log_name, off_t log_size) {
+    struct lfs_data* data = (struct lfs_data*)
+            calloc(1, sizeof(struct lfs_data));
+    if(data == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return NULL;
+    }
+
+    data->log_name = strdup(log_name);
+    if(data->log_name == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        free(data);
+
+        return NULL;
+    }
+
+    data->log_size = log_size;
+    data->prealloc = PREALLOC_NONE;
+    data->segment_size = DEFAULT_SEGMENT_SIZE;
+    data->direct_io = false;
+    init_clean_config(&(data->clean_config));
+
+    return data;
+}
+
+// the cleaning thresholds can only be compared once the log's segment count
+// is known
+static int check_clean_options(struct lfs_data* data) {
+    if(check_clean_thresholds(data) == 0) {
+        return 0;
+    }
+
+    char start[CLEAN_XATTR_VALUE_MAX], stop[CLEAN_XATTR_VALUE_MAX];
+    get_clean_option(&(data->clean_config), "clean_start", start,
+                     CLEAN_XATTR_VALUE_MAX);
+    get_clean_option(&(data->clean_config), "clean_stop", stop,
+                     CLEAN_XATTR_VALUE_MAX);
+    fprintf(stderr, "invalid option clean_stop=%s, below clean_start=%s\n",
+            stop, start);
+
+    return -1;
+}
+
+// open the log file, creating it with log_size bytes if it doesn't exist
+int lfs_init(struct lfs_data* data) {
+    memset(&(data->stats), 0, sizeof(struct lfs_stats));
+    data->latency = (struct latency_histogram*)
+            calloc(LATENCY_OP_COUNT, sizeof(struct latency_histogram));
+    if(data->latency == NULL) {
+        fprintf(stderr, "init: malloc failed\n");
 
+        return -1;
+    }
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; // rw-r--r--
+    int flags = O_CREAT | O_RDWR;
+    if(data->direct_io) {
+        flags |= O_DIRECT;
+    }
+    data->fd = open(data->log_name, flags, mode);
+    if(data->fd == -1 && data->direct_io && errno == EINVAL) {
+        fprintf(stderr, "init: O_DIRECT not supported for %s, using the page "
+                "cache\n", data->log_name);
+        data->direct_io = false;
+        data->fd = open(data->log_name, O_CREAT | O_RDWR, mode);
+    }
     struct stat statbuf;
     if(fstat(data->fd, &statbuf) == -1) {
         fprintf(stderr, "init: unable to open log file %s\n", data->log_name);
         
-        exit(-1);
+        return -1;
     }
     
     off_t end = statbuf.st_size;
@@ -29,25 +99,65 @@ void* lfs_init(struct fuse_conn_info* conn) {
         if(init_data(data) == -1) {
             fprintf(stderr, "init: unable to load metadata\n");
 
-            exit(-1);
+            return -1;
         }
+
+        if(check_clean_options(data) == -1) {
+            return -1;
+        }
+
+        prealloc_log(data);
         
-        return data;
+        return 0;
+    }
+
+    // a new log gets the segment size asked for
+    if(set_segment_size(data, data->segment_size) == -1) {
+        return -1;
+    }
+
+    data->segment_count = data->log_size / data->segment_size;
+
+    // prepare the prologue, first segments which contain both checkpoint
+    // regions with all segment info
+    int prologue_segments = CHECKPOINT_REGIONS * CHECKPOINT_REGION_SIZE(data)
+            / data->segment_size + 1;
+    if(prologue_segments + LOG_HEAD_COUNT > data->segment_count) {
+        fprintf(stderr, "init: log file %s too small for %d byte segments\n",
+                data->log_name, data->segment_size);
+
+        return -1;
+    }
+
+    data->prologue_segments = prologue_segments;
+    if(check_clean_options(data) == -1) {
+        return -1;
     }
 
-    if(ftruncate(data->fd, data->log_size) == -1) {
+    bool allocated = false;
+    if(data->prealloc == PREALLOC_FULL) {
+        // contiguous where the host filesystem can manage it
+        allocated = fallocate(data->fd, 0, 0, data->log_size) == 0;
+    }
+    if(!allocated && ftruncate(data->fd, data->log_size) == -1) {
         fprintf(stderr, "init: failed to extend log file %s to %ld bytes\n",
                 data->log_name, data->log_size);
                 
-        exit(-1);
+        return -1;
     }
 
     // create checkpoint region and root inode
     struct superblock sblock;
     struct inode_map imap;
     struct inode root;
-    sblock.segment_size = SEGMENT_SIZE;
+    memset(&sblock, 0, sizeof(struct superblock));
+    // every inumber but the root's is free
+    for(int index = 0; index < OFFSETS_PER_BLOCK - 1; index++) {
+        imap.inode_blocks[index] = (off_t) -1;
+    }
+    sblock.segment_size = data->segment_size;
     sblock.block_size = BLOCK_SIZE;
+    memset(&root, 0, sizeof(struct inode));
     memcpy(&(root.statbuf), &statbuf, sizeof(struct stat));
     root.statbuf.st_ino = ROOT_INUMBER;
     // same permissions as log file +x, and as a directory
@@ -64,18 +174,13 @@ void* lfs_init(struct fuse_conn_info* conn) {
     root_entries[1].inumber = ROOT_INUMBER;
     strncpy(root_entries[1].name, "/", MAX_FILENAME); //..
     
-    // prepare the prologue, first segments which contain all segment info
-    int prologue_bytes = MIN_PROLOGUE_SIZE;
-    prologue_bytes += sizeof(struct segment_summary) * data->segment_count;
-
-    int prologue_segments = prologue_bytes / SEGMENT_SIZE + 1;
-    off_t prologue_end = prologue_segments * SEGMENT_SIZE;
+    off_t prologue_end = (off_t) prologue_segments * data->segment_size;
     int log_buffer_size = (int) prologue_end + 3 * BLOCK_SIZE;
-    char* log_buffer = (char*) malloc(log_buffer_size);
+    char* log_buffer = (char*) alloc_log_buffer(log_buffer_size);
     if(log_buffer == NULL) {
         fprintf(stderr, "init: malloc failed\n");
 
-        exit(-1);
+        return -1;
     }
     int pos = 0;
     sblock.inode_map_blocks[INODE_TO_IMAP(ROOT_INUMBER)] = prologue_end;
@@ -90,101 +195,162 @@ void* lfs_init(struct fuse_conn_info* conn) {
     // write root inode
     root.offset = (off_t) pos;
     root.direct_blocks[0] = pos + BLOCK_SIZE;
-    memcpy(log_buffer + pos, &root, BLOCK_SIZE);
+    memcpy(log_buffer + pos, &root, sizeof(struct inode));
     pos += BLOCK_SIZE;
 
     // write root data
-    memcpy(log_buffer + pos, &root_entries, BLOCK_SIZE);
+    memcpy(log_buffer + pos, &root_entries, sizeof(root_entries));
     pos += BLOCK_SIZE;
 
     // log: IMAP 0 | INODE 0 | INODE 0 DATA 0
-    if(write(data->fd, log_buffer, log_buffer_size) < log_buffer_size) {
+    if(log_pwrite(data, log_buffer, log_buffer_size, 0) < log_buffer_size) {
         fprintf(stderr, "init: can't initialize log file %s\n", data->log_name);
 
-        exit(-1);
+        return -1;
     }
 
     free(log_buffer);
-    data->tail = log_buffer_size;
+    // metadata continues after the root, every other head starts in a clean
+    // segment of its own
+    data->heads[LOG_HEAD_META] = log_buffer_size;
+    data->heads[LOG_HEAD_HOT] = (off_t) (prologue_segments + 1)
+            * data->segment_size;
+    data->heads[LOG_HEAD_COLD] = (off_t) (prologue_segments + 2)
+            * data->segment_size;
+    data->heads[LOG_HEAD_CLEAN] = (off_t) (prologue_segments + 3)
+            * data->segment_size;
     data->file_count = ROOT_INUMBER + 1;
     data->max_inumber = 0;
-    data->clean_segments = data->segment_count - (prologue_segments + 1);
     data->segsums = (struct segment_summary*) 
-            calloc(data->segment_count, sizeof(struct segment_summary));
+            calloc(data->segment_count, data->segsum_size);
     if(data->segsums == NULL) {
         fprintf(stderr, "init: malloc failed\n");
 
-        exit(-1);
+        return -1;
     }
 
-    int first_segment = prologue_segments + 1;
-    data->segsums[first_segment].live_bytes = log_buffer_size - SEGMENT_SIZE;
+    // imap 0, root inode and root data start the segment after the prologue
+    int first_segment = prologue_segments;
+    data->clean_segments = data->segment_count - (first_segment + 1);
+    SEGSUM(data, first_segment)->live_bytes = 3 * BLOCK_SIZE;
     // entries[0] is imap 0
-    data->segsums[first_segment].entries[0].file_owner = SEGSUM_METADATA;
-    data->segsums[first_segment].entries[0].file_offset = 0;
-    // entries[1] is inode 0
-    data->segsums[first_segment].entries[1].file_owner = SEGSUM_ROOT;
-    data->segsums[first_segment].entries[1].file_offset = SEGSUM_METADATA;
+    SEGSUM(data, first_segment)->entries[0].file_owner = SEGSUM_METADATA;
+    SEGSUM(data, first_segment)->entries[0].file_offset = 0;
+    // entries[1] is the inode block holding inode 0 in slot 0
+    SEGSUM(data, first_segment)->entries[1].file_owner = SEGSUM_INODES;
+    SEGSUM(data, first_segment)->entries[1].file_offset = 1;
     // entries[2] is file 0 at offset 0
-    data->segsums[first_segment].entries[2].file_owner = SEGSUM_ROOT;
-    data->segsums[first_segment].entries[2].file_offset = 0;
+    SEGSUM(data, first_segment)->entries[2].file_owner = SEGSUM_ROOT;
+    SEGSUM(data, first_segment)->entries[2].file_offset = 0;
     // update write times
     if(clock_gettime(CLOCK_REALTIME,
-                     &(data->segsums[first_segment].last_write_time)) == -1) {
+                     &(SEGSUM(data, first_segment)->last_write_time)) == -1) {
         fprintf(stderr, "init: failed to read clock\n");
         free(data->segsums);
 
-        exit(-1);
+        return -1;
     }
 
     for(int seg = 0; seg < prologue_segments; seg++) {
-        data->segsums[seg].live_bytes = SEGMENT_SIZE;
+        SEGSUM(data, seg)->live_bytes = data->segment_size;
         // segment 0 is all metadata: write SEGSUM_METADATA, whole segment is
         // always alive
-        memset(&(data->segsums[seg].entries), SEGSUM_METADATA,
-               BLOCKS_PER_SEGMENT * sizeof(struct segsum_entry));
-        memcpy(&(data->segsums[first_segment].last_write_time),
-               &(data->segsums[seg].last_write_time), sizeof(struct timespec));
+        memset(SEGSUM(data, seg)->entries, SEGSUM_METADATA,
+               BLOCKS_PER_SEGMENT(data) * sizeof(struct segsum_entry));
+        memcpy(&(SEGSUM(data, seg)->last_write_time),
+               &(SEGSUM(data, first_segment)->last_write_time),
+               sizeof(struct timespec));
     }
 
-    return data;
+    // first checkpoint writes every segment summary
+    data->sblock = (struct superblock*) malloc(sizeof(struct superblock));
+    if(data->sblock == NULL || init_checkpoint_state(data) == -1) {
+        fprintf(stderr, "init: malloc failed\n");
+
+        return -1;
+    }
+
+    memcpy(data->sblock, &sblock, sizeof(struct superblock));
+    for(int seg = 0; seg < data->segment_count; seg++) {
+        data->segsum_dirty[seg] = true;
+        // a new log file is all holes
+        data->punch_pending[seg] = false;
+    }
+    data->log_generation++;
+    if(sync_checkpoint(data) != 0) {
+        fprintf(stderr, "init: can't checkpoint log file %s\n",
+                data->log_name);
+
+        return -1;
+    }
+
+    if(data->prealloc == PREALLOC_AHEAD) {
+        prealloc_log(data);
+    }
+
+    return 0;
+}
+
+// allocate the log's host space up front for the prealloc option: all of it,
+// or the segments the log heads are writing to
+void prealloc_log(struct lfs_data* data) {
+    if(data->prealloc == PREALLOC_FULL) {
+        prealloc_segments(data, 0, data->segment_count);
+    } else if(data->prealloc == PREALLOC_AHEAD) {
+        for(int head = 0; head < LOG_HEAD_COUNT; head++) {
+            prealloc_segments(data, data->heads[head] / data->segment_size,
+                              1);
+        }
+    }
 }
 
-int lfs_statfs(const char *path, struct statvfs *statv) {
+int lfs_statfs(struct lfs_data* data, const char* path,
+               struct statvfs* statv) {
     statv->f_bsize = BLOCK_SIZE;
-    statv->f_blocks = PRIVATE_DATA->segment_count * BLOCKS_PER_SEGMENT;
-    statv->f_files = PRIVATE_DATA->file_count;
+    statv->f_blocks = (fsblkcnt_t) data->segment_count
+            * BLOCKS_PER_SEGMENT(data);
+    statv->f_files = data->file_count;
     statv->f_namemax = MAX_FILENAME;
 
     return 0;
 }
 
-void lfs_destroy(void* private_data) {
+void lfs_destroy(struct lfs_data* data) {
     // write in-memory status of segments to prologue so it can be recovered
     // next time backing file is mounted
-    struct lfs_data* data = (struct lfs_data*) private_data;
-    int fd = data->fd;
-    if(lseek(fd, BLOCK_SIZE, SEEK_SET) == -1) {
-        return;
-    }
+    sync_checkpoint(data);
+    free(data->segsum_dirty);
+    free(data->segsum_behind);
+    free(data->punch_pending);
+    free(data->inode_block);
+    free(data->segsums);
+    free(data->sblock);
+    free_inumbers(data);
+    free(data->latency);
+    data->latency = NULL;
+    close(data->fd);
+}
 
-    if(write(fd, &(data->tail), sizeof(off_t)) < sizeof(off_t)
-            || write(fd, &(data->file_count), sizeof(int)) < sizeof(int)
-            || write(fd, &(data->max_inumber), sizeof(int)) < sizeof(int)
-            || write(fd, &(data->segment_count), sizeof(int)) < sizeof(int)
-            || write(fd, &(data->clean_segments), sizeof(int)) < sizeof(int)) {
-        return;
+struct lfs_data* lfs_open_log(const char* log_name, off_t log_size) {
+    struct lfs_data* data = lfs_alloc(log_name, log_size);
+    if(data == NULL) {
+        return NULL;
     }
 
-    size_t segsum_bytes = sizeof(struct segment_summary);
-    for(int i = 0; i < data->segment_count; i++) {
-        if(write(fd, &(data->segsums[i]), segsum_bytes) < segsum_bytes) {
-            free(data->segsums);
+    if(lfs_init(data) == -1) {
+        fprintf(stderr, "unable to open log file %s\n", log_name);
+        free(data->latency);
+        free(data->log_name);
+        free(data);
 
-            return;
-        }
+        return NULL;
     }
 
-    free(data->segsums);
-    close(fd);
+    return data;
+}
+
+void lfs_close_log(struct lfs_data* data) {
+    lfs_destroy(data);
+    free(data->log_name);
+    free(data);
 }
@@ -3,13 +3,35 @@
 
 #include "380LFS.h"
 
-#include <fuse.h>
+#include <sys/types.h>
 #include <sys/statvfs.h>
 
-#define MIN_PROLOGUE_SIZE sizeof(off_t) + sizeof(int) * 3
+// checkpoint block, then the format's magic and version, the log heads,
+// file_count, max_inumber, segment_count, clean_segments and the next inode
+// generation, followed by the segment summaries
+#define CHECKPOINT_HEADER_SIZE (sizeof(int) * 2 \
+        + sizeof(off_t) * LOG_HEAD_COUNT + sizeof(int) * 4 + sizeof(uint32_t))
+// logs from before the two checkpoint regions have no magic
+#define CHECKPOINT_MAGIC 0x4346534c
+#define CHECKPOINT_VERSION 3
+#define MIN_PROLOGUE_SIZE (BLOCK_SIZE + CHECKPOINT_HEADER_SIZE)
+// the prologue holds two checkpoint regions laid out as above, each ending in
+// a block for its commit record; checkpoints alternate between them, so the
+// previous one is still whole while the next is written
+#define CHECKPOINT_REGIONS 2
+#define CHECKPOINT_REGION_SIZE(data) (ROUND_UP_BLOCK(MIN_PROLOGUE_SIZE \
+        + (off_t) (data)->segsum_size * (data)->segment_count) + BLOCK_SIZE)
+#define CHECKPOINT_COMMIT_OFFSET(data) (CHECKPOINT_REGION_SIZE(data) \
+        - BLOCK_SIZE)
+// write a checkpoint at least this often even if nobody calls fsync
+#define CHECKPOINT_INTERVAL_SEC 30
 
-void* lfs_init(struct fuse_conn_info*);
-int lfs_statfs(const char*, struct statvfs*);
-void lfs_destroy(void*);
+struct lfs_data* lfs_alloc(const char*, off_t);
+int lfs_init(struct lfs_data*);
+int lfs_statfs(struct lfs_data*, const char*, struct statvfs*);
+void lfs_destroy(struct lfs_data*);
+struct lfs_data* lfs_open_log(const char*, off_t);
+void lfs_close_log(struct lfs_data*);
+void prealloc_log(struct lfs_data*);
 
 #endif
@@ -0,0 +1,123 @@
+#include "latency.h"
+#include "segments.h"
+
+#include <stdio.h>
+
+static const char* latency_names[LATENCY_OP_COUNT] = {
+    "getattr", "access", "create", "utime", "truncate", "setxattr",
+    "getxattr", "unlink", "open", "read", "write", "fsync", "flush",
+    "release", "opendir", "releasedir", "statfs", "log_append", "clean",
+    "get_inumber", "read_block_range"
+};
+
+static int latency_bucket(uint64_t ns) {
+    if(ns < LATENCY_SUB_BUCKETS) {
+        return (int) ns;
+    }
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - LATENCY_SUB_BITS;
+
+    return (shift + 1) * LATENCY_SUB_BUCKETS
+            + (int) (ns >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+// largest latency that falls in bucket
+static uint64_t latency_bucket_limit(int bucket) {
+    if(bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+struct timespec latency_start() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    return start;
+}
+
+// add the time since start to op's histogram, returns result so a call can be
+// timed in its return statement
+int record_latency(struct lfs_data* data, int op, struct timespec* start,
+                   int result) {
+    if(data == NULL || data->latency == NULL) {
+        return result;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ns = (uint64_t) (now.tv_sec - start->tv_sec) * NSEC_PER_SEC
+            + now.tv_nsec - start->tv_nsec;
+    struct latency_histogram* histogram = &(data->latency[op]);
+    histogram->counts[latency_bucket(ns)]++;
+    histogram->count++;
+    if(ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+
+    return result;
+}
+
+// latency below which fraction of the recorded calls fall, to within a bucket
+uint64_t latency_percentile(struct latency_histogram* histogram,
+                            double fraction) {
+    if(histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (fraction * histogram->count);
+    if(rank >= histogram->count) {
+        rank = histogram->count - 1;
+    }
+    uint64_t seen = 0;
+    for(int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if(seen > rank) {
+            uint64_t limit = latency_bucket_limit(bucket);
+            return limit < histogram->max_ns ? limit : histogram->max_ns;
+        }
+    }
+
+    return histogram->max_ns;
+}
+
+// write every histogram as "latency_<op>_<stat> value" lines to buf, returns
+// the length written like snprintf
+int format_latency(struct latency_histogram* histograms, char* buf,
+                   size_t size) {
+    int length = 0;
+    int written;
+    struct latency_histogram* histogram;
+    for(int op = 0; op < LATENCY_OP_COUNT; op++) {
+        histogram = &(histograms[op]);
+        // once buf is full only the length is counted
+        written = snprintf((size_t) length < size ? buf + length : NULL,
+                           (size_t) length < size ? size - length : 0,
+                           "latency_%s_count %lu\n"
+                           "latency_%s_p50_ns %lu\n"
+                           "latency_%s_p99_ns %lu\n"
+                           "latency_%s_p999_ns %lu\n"
+                           "latency_%s_max_ns %lu\n",
+                           latency_names[op], (unsigned long) histogram->count,
+                           latency_names[op], (unsigned long)
+                                   latency_percentile(histogram, 0.5),
+                           latency_names[op], (unsigned long)
+                                   latency_percentile(histogram, 0.99),
+                           latency_names[op], (unsigned long)
+                                   latency_percentile(histogram, 0.999),
+                           latency_names[op],
+                           (unsigned long) histogram->max_ns);
+        if(written < 0) {
+            return -1;
+        }
+
+        length += written;
+    }
+
+    return length;
+}
@@ -0,0 +1,52 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include "380LFS.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// log-linear histogram buckets: each power of two of nanoseconds is split into
+// LATENCY_SUB_BUCKETS linear buckets, so a bucket is at most 1/16 too wide
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((65 - LATENCY_SUB_BITS) * LATENCY_SUB_BUCKETS)
+
+// FUSE operations
+#define LATENCY_GETATTR 0
+#define LATENCY_ACCESS 1
+#define LATENCY_CREATE 2
+#define LATENCY_UTIME 3
+#define LATENCY_TRUNCATE 4
+#define LATENCY_SETXATTR 5
+#define LATENCY_GETXATTR 6
+#define LATENCY_UNLINK 7
+#define LATENCY_OPEN 8
+#define LATENCY_READ 9
+#define LATENCY_WRITE 10
+#define LATENCY_FSYNC 11
+#define LATENCY_FLUSH 12
+#define LATENCY_RELEASE 13
+#define LATENCY_OPENDIR 14
+#define LATENCY_RELEASEDIR 15
+#define LATENCY_STATFS 16
+// internal phases
+#define LATENCY_LOG_APPEND 17
+#define LATENCY_CLEAN 18
+#define LATENCY_GET_INUMBER 19
+#define LATENCY_READ_BLOCK_RANGE 20
+#define LATENCY_OP_COUNT 21
+
+struct latency_histogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t max_ns;
+};
+
+struct timespec latency_start();
+int record_latency(struct lfs_data*, int, struct timespec*, int);
+uint64_t latency_percentile(struct latency_histogram*, double);
+int format_latency(struct latency_histogram*, char*, size_t);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _LFS_H_
+#define _LFS_H_
+
+// 380LFS without FUSE: the core is built into lib380LFS.a, link against it
+// and include this header
+//
+//     struct lfs_data* fs = lfs_open_log("disk.log", (off_t) GB);
+//     struct open_file* file;
+//     lfs_create(fs, "/name", S_IFREG | 0644, &file);
+//     lfs_write(fs, file, buf, size, 0);
+//     lfs_release(fs, file);
+//     lfs_close_log(fs);
+//
+// ops return 0 (or a byte count) on success and -1 or a negative errno on
+// failure, like the FUSE operations they implement; paths are names in the
+// root directory ("/name")
+// a filesystem is single threaded like the FUSE mount (-s), calls on the
+// same lfs_data must not overlap
+// inode numbers of unlinked files are reused, so a file must be released
+// before it is unlinked (FUSE hides unlinked open files until then)
+// options (prealloc, direct_io, segment_size, clean_config) are set between
+// lfs_alloc and lfs_init, lfs_open_log does both with the defaults
+
+#include "380LFS.h"
+#include "fs_ops.h"
+#include "file_io_ops.h"
+#include "dir_ops.h"
+#include "metadata_ops.h"
+#include "link_ops.h"
+
+#endif
@@ -2,46 +2,50 @@
 #include "link_ops.h"
 #include "metadata_ops.h"
 #include "metadata_helpers.h"
+#include "log_io.h"
+#include "stats.h"
 
-#include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 /*int lfs_link(const char *path, const char *newpath) {
     fprintf(stderr, "CALLED LINK\n");
     return -1;
 }*/
 
-int lfs_unlink(const char *path) {
+int lfs_unlink(struct lfs_data* data, const char* path) {
     if(strcmp(path, "/") == 0) {
         fprintf(stderr, "unlink: cannot unlink root\n");
 
         return -1;
     }
 
+    if(is_stats_path(path)) {
+        return -EACCES;
+    }
+
     struct superblock sblock;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
 
-    
-    struct inode_map root_imap;
     struct inode root;
-    if(get_imap(ROOT_INUMBER, &sblock, &root_imap) == NULL
-            || get_inode(ROOT_INUMBER, &sblock, &root) == NULL) {
+    if(get_inode(data, ROOT_INUMBER, &sblock, &root) == NULL) {
         return -1;
     }
 
     int dir_read_size = BLOCK_SIZE * root.statbuf.st_blocks;
-    struct dir_block* dblocks = (struct dir_block*) malloc(dir_read_size);
+    struct dir_block* dblocks = (struct dir_block*)
+            alloc_log_buffer(dir_read_size);
     if(dblocks == NULL) {
         fprintf(stderr, "unlink: malloc failed\n");
 
         return -1;
     }
 
-    int read_result = read_blocks_all(&root, (char*) dblocks);
+    int read_result = read_blocks_all(data, &root, (char*) dblocks);
     if(read_result < dir_read_size) {
         if(read_result <= 0) {
             fprintf(stderr, "failed to read block %d of root\n", -read_result);
@@ -67,60 +71,57 @@ int lfs_unlink(const char *path) {
     }
 
     struct inode file;
-    if(get_inode(entry_ptr->inumber, &sblock, &file) == NULL) {
+    int inumber = entry_ptr->inumber;
+    if(get_inode(data, inumber, &sblock, &file) == NULL) {
         free(dblocks);
 
         return -1;
     }
-    int old_offset_count = 1 + file.statbuf.st_blocks;
-    off_t* old_offsets = (off_t*) malloc(old_offset_count * sizeof(off_t));
-    if(old_offsets == NULL) {
-        fprintf(stderr, "unlink: malloc failed\n");
+
+    // file blocks, file inode, root data, root inode and imap(s) all go in
+    // one log append
+    struct log_txn txn;
+    if(txn_begin(&txn, data, &sblock) == -1) {
         free(dblocks);
 
         return -1;
     }
 
-    old_offsets[0] = file.offset;
-    for(int block = 0; block < file.statbuf.st_blocks; block++) {
-        old_offsets[block + 1] = file.direct_blocks[block];
-    }
-
-    if(lfs_truncate(path, 0) == -1) {
+    struct inode_map* imap = txn_get_imap(&txn, INODE_TO_IMAP(inumber));
+    if(imap == NULL
+            || release_blocks_helper(&txn, &file, 0) == -1
+            || txn_release(&txn, file.offset) == -1) {
         free(dblocks);
-        free(old_offsets);
+        txn_abort(&txn);
 
         return -1;
     }
-    if(lfs_truncate("/", 
-                    root.statbuf.st_size - sizeof(struct dir_entry)) == -1) {
-        return -1;
-    }
-
-    // replace unlinked entry with final entry
-    int entries_per_block = BLOCK_SIZE / sizeof(struct dir_entry);
-    struct dir_block* last_dblock = dblocks + root.statbuf.st_blocks - 1;
-    int last_entry_index = (entry_count - 1) % entries_per_block;
-    struct dir_entry* last_entry = &(last_dblock->entries[last_entry_index]);
-    root.statbuf.st_size -= sizeof(struct dir_entry);
-    root.statbuf.st_blocks = root.statbuf.st_size / BLOCK_SIZE + 1;
+    imap->inode_blocks[INODE_TO_IMAP_INDEX(inumber)] = (off_t) -1;
 
-    // only need to write block with removed entry, inode, imap
+    // replace unlinked entry with final entry, then drop the final entry
+    // truncate first: the write reads root blocks through its old pointers
+    struct dir_entry* last_entry = &(dblocks[0].entries[entry_count - 1]);
     off_t removed_entry_offset = entry * sizeof(struct dir_entry);
-    int write_result = lfs_write_helper(&sblock, &root_imap, &root,
-                                        (char*) last_entry,
-                                        sizeof(struct dir_entry),
-                                        removed_entry_offset);
+    off_t new_root_size = root.statbuf.st_size - sizeof(struct dir_entry);
+    if(lfs_truncate_helper(&txn, &root, new_root_size) == -1
+            || (entry < entry_count - 1
+                && lfs_write_helper(&txn, &root, (char*) last_entry,
+                                    sizeof(struct dir_entry),
+                                    removed_entry_offset)
+                        < (int) sizeof(struct dir_entry))) {
+        free(dblocks);
+        txn_abort(&txn);
+
+        return -1;
+    }
     free(dblocks);
-    if(write_result < sizeof(struct dir_entry)) {
-        free(old_offsets);
 
+    if(txn_commit(&txn, true) == -1) {
         return -1;
     }
 
-    clear_segsum_entries(old_offsets, old_offset_count);
-    free(old_offsets);
-    PRIVATE_DATA->file_count--;
+    data->file_count--;
+    release_inumber(data, inumber);
 
     return 0;
 }
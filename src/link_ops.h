@@ -1,12 +1,14 @@
 #ifndef _LINK_OPS_H_
 #define _LINK_OPS_H_
 
+#include "380LFS.h"
+
 #include <stddef.h>
 
-int lfs_link(const char*, const char*);
-int lfs_unlink(const char*);
-int lfs_readlink(const char*, char*, size_t);
-int lfs_symlink(const char*, const char*);
-int lfs_rename(const char*, const char*);
+int lfs_link(struct lfs_data*, const char*, const char*);
+int lfs_unlink(struct lfs_data*, const char*);
+int lfs_readlink(struct lfs_data*, const char*, char*, size_t);
+int lfs_symlink(struct lfs_data*, const char*, const char*);
+int lfs_rename(struct lfs_data*, const char*, const char*);
 
 #endif
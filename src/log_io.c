@@ -0,0 +1,97 @@
+#include "log_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// buffers the log is read into or written from, aligned so that O_DIRECT can
+// use them as they are
+void* alloc_log_buffer(size_t size) {
+    void* buffer;
+    if(posix_memalign(&buffer, LOG_IO_ALIGN, size) != 0) {
+        return NULL;
+    }
+
+    return buffer;
+}
+
+// an aligned buffer covering size bytes at offset, for requests O_DIRECT can't
+// take as they are; start is the log offset of its first byte
+static char* alloc_bounce(size_t size, off_t offset, off_t* start,
+                          size_t* span) {
+    *start = offset / LOG_IO_ALIGN * LOG_IO_ALIGN;
+    off_t end = (offset + (off_t) size + LOG_IO_ALIGN - 1)
+            / LOG_IO_ALIGN * LOG_IO_ALIGN;
+    *span = (size_t) (end - *start);
+    char* bounce = (char*) alloc_log_buffer(*span);
+    if(bounce == NULL) {
+        fprintf(stderr, "log io: malloc failed\n");
+    }
+
+    return bounce;
+}
+
+static bool needs_bounce(struct lfs_data* data, const void* buf, size_t size,
+                         off_t offset) {
+    return data->direct_io && !(IS_LOG_IO_ALIGNED(buf)
+            && IS_LOG_IO_ALIGNED(size) && IS_LOG_IO_ALIGNED(offset));
+}
+
+// pread from the log, through an aligned bounce buffer if the log is opened
+// with O_DIRECT and the request isn't aligned
+ssize_t log_pread(struct lfs_data* data, void* buf, size_t size,
+                  off_t offset) {
+    if(!needs_bounce(data, buf, size, offset)) {
+        return pread(data->fd, buf, size, offset);
+    }
+
+    off_t start;
+    size_t span;
+    char* bounce = alloc_bounce(size, offset, &start, &span);
+    if(bounce == NULL) {
+        return -1;
+    }
+
+    ssize_t bytes = pread(data->fd, bounce, span, start);
+    if(bytes >= 0) {
+        // only the bytes at and after offset were asked for
+        bytes -= offset - start;
+        if(bytes < 0) {
+            bytes = 0;
+        } else if((size_t) bytes > size) {
+            bytes = size;
+        }
+        memcpy(buf, bounce + (offset - start), bytes);
+    }
+    free(bounce);
+
+    return bytes;
+}
+
+// pwrite to the log; an unaligned request with O_DIRECT reads the blocks it
+// partly covers first, so their other bytes are written back unchanged
+ssize_t log_pwrite(struct lfs_data* data, const void* buf, size_t size,
+                   off_t offset) {
+    if(!needs_bounce(data, buf, size, offset)) {
+        return pwrite(data->fd, buf, size, offset);
+    }
+
+    off_t start;
+    size_t span;
+    char* bounce = alloc_bounce(size, offset, &start, &span);
+    if(bounce == NULL) {
+        return -1;
+    }
+
+    ssize_t bytes = -1;
+    if(pread(data->fd, bounce, span, start) == (ssize_t) span) {
+        memcpy(bounce + (offset - start), buf, size);
+        if(pwrite(data->fd, bounce, span, start) == (ssize_t) span) {
+            bytes = size;
+        }
+    }
+    free(bounce);
+
+    return bytes;
+}
@@ -0,0 +1,18 @@
+#ifndef _LOG_IO_H_
+#define _LOG_IO_H_
+
+#include "380LFS.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// O_DIRECT needs buffers, offsets and lengths aligned to the device's logical
+// block size, a whole block covers every common one
+#define LOG_IO_ALIGN BLOCK_SIZE
+#define IS_LOG_IO_ALIGNED(value) ((uintptr_t) (value) % LOG_IO_ALIGN == 0)
+
+void* alloc_log_buffer(size_t);
+ssize_t log_pread(struct lfs_data*, void*, size_t, off_t);
+ssize_t log_pwrite(struct lfs_data*, const void*, size_t, off_t);
+
+#endif
@@ -1,36 +1,33 @@
+// copy_file_range
+#define _GNU_SOURCE
+
 #include "metadata_helpers.h"
 #include "segments.h"
 #include "fs_ops.h"
+#include "log_io.h"
+#include "readahead.h"
+#include "stats.h"
+#include "latency.h"
 
-#include <fuse.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 
-struct superblock* get_superblock(
-        struct superblock* sblock) {
-    int fd = PRIVATE_DATA->fd;
-    if(lseek(fd, 0, SEEK_SET) == -1) {
-        fprintf(stderr, "failed to seek checkpoint region\n");
+struct superblock* get_superblock(struct lfs_data* data,
+                                  struct superblock* sblock) {
+    memcpy(sblock, data->sblock, sizeof(struct superblock));
 
-        return NULL;
-    }
-    
-    if(read(fd, sblock, BLOCK_SIZE) < BLOCK_SIZE) {
-        fprintf(stderr, "failed to read checkpoint region\n");
-        
-        return NULL;
-    }
     return sblock;
 }
 
-int get_inumber(const char* path, struct superblock* sblock,
-                struct inode_map* imap, struct inode* file) {
+static int find_inumber(struct lfs_data* data, const char* path,
+                        struct superblock* sblock, struct inode_map* imap,
+                        struct inode* file) {
     // find root dir
     struct inode root;
-    if(get_inode(ROOT_INUMBER, sblock, &root) == NULL) {
+    if(get_inode(data, ROOT_INUMBER, sblock, &root) == NULL) {
         return -1;
     }
     // search root dir entries for path
@@ -40,9 +37,8 @@ int get_inumber(const char* path, struct superblock* sblock,
     int entry_count = root.statbuf.st_size / sizeof(struct dir_entry);
     int entries_per_block = BLOCK_SIZE / sizeof(struct dir_entry);
     int entry, entry_max;
-    int fd = PRIVATE_DATA->fd;
     while(i < max_block) {
-        if(read_block(i, &root, (char*) &dblock) < BLOCK_SIZE) {
+        if(read_block(data, i, &root, (char*) &dblock) < BLOCK_SIZE) {
             fprintf(stderr, "failed to read block %d of root\n", i);
 
             return -1;
@@ -55,13 +51,15 @@ int get_inumber(const char* path, struct superblock* sblock,
         }
         while(entry < entry_max) {
             if(strcmp(dblock.entries[entry].name, path) == 0) {
-                if(imap != NULL && get_imap(dblock.entries[entry].inumber, 
-                                            sblock, imap) == NULL) {
+                if(imap != NULL
+                        && get_imap(data, dblock.entries[entry].inumber,
+                                    sblock, imap) == NULL) {
                     return -1;
                 }
 
-                if(file != NULL && get_inode(dblock.entries[entry].inumber,
-                                             sblock, file) == NULL) {
+                if(file != NULL
+                        && get_inode(data, dblock.entries[entry].inumber,
+                                     sblock, file) == NULL) {
                     return -1;
                 }
 
@@ -75,114 +73,592 @@ int get_inumber(const char* path, struct superblock* sblock,
     return -1;
 }
 
-struct inode* get_inode(int inumber, struct superblock* sblock, 
-                        struct inode* file) {
+int get_inumber(struct lfs_data* data, const char* path,
+                struct superblock* sblock, struct inode_map* imap,
+                struct inode* file) {
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_GET_INUMBER, &start,
+                          find_inumber(data, path, sblock, imap, file));
+}
+
+struct inode* get_inode(struct lfs_data* data, int inumber,
+                        struct superblock* sblock, struct inode* file) {
     struct inode_map imap;
-    if(get_imap(inumber, sblock, &imap) == NULL) {
+    if(get_imap(data, inumber, sblock, &imap) == NULL) {
         return NULL;
     }
     
-    int fd = PRIVATE_DATA->fd;
     off_t inode_offset = imap.inode_blocks[INODE_TO_IMAP_INDEX(inumber)];
-    if(lseek(fd, inode_offset, SEEK_SET) == -1) {
-        fprintf(stderr, "failed to seek to inode %d\n", inumber);
-
-        return NULL;
+    // an inode record never crosses the end of its inode block
+    size_t record_size = BLOCK_SIZE - inode_offset % BLOCK_SIZE;
+    if(record_size > sizeof(struct inode)) {
+        record_size = sizeof(struct inode);
     }
-
-    if(read(fd, file, sizeof(struct inode)) < sizeof(struct inode)) {
+    if(log_pread(data, file, record_size, inode_offset)
+            < (ssize_t) INODE_HEADER_SIZE) {
         fprintf(stderr, "failed to read inode %d\n", inumber);
 
         return NULL;
     }
+
+    if(INODE_IS_INLINE(file)) {
+        // bytes past the end of the file belong to the next slots
+        memset(file->inline_data + file->statbuf.st_size, 0,
+               INLINE_DATA_SIZE - file->statbuf.st_size);
+    }
     return file;
 }
 
-struct inode_map* get_imap(int inumber, struct superblock* sblock, 
-                           struct inode_map* imap) {
-    struct lfs_data* data = PRIVATE_DATA;
-    int fd = data->fd;
+// reload the inode of an open file; -ESTALE if the file was deleted and its
+// inumber given to another one
+int get_open_inode(struct lfs_data* data, struct superblock* sblock,
+                   struct open_file* file) {
+    int inumber = file->file_inode.statbuf.st_ino;
+    if(get_inode(data, inumber, sblock, &(file->file_inode)) == NULL) {
+        return -1;
+    }
+
+    if(file->file_inode.generation != file->generation) {
+        fprintf(stderr, "inode %d was reused since it was opened\n", inumber);
+
+        return -ESTALE;
+    }
+
+    return 0;
+}
+
+struct inode_map* get_imap(struct lfs_data* data, int inumber,
+                           struct superblock* sblock, struct inode_map* imap) {
     int imap_number = INODE_TO_IMAP(inumber);
     int max_imap_number = INODE_TO_IMAP(data->max_inumber);
     if(imap_number > max_imap_number) {
-        // this imap isn't used yet, it has no offset
+        // this imap isn't used yet, it has no offset and no inodes
         imap->offset = (off_t) -1;
+        for(int index = 0; index < OFFSETS_PER_BLOCK - 1; index++) {
+            imap->inode_blocks[index] = (off_t) -1;
+        }
 
         return imap;
     }
 
     off_t imap_offset = sblock->inode_map_blocks[imap_number];
-    if(lseek(fd, imap_offset, SEEK_SET) == -1) {
-        fprintf(stderr, "Failed to seek imap for inode %d\n", inumber);
+    if(log_pread(data, imap, BLOCK_SIZE, imap_offset) < BLOCK_SIZE) {
+        fprintf(stderr, "Failed to read imap for inode %d\n", inumber);
 
         return NULL;
     }
+    return imap;
+}
 
+// find which inumbers up to max_inumber are in use from the imaps sblock
+// points to, unlinked ones are -1 in theirs
+static int init_inumbers(struct lfs_data* data, struct superblock* sblock) {
+    data->inumber_used = (bool*) calloc(MAX_INUMBER, sizeof(bool));
+    data->imap_live = (int*) calloc(OFFSETS_PER_BLOCK - 1, sizeof(int));
+    if(data->inumber_used == NULL || data->imap_live == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        free_inumbers(data);
 
-    if(read(fd, imap, BLOCK_SIZE) < BLOCK_SIZE) {
-        fprintf(stderr, "Failed to read imap for inode %d\n", inumber);
+        return -1;
+    }
 
-        return NULL;
+    struct inode_map imap;
+    int inumber = 0;
+    for(int imap_number = 0; inumber <= data->max_inumber; imap_number++) {
+        if(get_imap(data, inumber, sblock, &imap) == NULL) {
+            free_inumbers(data);
+
+            return -1;
+        }
+
+        for(int index = 0; index < OFFSETS_PER_BLOCK - 1
+                && inumber <= data->max_inumber; index++, inumber++) {
+            if(imap.inode_blocks[index] != (off_t) -1) {
+                data->inumber_used[inumber] = true;
+                data->imap_live[imap_number]++;
+            }
+        }
     }
-    return imap;
+
+    return 0;
+}
+
+void free_inumbers(struct lfs_data* data) {
+    free(data->inumber_used);
+    free(data->imap_live);
+    data->inumber_used = NULL;
+    data->imap_live = NULL;
 }
 
-int alloc_inumber(struct superblock* sblock) {
-    int inumber = PRIVATE_DATA->max_inumber + 1;
+// a free inumber for a new file, MAX_INUMBER if there is none
+// unlinked files' inumbers are reused, the fullest imap with room first, so
+// live inodes stay packed into few imaps; max_inumber only grows once every
+// imap in use is full
+int alloc_inumber(struct lfs_data* data, struct superblock* sblock) {
+    if(data->inumber_used == NULL && init_inumbers(data, sblock) == -1) {
+        return MAX_INUMBER;
+    }
+
+    int last_imap = INODE_TO_IMAP(data->max_inumber + 1);
+    if(last_imap > OFFSETS_PER_BLOCK - 2) {
+        last_imap = OFFSETS_PER_BLOCK - 2;
+    }
+    int best = -1;
+    for(int imap_number = 0; imap_number <= last_imap; imap_number++) {
+        if(data->imap_live[imap_number] < OFFSETS_PER_BLOCK - 1
+                && (best == -1 || data->imap_live[imap_number]
+                        > data->imap_live[best])) {
+            best = imap_number;
+        }
+    }
+    if(best == -1) {
+        return MAX_INUMBER;
+    }
+
+    int inumber = best * (OFFSETS_PER_BLOCK - 1);
+    while(data->inumber_used[inumber]) {
+        inumber++;
+    }
 
     return inumber;
 }
 
-int commit_write(off_t tail, struct superblock* sblock) {
-    int fd = PRIVATE_DATA->fd;
-    PRIVATE_DATA->tail = tail;
-    if(lseek(fd, 0, SEEK_SET) == -1) {
-        fprintf(stderr, "failed to seek to checkpoint region\n");
+// record that a file was created with inumber
+void use_inumber(struct lfs_data* data, int inumber) {
+    if(inumber > data->max_inumber) {
+        data->max_inumber = inumber;
+    }
+    if(data->inumber_used != NULL && !data->inumber_used[inumber]) {
+        data->inumber_used[inumber] = true;
+        data->imap_live[INODE_TO_IMAP(inumber)]++;
+    }
+}
 
-        return -1;
+// record that the file with inumber was unlinked, its inumber can be reused
+void release_inumber(struct lfs_data* data, int inumber) {
+    if(data->inumber_used != NULL && data->inumber_used[inumber]) {
+        data->inumber_used[inumber] = false;
+        data->imap_live[INODE_TO_IMAP(inumber)]--;
     }
+}
 
-    if(write(fd, sblock, BLOCK_SIZE) < BLOCK_SIZE) {
-        fprintf(stderr, "failed to write checkpoint region\n");
+// record a completed log append in memory, it becomes durable at the next
+// checkpoint
+int commit_write(struct lfs_data* data, off_t heads[LOG_HEAD_COUNT],
+                 struct superblock* sblock) {
+    memcpy(data->heads, heads, sizeof(data->heads));
+    memcpy(data->sblock, sblock, sizeof(struct superblock));
 
+    return 0;
+}
+
+// FNV-1a over the parts of a checkpoint region that locate everything else:
+// its superblock, its header and the generation of its commit record
+// the summaries aren't covered, the commit record is only written once they
+// are on disk and a torn region never has the newest generation
+static uint64_t checkpoint_checksum(const struct superblock* sblock,
+                                    const char* header, uint64_t generation) {
+    const unsigned char* parts[3] = {
+        (const unsigned char*) sblock, (const unsigned char*) header,
+        (const unsigned char*) &generation
+    };
+    size_t part_sizes[3] = {
+        BLOCK_SIZE, CHECKPOINT_HEADER_SIZE, sizeof(uint64_t)
+    };
+    uint64_t hash = 14695981039346656037ULL;
+    for(int part = 0; part < 3; part++) {
+        for(size_t i = 0; i < part_sizes[part]; i++) {
+            hash ^= parts[part][i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+// read the superblock and header of a checkpoint region, and its generation if
+// its commit record is valid
+static int read_checkpoint_region(struct lfs_data* data, int region,
+                                  struct superblock* sblock, char* header,
+                                  uint64_t* generation) {
+    off_t region_offset = (off_t) region * CHECKPOINT_REGION_SIZE(data);
+    struct checkpoint_commit commit;
+    if(log_pread(data, sblock, BLOCK_SIZE, region_offset) < BLOCK_SIZE
+            || log_pread(data, header, CHECKPOINT_HEADER_SIZE,
+                         region_offset + BLOCK_SIZE) < CHECKPOINT_HEADER_SIZE
+            || log_pread(data, &commit, sizeof(struct checkpoint_commit),
+                         region_offset + CHECKPOINT_COMMIT_OFFSET(data))
+                    < (ssize_t) sizeof(struct checkpoint_commit)) {
         return -1;
     }
-    
+
+    if(commit.generation == 0 || commit.checksum
+            != checkpoint_checksum(sblock, header, commit.generation)) {
+        return -1;
+    }
+    *generation = commit.generation;
+
     return 0;
 }
 
+// the checkpoint header, in the order CHECKPOINT_HEADER_SIZE lists it
+static void pack_checkpoint_header(struct lfs_data* data, int clean_segments,
+                                   char* header) {
+    int magic = CHECKPOINT_MAGIC, version = CHECKPOINT_VERSION;
+    int pos = 0;
+    memcpy(header + pos, &magic, sizeof(int));
+    pos += sizeof(int);
+    memcpy(header + pos, &version, sizeof(int));
+    pos += sizeof(int);
+    memcpy(header + pos, data->heads, sizeof(data->heads));
+    pos += sizeof(data->heads);
+    memcpy(header + pos, &(data->file_count), sizeof(int));
+    pos += sizeof(int);
+    memcpy(header + pos, &(data->max_inumber), sizeof(int));
+    pos += sizeof(int);
+    memcpy(header + pos, &(data->segment_count), sizeof(int));
+    pos += sizeof(int);
+    memcpy(header + pos, &clean_segments, sizeof(int));
+    pos += sizeof(int);
+    memcpy(header + pos, &(data->inode_generation), sizeof(uint32_t));
+}
+
+// the fields of a checkpoint header after its magic and version
+static void parse_checkpoint_header(struct lfs_data* data,
+                                    const char* header) {
+    int pos = 2 * sizeof(int);
+    memcpy(data->heads, header + pos, sizeof(data->heads));
+    pos += sizeof(data->heads);
+    memcpy(&(data->file_count), header + pos, sizeof(int));
+    pos += sizeof(int);
+    memcpy(&(data->max_inumber), header + pos, sizeof(int));
+    pos += sizeof(int);
+    memcpy(&(data->segment_count), header + pos, sizeof(int));
+    pos += sizeof(int);
+    memcpy(&(data->clean_segments), header + pos, sizeof(int));
+    pos += sizeof(int);
+    memcpy(&(data->inode_generation), header + pos, sizeof(uint32_t));
+}
+
 int init_data(struct lfs_data* data) {
-    int fd = data->fd;
-    if(lseek(fd, BLOCK_SIZE, SEEK_SET) == -1) {
+    data->sblock = (struct superblock*) malloc(sizeof(struct superblock));
+    if(data->sblock == NULL) {
         return -1;
     }
 
-    if(read(fd, &(data->tail), sizeof(off_t)) < sizeof(off_t)
-            || read(fd, &(data->file_count), sizeof(int)) < sizeof(int)
-            || read(fd, &(data->max_inumber), sizeof(int)) < sizeof(int)
-            || read(fd, &(data->segment_count), sizeof(int)) < sizeof(int)
-            || read(fd, &(data->clean_segments), sizeof(int)) < sizeof(int)) {
+    // both regions hold the same geometry and rewrite it unchanged, so the
+    // first one gives it even if a crash tore the rest of that region
+    char header[CHECKPOINT_HEADER_SIZE];
+    if(log_pread(data, data->sblock, BLOCK_SIZE, 0) < BLOCK_SIZE
+            || log_pread(data, header, CHECKPOINT_HEADER_SIZE, BLOCK_SIZE)
+                    < CHECKPOINT_HEADER_SIZE) {
+        fprintf(stderr, "failed to read checkpoint region\n");
+        free(data->sblock);
+
+        return -1;
+    }
+
+    // older logs have a different checkpoint layout and can't be read
+    int magic, version;
+    memcpy(&magic, header, sizeof(int));
+    memcpy(&version, header + sizeof(int), sizeof(int));
+    if(magic != CHECKPOINT_MAGIC) {
+        fprintf(stderr, "log has no checkpoint format version, it was made "
+                "before format %d and must be recreated\n",
+                CHECKPOINT_VERSION);
+        free(data->sblock);
+
         return -1;
     }
+
+    if(version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "log has checkpoint format %d, this build reads "
+                "format %d\n", version, CHECKPOINT_VERSION);
+        free(data->sblock);
+
+        return -1;
+    }
+
+    // the block size is built in, the segment size is the log's own
+    if(data->sblock->block_size != BLOCK_SIZE) {
+        fprintf(stderr, "log has %d byte blocks, this build uses %d\n",
+                data->sblock->block_size, BLOCK_SIZE);
+        free(data->sblock);
+
+        return -1;
+    }
+
+    if(set_segment_size(data, data->sblock->segment_size) == -1) {
+        free(data->sblock);
+
+        return -1;
+    }
+
+    // the region size depends on the segment count
+    parse_checkpoint_header(data, header);
+
+    // load the newest region that was committed
+    struct superblock sblock;
+    char region_header[CHECKPOINT_HEADER_SIZE];
+    uint64_t generation, newest = 0;
+    int region = -1;
+    for(int i = 0; i < CHECKPOINT_REGIONS; i++) {
+        if(read_checkpoint_region(data, i, &sblock, region_header,
+                                  &generation) == -1 || generation <= newest) {
+            continue;
+        }
+
+        memcpy(data->sblock, &sblock, sizeof(struct superblock));
+        memcpy(header, region_header, CHECKPOINT_HEADER_SIZE);
+        newest = generation;
+        region = i;
+    }
+    if(region == -1) {
+        fprintf(stderr, "no committed checkpoint region\n");
+        free(data->sblock);
+
+        return -1;
+    }
+
+    parse_checkpoint_header(data, header);
+    data->prologue_segments = CHECKPOINT_REGIONS
+            * CHECKPOINT_REGION_SIZE(data) / data->segment_size + 1;
     data->segsums = (struct segment_summary*) 
-            calloc(data->segment_count, sizeof(struct segment_summary));
+            calloc(data->segment_count, data->segsum_size);
     if(data->segsums == NULL) {
+        free(data->sblock);
+
+        return -1;
+    }
+
+    // the summaries are stored back to back, as they are in memory
+    size_t segsums_bytes = data->segsum_size * data->segment_count;
+    off_t region_offset = (off_t) region * CHECKPOINT_REGION_SIZE(data);
+    if(log_pread(data, data->segsums, segsums_bytes,
+                 region_offset + MIN_PROLOGUE_SIZE)
+            < (ssize_t) segsums_bytes) {
+        free(data->segsums);
+        free(data->sblock);
+
+        return -1;
+    }
+
+    if(init_checkpoint_state(data) == -1) {
+        free(data->segsums);
+        free(data->sblock);
+
+        return -1;
+    }
+
+    // the next checkpoint overwrites the other region
+    data->checkpoint_region = (region + 1) % CHECKPOINT_REGIONS;
+    data->checkpoint_generation = newest;
+
+    return 0;
+}
+
+int init_checkpoint_state(struct lfs_data* data) {
+    data->segsum_dirty = (bool*) calloc(data->segment_count, sizeof(bool));
+    data->segsum_behind = (bool*) calloc(data->segment_count, sizeof(bool));
+    data->punch_pending = (bool*) calloc(data->segment_count, sizeof(bool));
+    data->inode_block = (char*) alloc_log_buffer(BLOCK_SIZE);
+    if(data->segsum_dirty == NULL || data->segsum_behind == NULL
+            || data->punch_pending == NULL || data->inode_block == NULL) {
+        free(data->segsum_dirty);
+        free(data->segsum_behind);
+        free(data->punch_pending);
+        free(data->inode_block);
+
+        return -1;
+    }
+
+    data->inode_block_offset = (off_t) -1;
+
+    // clean segments may still hold space from before the last unmount
+    for(int seg = data->prologue_segments; seg < data->segment_count; seg++) {
+        data->punch_pending[seg] = SEGSUM(data, seg)->live_bytes == 0;
+    }
+    // nothing says how old the other region is, so its first checkpoint
+    // writes every summary
+    for(int seg = 0; seg < data->segment_count; seg++) {
+        data->segsum_behind[seg] = true;
+    }
+    data->log_generation = 0;
+    data->durable_generation = 0;
+    data->checkpoint_region = 0;
+    data->checkpoint_generation = 0;
+    data->punch_budget = 0;
+    if(clock_gettime(CLOCK_MONOTONIC, &(data->last_checkpoint)) == -1) {
         return -1;
     }
 
-    size_t segsum_bytes = sizeof(struct segment_summary);
-    for(int i = 0; i < data->segment_count; i++) {
-        if(read(fd, &(data->segsums[i]), segsum_bytes) < segsum_bytes) {
-            free(data->segsums);
+    memcpy(&(data->last_punch), &(data->last_checkpoint),
+           sizeof(struct timespec));
+
+    return 0;
+}
+
+// write the superblock, runtime state and segment summaries to the checkpoint
+// region whose turn it is, sync it along with the log, then write its commit
+// record; blocks freed since the last checkpoint are written as clean, but
+// stay reserved in memory until the checkpoint is on disk
+int write_checkpoint(struct lfs_data* data) {
+    off_t region_offset = (off_t) data->checkpoint_region
+            * CHECKPOINT_REGION_SIZE(data);
+    if(log_pwrite(data, data->sblock, BLOCK_SIZE, region_offset)
+            < BLOCK_SIZE) {
+        fprintf(stderr, "failed to write checkpoint region\n");
+
+        return -1;
+    }
+    data->stats.checkpoint_bytes_written += BLOCK_SIZE;
+
+    // clean_segments as it will be once freed blocks are released
+    int clean_segments = data->clean_segments;
+    size_t segsum_bytes = data->segsum_size;
+    struct segment_summary* segsum =
+            (struct segment_summary*) malloc(segsum_bytes);
+    if(segsum == NULL) {
+        fprintf(stderr, "failed to write checkpoint: malloc failed\n");
+
+        return -1;
+    }
+
+    off_t segsum_offset = region_offset + MIN_PROLOGUE_SIZE;
+    int seg, block;
+    for(seg = 0; seg < data->segment_count; seg++) {
+        if(!data->segsum_dirty[seg] && !data->segsum_behind[seg]) {
+            continue;
+        }
+
+        memcpy(segsum, SEGSUM(data, seg), segsum_bytes);
+        for(block = 0; block < BLOCKS_PER_SEGMENT(data); block++) {
+            if(segsum->entries[block].file_owner == SEGSUM_FREED) {
+                segsum->entries[block].file_owner = 0;
+                segsum->entries[block].file_offset = 0;
+                segsum->live_bytes -= BLOCK_SIZE;
+                if(segsum->live_bytes == 0) {
+                    clean_segments++;
+                }
+            }
+        }
+        if(log_pwrite(data, segsum, segsum_bytes,
+                      segsum_offset + seg * segsum_bytes)
+                < (ssize_t) segsum_bytes) {
+            fprintf(stderr, "failed to write segment summary %d\n", seg);
+            free(segsum);
 
             return -1;
         }
+        data->stats.checkpoint_bytes_written += segsum_bytes;
+    }
+    free(segsum);
+
+    char header[CHECKPOINT_HEADER_SIZE];
+    pack_checkpoint_header(data, clean_segments, header);
+    if(log_pwrite(data, header, CHECKPOINT_HEADER_SIZE,
+                  region_offset + BLOCK_SIZE) < CHECKPOINT_HEADER_SIZE) {
+        fprintf(stderr, "failed to write checkpoint header\n");
+
+        return -1;
+    }
+    data->stats.checkpoint_bytes_written += CHECKPOINT_HEADER_SIZE;
+
+    // the commit record must not reach the disk before the blocks it covers
+    if(fdatasync(data->fd) == -1) {
+        fprintf(stderr, "failed to sync checkpoint region\n");
+
+        return -1;
+    }
+
+    struct checkpoint_commit commit;
+    commit.generation = data->checkpoint_generation + 1;
+    commit.checksum = checkpoint_checksum(data->sblock, header,
+                                          commit.generation);
+    if(log_pwrite(data, &commit, sizeof(struct checkpoint_commit),
+                  region_offset + CHECKPOINT_COMMIT_OFFSET(data))
+            < (ssize_t) sizeof(struct checkpoint_commit)) {
+        fprintf(stderr, "failed to write checkpoint commit record\n");
+
+        return -1;
+    }
+    data->stats.checkpoint_bytes_written += sizeof(struct checkpoint_commit);
+
+    return 0;
+}
+
+// blocks freed before a durable checkpoint can be reused
+void release_freed_blocks(struct lfs_data* data) {
+    struct segment_summary* segsum;
+    int seg, block;
+    for(seg = 0; seg < data->segment_count; seg++) {
+        // the region just written is the only one with these summaries
+        data->segsum_behind[seg] = data->segsum_dirty[seg];
+        if(!data->segsum_dirty[seg]) {
+            continue;
+        }
+
+        segsum = SEGSUM(data, seg);
+        for(block = 0; block < BLOCKS_PER_SEGMENT(data); block++) {
+            if(segsum->entries[block].file_owner == SEGSUM_FREED) {
+                segsum->entries[block].file_owner = 0;
+                segsum->entries[block].file_offset = 0;
+                segsum->live_bytes -= BLOCK_SIZE;
+                if(segsum->live_bytes == 0) {
+                    data->clean_segments++;
+                    data->punch_pending[seg] = true;
+                }
+            }
+        }
+        data->segsum_dirty[seg] = false;
+    }
+}
+
+// make everything appended so far durable: write a checkpoint, which syncs
+// the log before committing, and sync its commit record
+// callers that find every commit already checkpointed share that checkpoint
+// (group commit), so back-to-back fsyncs write only one
+int sync_checkpoint(struct lfs_data* data) {
+    if(data->durable_generation == data->log_generation) {
+        return 0;
     }
 
+    // the open inode block is on disk as of its last commit; closing it means
+    // no rewrite can tear a block this checkpoint points to
+    data->inode_block_offset = (off_t) -1;
+    unsigned long generation = data->log_generation;
+    if(write_checkpoint(data) == -1 || fdatasync(data->fd) == -1) {
+        fprintf(stderr, "checkpoint failed\n");
+
+        return -EIO;
+    }
+
+    data->durable_generation = generation;
+    // the next checkpoint overwrites the older region
+    data->checkpoint_generation++;
+    data->checkpoint_region = (data->checkpoint_region + 1)
+            % CHECKPOINT_REGIONS;
+    release_freed_blocks(data);
+    data->stats.checkpoints++;
+    clock_gettime(CLOCK_MONOTONIC, &(data->last_checkpoint));
+    // only segments a durable checkpoint calls clean are punched
+    punch_clean_segments(data);
+
     return 0;
 }
 
-int init_fh(struct inode* file, uint64_t* fh) {
+bool checkpoint_due(struct lfs_data* data) {
+    struct timespec now;
+    if(clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        return false;
+    }
+
+    return now.tv_sec - data->last_checkpoint.tv_sec >= CHECKPOINT_INTERVAL_SEC;
+}
+
+int init_fh(struct lfs_data* data, struct inode* file,
+            struct open_file** fh) {
     struct open_file* new_open = (struct open_file*) 
             malloc(sizeof(struct open_file));
     if(new_open == NULL) {
@@ -192,42 +668,41 @@ int init_fh(struct inode* file, uint64_t* fh) {
     }
 
     memcpy(&(new_open->file_inode), file, sizeof(struct inode));
-    *fh = (uint64_t) new_open;
+    new_open->generation = file->generation;
+    init_readahead(&(new_open->readahead), data);
+    new_open->flags = 0;
+    new_open->stats = NULL;
+    new_open->stats_size = 0;
+    *fh = new_open;
 
     return 0;
 }
 
-off_t* read_double_indirect(struct inode* file, 
-                         off_t double_indirect_block[OFFSETS_PER_BLOCK]) {
-    int fd = PRIVATE_DATA->fd;
-    if(lseek(fd, file->double_indirect_block, SEEK_SET) == -1) {
-        return NULL;
-    }
-
-    if(read(fd, double_indirect_block, BLOCK_SIZE) < BLOCK_SIZE) {
+off_t* read_double_indirect(struct lfs_data* data, struct inode* file,
+                            off_t double_indirect_block[OFFSETS_PER_BLOCK]) {
+    if(log_pread(data, double_indirect_block, BLOCK_SIZE,
+                 file->double_indirect_block) < BLOCK_SIZE) {
         return NULL;
     }
 
     return double_indirect_block;
 }
 
-off_t* read_indirect(off_t double_indirect_block[OFFSETS_PER_BLOCK], 
+off_t* read_indirect(struct lfs_data* data,
+                     off_t double_indirect_block[OFFSETS_PER_BLOCK],
                      int block_no, off_t indirect_block[OFFSETS_PER_BLOCK]) {
-    int fd = PRIVATE_DATA->fd;
     int di_index = DOUBLE_INDIRECT_INDEX(block_no);
     off_t block_offset = double_indirect_block[di_index];
-    if(lseek(fd, block_offset, SEEK_SET) == -1) {
-        return NULL;
-    }
-
-    if(read(fd, indirect_block, BLOCK_SIZE) < BLOCK_SIZE) {
+    if(log_pread(data, indirect_block, BLOCK_SIZE,
+                 block_offset) < BLOCK_SIZE) {
         return NULL;
     }
 
     return indirect_block;
 }
 
-off_t get_block_offset(int block_no, struct inode* file) {
+off_t get_block_offset(struct lfs_data* data, int block_no,
+                       struct inode* file) {
     if(block_no > file->statbuf.st_blocks) {
         fprintf(stderr, "invalid block number %d\n", block_no);
 
@@ -240,8 +715,9 @@ off_t get_block_offset(int block_no, struct inode* file) {
 
     off_t double_indirect[OFFSETS_PER_BLOCK];
     off_t indirect[OFFSETS_PER_BLOCK];
-    if(read_double_indirect(file, double_indirect) == NULL
-            || read_indirect(double_indirect, block_no, indirect) == NULL) {
+    if(read_double_indirect(data, file, double_indirect) == NULL
+            || read_indirect(data, double_indirect, block_no,
+                             indirect) == NULL) {
         fprintf(stderr, "failed to read indirect blocks\n");
 
         return -1;
@@ -250,40 +726,23 @@ off_t get_block_offset(int block_no, struct inode* file) {
     return indirect[INDIRECT_INDEX(block_no)];
 }
 
-int read_block(int block_no, struct inode* file, char buf[BLOCK_SIZE]) {
-    int fd = PRIVATE_DATA->fd;
-    off_t block_offset = get_block_offset(block_no, file);
+int read_block(struct lfs_data* data, int block_no, struct inode* file,
+               char buf[BLOCK_SIZE]) {
+    off_t block_offset = get_block_offset(data, block_no, file);
     if(block_offset == -1) {
         return -1;
     }
 
-    if(lseek(fd, block_offset, SEEK_SET) == -1) {
-        fprintf(stderr, "failed to seek to block number %d\n", block_no);
-
-        return -1;
-    }
-    return read(fd, buf, BLOCK_SIZE);
+    return log_pread(data, buf, BLOCK_SIZE, block_offset);
 }
 
-// read blocks [start, end] inclusive from file into buf, start <= end
-int read_block_range(int start_block, int end_block, struct inode* file,
-                     char* buf) {
-    if(end_block >= file->statbuf.st_blocks) {
-        fprintf(stderr, "invalid block numbers %d to %d\n", start_block, 
-                end_block);
-
-        return -1;
-    }
-
-    if(start_block > end_block) {
-        return 0;
-    }
-
-    int fd = PRIVATE_DATA->fd;
+// log offsets of blocks [start, end] inclusive of file, start <= end
+int get_block_offsets(struct lfs_data* data, int start_block, int end_block,
+                      struct inode* file, off_t* offsets) {
     off_t double_indirect[OFFSETS_PER_BLOCK];
     off_t indirect[OFFSETS_PER_BLOCK];
     if(end_block >= DIRECT_BLOCK_COUNT) {
-        if(read_double_indirect(file, double_indirect) == NULL) {
+        if(read_double_indirect(data, file, double_indirect) == NULL) {
             fprintf(stderr, "failed to read double indirect block\n");
 
             return -1;
@@ -291,7 +750,7 @@ int read_block_range(int start_block, int end_block, struct inode* file,
 
         if(start_block >= DIRECT_BLOCK_COUNT 
                 && INDIRECT_INDEX(start_block) > 0
-                && read_indirect(double_indirect, start_block, 
+                && read_indirect(data, double_indirect, start_block,
                                  indirect) == NULL) {
             fprintf(stderr, "failed to read indirect blocks\n");
 
@@ -299,58 +758,130 @@ int read_block_range(int start_block, int end_block, struct inode* file,
         }
     }
 
-    off_t block_offset;
-    int pos = 0;
-    int bytes_read;
     int indirect_index;
-    while(start_block <= end_block) {
-        if(start_block < DIRECT_BLOCK_COUNT) {
-            block_offset = file->direct_blocks[start_block];
-        } else {
-            indirect_index = INDIRECT_INDEX(start_block);
-            if(indirect_index == 0 
-                    && read_indirect(double_indirect, start_block, 
-                                     indirect) == NULL) {
-                fprintf(stderr, "failed to read indirect blocks\n");
+    for(int block = start_block; block <= end_block; block++) {
+        if(block < DIRECT_BLOCK_COUNT) {
+            offsets[block - start_block] = file->direct_blocks[block];
+            continue;
+        }
 
-                return -1;
-            }
+        indirect_index = INDIRECT_INDEX(block);
+        if(indirect_index == 0
+                && read_indirect(data, double_indirect, block,
+                                 indirect) == NULL) {
+            fprintf(stderr, "failed to read indirect blocks\n");
 
-            block_offset = indirect[indirect_index];
+            return -1;
         }
-        if(lseek(fd, block_offset, SEEK_SET) == -1) {
-            fprintf(stderr, "failed to seek to block number %d\n", start_block);
 
-            return -1;
+        offsets[block - start_block] = indirect[indirect_index];
+    }
+    return 0;
+}
+
+// read count blocks from the log offsets in offsets into buf, blocks that are
+// consecutive in the log with one read; returns the number of blocks read
+int read_block_runs(struct lfs_data* data, const off_t* offsets, int count,
+                    char* buf) {
+    int block, run;
+    size_t run_bytes;
+    for(block = 0; block < count; block += run) {
+        run = 1;
+        while(block + run < count && offsets[block + run]
+                == offsets[block] + (off_t) run * BLOCK_SIZE) {
+            run++;
         }
 
-        bytes_read = read(fd, buf + pos, BLOCK_SIZE);
-        if(bytes_read < BLOCK_SIZE) {
-            return -start_block;
+        run_bytes = (size_t) run * BLOCK_SIZE;
+        if(log_pread(data, buf + (size_t) block * BLOCK_SIZE, run_bytes,
+                     offsets[block]) < (ssize_t) run_bytes) {
+            return block;
         }
+    }
+    return count;
+}
 
-        pos += bytes_read;
-        start_block++;
+static int read_file_blocks(struct lfs_data* data, int start_block,
+                            int end_block, struct inode* file, char* buf) {
+    if(end_block >= file->statbuf.st_blocks) {
+        fprintf(stderr, "invalid block numbers %d to %d\n", start_block, 
+                end_block);
+
+        return -1;
     }
-    return pos;
+
+    if(start_block > end_block) {
+        return 0;
+    }
+
+    int count = end_block - start_block + 1;
+    off_t* offsets = (off_t*) malloc(count * sizeof(off_t));
+    if(offsets == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return -1;
+    }
+
+    if(get_block_offsets(data, start_block, end_block, file,
+                         offsets) == -1) {
+        free(offsets);
+
+        return -1;
+    }
+
+    int blocks_read = read_block_runs(data, offsets, count, buf);
+    free(offsets);
+    if(blocks_read < count) {
+        return -(start_block + blocks_read);
+    }
+
+    return count * BLOCK_SIZE;
+}
+
+// read blocks [start, end] inclusive from file into buf, start <= end
+int read_block_range(struct lfs_data* data, int start_block, int end_block,
+                     struct inode* file, char* buf) {
+    struct timespec start = latency_start();
+
+    return record_latency(data, LATENCY_READ_BLOCK_RANGE, &start,
+                          read_file_blocks(data, start_block, end_block, file,
+                                           buf));
 }
 
-int read_blocks_all(struct inode* file, char* buf) {
-    return read_block_range(0, file->statbuf.st_blocks - 1, file, buf);
+int read_blocks_all(struct lfs_data* data, struct inode* file, char* buf) {
+    return read_block_range(data, 0, file->statbuf.st_blocks - 1, file, buf);
 }
 
-// size is a multiple of BLOCK_SIZE, size >= BLOCK_SIZE
-// segsum_entries has an entry for every block in buffer
-// size / BLOCK_SIZE == number of entries in segsum entries buffer
-int log_append(struct superblock* sblock, char* buffer, size_t size,
-               struct segsum_entry* segsum_entries, bool allow_clean) {
-    struct lfs_data* data = PRIVATE_DATA;
+// copy length bytes of the log from source to dest inside the kernel, falling
+// back to a read and a write through bounce where that isn't supported
+static int copy_log_range(struct lfs_data* data, off_t source, off_t dest,
+                          size_t length, char* bounce) {
     int fd = data->fd;
-    off_t tail = data->tail;
-    // update in-memory segment summaries for blocks about to be written
-    int entry_count = size / BLOCK_SIZE;
+    loff_t in = source, out = dest;
+    ssize_t copied;
+    while(length > 0) {
+        copied = copy_file_range(fd, &in, fd, &out, length, 0);
+        if(copied <= 0) {
+            break;
+        }
+
+        length -= copied;
+    }
+    if(length == 0) {
+        return 0;
+    }
+
+    if(log_pread(data, bounce, length, in) < (ssize_t) length
+            || log_pwrite(data, bounce, length, out) < (ssize_t) length) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int write_txn_blocks(struct log_txn* txn) {
+    struct lfs_data* data = txn->data;
     struct segment_summary* segsum;
-    struct segsum_entry* entry_ptr;
     struct timespec update_time;
     if(clock_gettime(CLOCK_REALTIME, &update_time) == -1) {
         fprintf(stderr, "failed to read clock\n");
@@ -358,47 +889,68 @@ int log_append(struct superblock* sblock, char* buffer, size_t size,
         return -1;
     }
 
-    for(int entry = 0; entry < entry_count; entry++) {
-        segsum = get_segsum(tail);
-        entry_ptr = get_segsum_entry(tail);
-        memcpy(entry_ptr, &(segsum_entries[entry]),
-               sizeof(struct segsum_entry));
-        if(segsum->live_bytes == 0) {
-            data->clean_segments--;
+    int run;
+    size_t run_bytes;
+    off_t source;
+    char* run_buffer;
+    for(int block = 0; block < txn->block_count; block += run) {
+        // copied blocks form a run only if their sources are consecutive too
+        source = txn->sources[block];
+        run = 1;
+        while(block + run < txn->block_count
+                && txn->offsets[block + run]
+                        == txn->offsets[block] + (off_t) run * BLOCK_SIZE
+                && (source == (off_t) -1
+                        ? txn->sources[block + run] == (off_t) -1
+                        : txn->sources[block + run]
+                                == source + (off_t) run * BLOCK_SIZE)) {
+            run++;
         }
-        segsum->live_bytes += BLOCK_SIZE;
-        memcpy(&(segsum->last_write_time), &update_time,
-               sizeof(struct timespec));
-        if(lseek(fd, tail, SEEK_SET) == -1) {
-            fprintf(stderr, "failed to seek to tail\n");
 
-            return -1;
+        for(int i = block; i < block + run; i++) {
+            segsum = get_segsum(data, txn->offsets[i]);
+            memcpy(&(segsum->last_write_time), &update_time,
+                   sizeof(struct timespec));
+            data->segsum_dirty[txn->offsets[i] / data->segment_size] = true;
         }
+        run_bytes = (size_t) run * BLOCK_SIZE;
+        run_buffer = txn->buffer + (size_t) block * BLOCK_SIZE;
+        if(source != (off_t) -1) {
+            if(copy_log_range(data, source, txn->offsets[block], run_bytes,
+                              run_buffer) == -1) {
+                fprintf(stderr, "failed to copy within log\n");
 
-        if(write(fd, buffer + (entry * BLOCK_SIZE), BLOCK_SIZE) < BLOCK_SIZE) {
-            fprintf(stderr, "failed to write to tail\n");
+                return -1;
+            }
+        } else if(log_pwrite(data, run_buffer, run_bytes,
+                              txn->offsets[block]) < (ssize_t) run_bytes) {
+            fprintf(stderr, "failed to write to log\n");
 
             return -1;
         }
-
-        tail = increment_tail(tail);
     }
+    data->stats.log_bytes_written += (uint64_t) txn->block_count * BLOCK_SIZE;
 
-    if(commit_write(tail, sblock) == -1) {
-        return -1;
-    }
+    return commit_write(data, txn->heads, txn->sblock);
+}
 
-    if(allow_clean && data->clean_segments < START_CLEAN_SEGMENT_THRESHOLD) {
-        clean();
-    }
+// write the blocks of txn to the offsets its log heads reserved for them,
+// runs of consecutive blocks with one write (or one copy) each
+int log_append(struct log_txn* txn) {
+    struct timespec start = latency_start();
 
-    return 0;
+    return record_latency(txn->data, LATENCY_LOG_APPEND, &start,
+                          write_txn_blocks(txn));
 }
 
-int lfs_write_helper(struct superblock* sblock,
-                     struct inode_map* imap, struct inode* file,
+// adds the modified data blocks, indirect blocks and double indirect block of
+// a write to txn and marks file dirty
+// blocks are read through file's current pointers, so they must not have been
+// rewritten earlier in the same transaction
+int lfs_write_helper(struct log_txn* txn, struct inode* file,
                      const char* buf, size_t size, off_t offset) {
     int inumber = (int) file->statbuf.st_ino;
+    int file_owner = SEGSUM_OWNER(inumber);
     if(size == 0) {
         // empty write
         return 0;
@@ -413,8 +965,24 @@ int lfs_write_helper(struct superblock* sblock,
         size = MAX_FILE_SIZE - offset;
     }
     
-    // decide which blocks to read (which blocks are modified by write)
     off_t old_size = file->statbuf.st_size;
+    if(INODE_IS_INLINE(file) && offset + size <= INLINE_DATA_SIZE) {
+        // still small enough to keep in the inode block
+        if(offset > old_size) {
+            memset(file->inline_data + old_size, 0, offset - old_size);
+        }
+        memcpy(file->inline_data + offset, buf, size);
+        if(offset + size > old_size) {
+            file->statbuf.st_size = offset + size;
+        }
+        if(txn_dirty_inode(txn, file) == -1) {
+            return -1;
+        }
+
+        return size;
+    }
+
+    // decide which blocks to read (which blocks are modified by write)
     off_t starting_point;
     if(offset < old_size) {
         starting_point = ROUND_DOWN_BLOCK(offset);
@@ -423,42 +991,27 @@ int lfs_write_helper(struct superblock* sblock,
     }
     
     int blocks = (int) file->statbuf.st_blocks;
-    int start_block = (int) starting_point / BLOCK_SIZE;
-    int end_block = (int) (offset + size - 1) / BLOCK_SIZE;
+    int start_block = (int) (starting_point / BLOCK_SIZE);
+    int end_block = (int) ((offset + size - 1) / BLOCK_SIZE);
     if(end_block >= MAX_BLOCK_COUNT) {
         end_block = MAX_BLOCK_COUNT - 1;
     }
     int modify_region_size = (end_block - start_block + 1) * BLOCK_SIZE;
-    int indirect_region = 0;
-    // add 2 blocks for new inode and imap
-    int write_buffer_size = modify_region_size + 2 * BLOCK_SIZE;
-    if(end_block >= DIRECT_BLOCK_COUNT) {
-        // add a block for new double indirect
-        write_buffer_size += BLOCK_SIZE;
-
-        // add blocks for each rewritten indirect block
-        int low_indirect = DOUBLE_INDIRECT_INDEX(start_block);
-        int high_indirect = DOUBLE_INDIRECT_INDEX(end_block);
-        if(low_indirect < 0) {
-            low_indirect = 0;
-        }
-        indirect_region = (high_indirect - low_indirect + 1) * BLOCK_SIZE;
-        write_buffer_size += indirect_region;
-    }
-    char* write_buffer = (char*) malloc(write_buffer_size);
+    char* write_buffer = (char*) alloc_log_buffer(modify_region_size);
     if(write_buffer == NULL) {
         fprintf(stderr, "malloc failed\n");
         
         return -1;
     }
+    memset(write_buffer, 0, modify_region_size);
 
     int last_block = end_block;
     if(last_block >= blocks) {
         last_block = blocks - 1;
     }
     int read_range = (last_block - start_block + 1) * BLOCK_SIZE;
-    int read_result = read_block_range(start_block, last_block, file,
-                                       write_buffer);
+    int read_result = read_block_range(txn->data, start_block, last_block,
+                                       file, write_buffer);
     if(read_result < read_range) {
         if(read_result <= 0) {
             fprintf(stderr, "failed to read block %d from inode %d\n",
@@ -471,179 +1024,267 @@ int lfs_write_helper(struct superblock* sblock,
 
         return -1;
     }
-    
-    off_t tail = PRIVATE_DATA->tail;
-    // store old offsets so they can be removed from segsums after write
-    // segsum entries needed for log append
-    int entry_count = write_buffer_size / BLOCK_SIZE;
-    struct segsum_entry* entries = (struct segsum_entry*) 
-            malloc(entry_count * sizeof(struct segsum_entry));
-    if(entries == NULL) {
-        fprintf(stderr, "malloc failed\n");
-        free(write_buffer);
-        
-        return -1;
-    }
 
-    off_t* old_offsets = (off_t*) malloc(entry_count * sizeof(off_t));
-    if(old_offsets == NULL) {
-        fprintf(stderr, "malloc failed\n");
-        free(write_buffer);
-        free(entries);
-        
-        return -1;
+    if(INODE_IS_INLINE(file)) {
+        // file outgrew its inode block, inline contents become block 0
+        memcpy(write_buffer, file->inline_data, old_size);
+        memset(file->inline_data, 0, INLINE_DATA_SIZE);
     }
 
-    int pos, entry_index, current_block;
-    off_t* double_indirect;
+    // load the double indirect block and every indirect block the write
+    // passes through
+    off_t double_indirect[OFFSETS_PER_BLOCK];
+    off_t* indirects = NULL;
+    int low_indirect = 0;
+    int high_indirect = -1;
+    int d_ind_index, current_block;
     if(end_block >= DIRECT_BLOCK_COUNT) {
-        pos = modify_region_size + indirect_region;
-        entry_index = pos / BLOCK_SIZE;
-        double_indirect = (off_t*) (write_buffer + pos);
         if(blocks > DIRECT_BLOCK_COUNT) {
-            if(read_double_indirect(file, double_indirect) == NULL) {
+            if(read_double_indirect(txn->data, file,
+                                    double_indirect) == NULL) {
                 fprintf(stderr, "failed to read double indirect block\n");
                 free(write_buffer);
-                free(entries);
-                free(old_offsets);
 
                 return -1;
             }
-
-            old_offsets[entry_index] = file->double_indirect_block;
         } else {
-            old_offsets[entry_index] = (off_t) -1;
+            memset(double_indirect, 0, BLOCK_SIZE);
         }
-        entries[entry_index].file_owner = inumber;
-        entries[entry_index].file_offset = SEGSUM_DOUBLE_INDIRECT;
-        pos = modify_region_size;
-        entry_index = pos / BLOCK_SIZE;
 
-        int d_ind_index, min_block;
         current_block = start_block;
         if(current_block < DIRECT_BLOCK_COUNT) {
             current_block = DIRECT_BLOCK_COUNT;
         }
-        do {
-            d_ind_index = DOUBLE_INDIRECT_INDEX(current_block);
-            //ind_index = INDIRECT_INDEX(current_block);
-            min_block = d_ind_index * OFFSETS_PER_BLOCK + DIRECT_BLOCK_COUNT;
-            entries[entry_index].file_owner = inumber;
-            entries[entry_index].file_offset = (d_ind_index + 1) 
-                    * SEGSUM_INDIRECT;
-            if(min_block < blocks) {
-                old_offsets[entry_index] = double_indirect[d_ind_index];
-                if(read_indirect(double_indirect, current_block, 
-                                 (off_t*) (write_buffer + pos)) == NULL) {
-                    fprintf(stderr, "failed to read indirect block\n");
-                    free(write_buffer);
-                    free(entries);
-                    free(old_offsets);
+        low_indirect = DOUBLE_INDIRECT_INDEX(current_block);
+        high_indirect = DOUBLE_INDIRECT_INDEX(end_block);
+        indirects = (off_t*) calloc(high_indirect - low_indirect + 1,
+                                    BLOCK_SIZE);
+        if(indirects == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            free(write_buffer);
 
-                    return -1;
-                }
-            } else {
-                old_offsets[entry_index] = (off_t) -1;
-            }
+            return -1;
+        }
 
-            pos += BLOCK_SIZE;
-            entry_index++;
-            current_block += OFFSETS_PER_BLOCK;
-        } while(current_block <= end_block);
-    }
+        for(d_ind_index = low_indirect; d_ind_index <= high_indirect;
+                d_ind_index++) {
+            current_block = d_ind_index * OFFSETS_PER_BLOCK
+                    + DIRECT_BLOCK_COUNT;
+            if(current_block < blocks
+                    && read_indirect(txn->data, double_indirect,
+                                     current_block,
+                                     indirects + (d_ind_index - low_indirect)
+                                             * OFFSETS_PER_BLOCK) == NULL) {
+                fprintf(stderr, "failed to read indirect block\n");
+                free(write_buffer);
+                free(indirects);
 
-    off_t* indirect_ptr = (off_t*) (write_buffer + modify_region_size);
-    current_block = start_block;
-    if(current_block >= DIRECT_BLOCK_COUNT) {
-        indirect_ptr += INDIRECT_INDEX(current_block);
-    }
-    entry_index = 0;
-    do {
-        entries[entry_index].file_owner = inumber;
-        entries[entry_index].file_offset = (off_t) current_block * BLOCK_SIZE;
-        if(current_block < DIRECT_BLOCK_COUNT) {
-            if(current_block >= blocks) {
-                old_offsets[entry_index] = (off_t) -1;
-            } else {
-                old_offsets[entry_index] = file->direct_blocks[current_block];
-            }
-            file->direct_blocks[current_block] = tail;
-        } else {
-            if(current_block >= blocks) {
-                old_offsets[entry_index] = (off_t) -1;
-            } else {
-                old_offsets[entry_index] = *indirect_ptr;
+                return -1;
             }
-            *indirect_ptr = tail;
-            indirect_ptr++;
         }
-        tail = increment_tail(tail);
-        entry_index++;
-        current_block++;
-    } while(current_block <= end_block);
-    entry_index = entry_count - 2;
-    old_offsets[entry_index] = file->offset;
-    entries[entry_index].file_owner = inumber;
-    entries[entry_index].file_offset = SEGSUM_METADATA;
-    entry_index++;
-    old_offsets[entry_index] = imap->offset;
-    entries[entry_index].file_owner = SEGSUM_METADATA;
-    entries[entry_index].file_offset = INODE_TO_IMAP(inumber);
+    }
+
+    int pos;
     if(offset > old_size) {
         // pad file with zeroes to reach offset
-        pos = (int) old_size - starting_point;
+        pos = (int) (old_size - starting_point);
         memset(write_buffer + pos, 0, offset - old_size);
     } else {
-        pos = (int) offset - starting_point;
+        pos = (int) (offset - starting_point);
     }
     memcpy(write_buffer + pos, buf, size);
+
+    // data blocks first, then the indirect blocks that point to them, then
+    // the double indirect block
+    off_t* block_ptr;
+    off_t old_offset, new_offset;
+    for(current_block = start_block; current_block <= end_block;
+            current_block++) {
+        if(current_block < DIRECT_BLOCK_COUNT) {
+            block_ptr = &(file->direct_blocks[current_block]);
+        } else {
+            d_ind_index = DOUBLE_INDIRECT_INDEX(current_block);
+            block_ptr = indirects + (d_ind_index - low_indirect)
+                    * OFFSETS_PER_BLOCK + INDIRECT_INDEX(current_block);
+        }
+        old_offset = current_block < blocks ? *block_ptr : (off_t) -1;
+        pos = (current_block - start_block) * BLOCK_SIZE;
+        new_offset = txn_append(txn, write_buffer + pos, BLOCK_SIZE, file_owner,
+                                (off_t) current_block * BLOCK_SIZE, old_offset);
+        if(new_offset == (off_t) -1) {
+            free(write_buffer);
+            free(indirects);
+
+            return -1;
+        }
+
+        *block_ptr = new_offset;
+    }
+    free(write_buffer);
+
+    if(end_block >= DIRECT_BLOCK_COUNT) {
+        for(d_ind_index = low_indirect; d_ind_index <= high_indirect;
+                d_ind_index++) {
+            current_block = d_ind_index * OFFSETS_PER_BLOCK
+                    + DIRECT_BLOCK_COUNT;
+            if(current_block < blocks) {
+                old_offset = double_indirect[d_ind_index];
+            } else {
+                old_offset = (off_t) -1;
+            }
+            new_offset = txn_append(txn, indirects + (d_ind_index
+                                            - low_indirect) * OFFSETS_PER_BLOCK,
+                                    BLOCK_SIZE, file_owner,
+                                    (d_ind_index + 1) * SEGSUM_INDIRECT,
+                                    old_offset);
+            if(new_offset == (off_t) -1) {
+                free(indirects);
+
+                return -1;
+            }
+
+            double_indirect[d_ind_index] = new_offset;
+        }
+        free(indirects);
+
+        if(blocks > DIRECT_BLOCK_COUNT) {
+            old_offset = file->double_indirect_block;
+        } else {
+            old_offset = (off_t) -1;
+        }
+        new_offset = txn_append(txn, double_indirect, BLOCK_SIZE, file_owner,
+                                SEGSUM_DOUBLE_INDIRECT, old_offset);
+        if(new_offset == (off_t) -1) {
+            return -1;
+        }
+
+        file->double_indirect_block = new_offset;
+    }
+
     // update inode
     if(offset + size > old_size) {
         file->statbuf.st_size = offset + size;
         file->statbuf.st_blocks = end_block + 1;
     }
-    pos = modify_region_size;
-    if(end_block >= DIRECT_BLOCK_COUNT) {
-        int start_di_index = DOUBLE_INDIRECT_INDEX(start_block);
-        int end_di_index = DOUBLE_INDIRECT_INDEX(end_block);
-        do {
-            double_indirect[start_di_index] = tail;
-            tail = increment_tail(tail);
-            pos += BLOCK_SIZE;
-            start_di_index++;
-        } while(start_di_index <= end_di_index);
-        file->double_indirect_block = tail;
-        tail = increment_tail(tail);
-        pos += BLOCK_SIZE;
-    }
-    // write inode to tail
-    file->offset = tail;
-    memcpy(write_buffer + pos, file, sizeof(struct inode));
-    pos += BLOCK_SIZE;
-    // update imap
-    imap->inode_blocks[INODE_TO_IMAP_INDEX(inumber)] = tail;
-    tail = increment_tail(tail);
-    // write imap to tail
-    imap->offset = tail;
-    memcpy(write_buffer + pos, imap, BLOCK_SIZE);
-    // update checkpoint region
-    sblock->inode_map_blocks[INODE_TO_IMAP(inumber)] = tail;
-    tail = increment_tail(tail);
-
-    // complete write to tail
-    int append_result = log_append(sblock, write_buffer, write_buffer_size,
-                                   entries, true);
-    free(write_buffer);
-    free(entries);
-    if(append_result == -1) {
-        free(old_offsets);
-
+    if(txn_dirty_inode(txn, file) == -1) {
         return -1;
     }
 
-    // need the old offsets of blocks written:
-    clear_segsum_entries(old_offsets, entry_count);
-    free(old_offsets);
-    
     return size;
 }
+
+// marks blocks [block_count, end of file] of file as stale in txn, along with
+// any indirect blocks that no longer point to live blocks
+// file's pointers are left as they are, callers update st_size/st_blocks
+int release_blocks_helper(struct log_txn* txn, struct inode* file,
+                          int block_count) {
+    int blocks = (int) file->statbuf.st_blocks;
+    int current_block = block_count;
+    while(current_block < blocks && current_block < DIRECT_BLOCK_COUNT) {
+        if(txn_release(txn, file->direct_blocks[current_block]) == -1) {
+            return -1;
+        }
+
+        current_block++;
+    }
+
+    if(blocks <= DIRECT_BLOCK_COUNT) {
+        return 0;
+    }
+
+    off_t double_indirect[OFFSETS_PER_BLOCK];
+    off_t indirect[OFFSETS_PER_BLOCK];
+    if(read_double_indirect(txn->data, file, double_indirect) == NULL) {
+        fprintf(stderr, "failed to read double indirect block\n");
+
+        return -1;
+    }
+
+    int d_ind_index = DOUBLE_INDIRECT_INDEX(current_block);
+    int high_indirect = DOUBLE_INDIRECT_INDEX(blocks - 1);
+    int first_block, ind_index;
+    while(d_ind_index <= high_indirect) {
+        first_block = d_ind_index * OFFSETS_PER_BLOCK + DIRECT_BLOCK_COUNT;
+        if(read_indirect(txn->data, double_indirect, first_block,
+                         indirect) == NULL) {
+            fprintf(stderr, "failed to read indirect block\n");
+
+            return -1;
+        }
+
+        ind_index = INDIRECT_INDEX(current_block);
+        while(ind_index < OFFSETS_PER_BLOCK && current_block < blocks) {
+            if(txn_release(txn, indirect[ind_index]) == -1) {
+                return -1;
+            }
+
+            ind_index++;
+            current_block++;
+        }
+        if(first_block >= block_count
+                && txn_release(txn, double_indirect[d_ind_index]) == -1) {
+            return -1;
+        }
+
+        d_ind_index++;
+    }
+    if(block_count <= DIRECT_BLOCK_COUNT
+            && txn_release(txn, file->double_indirect_block) == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// resize file to new_size in txn, zero filling if it grows
+int lfs_truncate_helper(struct log_txn* txn, struct inode* file,
+                        off_t new_size) {
+    off_t old_size = file->statbuf.st_size;
+    if(new_size > MAX_FILE_SIZE) {
+        new_size = MAX_FILE_SIZE;
+    }
+    if(new_size == old_size) {
+        return 0;
+    }
+
+    if(new_size > old_size) {
+        // write zeroes until size is new_size
+        int extend_size = new_size - old_size;
+        char* zeroes = (char*) calloc(extend_size, sizeof(char));
+        if(zeroes == NULL) {
+            fprintf(stderr, "truncate: malloc failed\n");
+
+            return -1;
+        }
+
+        int bytes_written = lfs_write_helper(txn, file, zeroes, extend_size,
+                                             old_size);
+        free(zeroes);
+        if(bytes_written < extend_size) {
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if(INODE_IS_INLINE(file)) {
+        // no data blocks to release, the file stays inline
+        memset(file->inline_data + new_size, 0, old_size - new_size);
+        file->statbuf.st_size = new_size;
+
+        return txn_dirty_inode(txn, file);
+    }
+
+    int new_blocks = BLOCK_COUNT(new_size);
+    if(release_blocks_helper(txn, file, new_blocks) == -1) {
+        return -1;
+    }
+
+    if(new_blocks <= DIRECT_BLOCK_COUNT) {
+        file->double_indirect_block = (off_t) -1;
+    }
+    file->statbuf.st_blocks = new_blocks;
+    file->statbuf.st_size = new_size;
+
+    return txn_dirty_inode(txn, file);
+}
@@ -3,29 +3,46 @@
 
 #include "380LFS.h"
 #include "segments.h"
+#include "transactions.h"
 
 #include <stddef.h>
 #include <stdbool.h>
 
-struct superblock* get_superblock(struct superblock*);
-int get_inumber(const char*, struct superblock*, struct inode_map*,
-                struct inode*);
-struct inode* get_inode(int, struct superblock*, struct inode*);
-struct inode_map* get_imap(int, struct superblock*, struct inode_map*);
-int alloc_inumber(struct superblock*);
-int commit_write(off_t, struct superblock*);
+struct superblock* get_superblock(struct lfs_data*, struct superblock*);
+int get_inumber(struct lfs_data*, const char*, struct superblock*,
+                struct inode_map*, struct inode*);
+struct inode* get_inode(struct lfs_data*, int, struct superblock*,
+                        struct inode*);
+int get_open_inode(struct lfs_data*, struct superblock*, struct open_file*);
+struct inode_map* get_imap(struct lfs_data*, int, struct superblock*,
+                           struct inode_map*);
+int alloc_inumber(struct lfs_data*, struct superblock*);
+void use_inumber(struct lfs_data*, int);
+void release_inumber(struct lfs_data*, int);
+void free_inumbers(struct lfs_data*);
+int commit_write(struct lfs_data*, off_t[LOG_HEAD_COUNT], struct superblock*);
 int init_data(struct lfs_data*);
-int init_fh(struct inode*, uint64_t*);
-off_t* read_double_indirect(struct inode*, off_t[OFFSETS_PER_BLOCK]);
-off_t* read_indirect(off_t[OFFSETS_PER_BLOCK], int, off_t[OFFSETS_PER_BLOCK]);
-off_t get_block_offset(int, struct inode*);
-int read_block(int, struct inode*, char[BLOCK_SIZE]);
-int read_block_range(int, int, struct inode*, char*);
-int read_blocks_all(struct inode*, char*);
-int log_append(struct superblock*, char*, size_t, struct segsum_entry*,
-			   bool);
+int init_checkpoint_state(struct lfs_data*);
+int write_checkpoint(struct lfs_data*);
+void release_freed_blocks(struct lfs_data*);
+int sync_checkpoint(struct lfs_data*);
+bool checkpoint_due(struct lfs_data*);
+int init_fh(struct lfs_data*, struct inode*, struct open_file**);
+off_t* read_double_indirect(struct lfs_data*, struct inode*,
+                            off_t[OFFSETS_PER_BLOCK]);
+off_t* read_indirect(struct lfs_data*, off_t[OFFSETS_PER_BLOCK], int,
+                     off_t[OFFSETS_PER_BLOCK]);
+off_t get_block_offset(struct lfs_data*, int, struct inode*);
+int read_block(struct lfs_data*, int, struct inode*, char[BLOCK_SIZE]);
+int get_block_offsets(struct lfs_data*, int, int, struct inode*, off_t*);
+int read_block_runs(struct lfs_data*, const off_t*, int, char*);
+int read_block_range(struct lfs_data*, int, int, struct inode*, char*);
+int read_blocks_all(struct lfs_data*, struct inode*, char*);
+int log_append(struct log_txn*);
 
-int lfs_write_helper(struct superblock*, struct inode_map*,
-                     struct inode*, const char*, size_t, off_t);
+int lfs_write_helper(struct log_txn*, struct inode*, const char*, size_t,
+                     off_t);
+int release_blocks_helper(struct log_txn*, struct inode*, int);
+int lfs_truncate_helper(struct log_txn*, struct inode*, off_t);
 
 #endif
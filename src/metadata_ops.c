@@ -1,8 +1,9 @@
 #include "380LFS.h"
 #include "metadata_ops.h"
 #include "metadata_helpers.h"
+#include "clean_policy.h"
+#include "stats.h"
 
-#include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -10,16 +11,21 @@
 #include <unistd.h>
 #include <errno.h>
 
-int lfs_getattr(const char* path, struct stat* statbuf) {
+int lfs_getattr(struct lfs_data* data, const char* path,
+                struct stat* statbuf) {
+    if(is_stats_path(path)) {
+        return get_stats_attr(data, statbuf);
+    }
+
     memset(statbuf, 0, sizeof(struct stat));
 
     // find checkpoint region
     struct superblock sblock;
     struct inode file;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
-    int inumber = get_inumber(path, &sblock, NULL, &file);
+    int inumber = get_inumber(data, path, &sblock, NULL, &file);
     if(inumber == -1) {
         fprintf(stderr, "getattr: file %s not found\n", path);
         
@@ -31,9 +37,9 @@ int lfs_getattr(const char* path, struct stat* statbuf) {
     return 0;
 }
 
-int lfs_access(const char* path, int mask) {
+int lfs_access(struct lfs_data* data, const char* path, int mask) {
     struct stat statbuf;
-    int getattr_result = lfs_getattr(path, &statbuf);
+    int getattr_result = lfs_getattr(data, path, &statbuf);
     if(getattr_result < 0) {
         return getattr_result;
     }
@@ -58,7 +64,11 @@ int lfs_access(const char* path, int mask) {
     return -EACCES;
 }
 
-int lfs_utime(const char* path, struct utimbuf* ubuf) {
+int lfs_utime(struct lfs_data* data, const char* path, struct utimbuf* ubuf) {
+    if(is_stats_path(path)) {
+        return -EACCES;
+    }
+
     //TODO: error checking
     struct timespec access_timestamp, modify_timestamp;
     if(ubuf == NULL) {
@@ -79,12 +89,11 @@ int lfs_utime(const char* path, struct utimbuf* ubuf) {
     }
     
     struct superblock sblock;
-    struct inode_map imap;
     struct inode file;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
-    int inumber = get_inumber(path, &sblock, &imap, &file);
+    int inumber = get_inumber(data, path, &sblock, NULL, &file);
     if(inumber == -1) {
         fprintf(stderr, "utime: file %s not found\n", path);
 
@@ -94,136 +103,191 @@ int lfs_utime(const char* path, struct utimbuf* ubuf) {
     memcpy(&(file.statbuf.st_atim), &access_timestamp, sizeof(struct timespec));
     memcpy(&(file.statbuf.st_mtim), &modify_timestamp, sizeof(struct timespec));
 
-    struct segsum_entry entries[2];
-    off_t old_offsets[2];
-    entries[0].file_owner = inumber;
-    entries[0].file_offset = SEGSUM_METADATA;
-    old_offsets[0] = file.offset;
-    entries[1].file_owner = SEGSUM_METADATA;
-    entries[1].file_offset = INODE_TO_IMAP(inumber);
-    old_offsets[1] = imap.offset;
-    
-    char write_buffer[2 * BLOCK_SIZE];
-    off_t tail = PRIVATE_DATA->tail;
-    file.offset = tail;
-    memcpy(write_buffer, &file, BLOCK_SIZE);
-    imap.inode_blocks[INODE_TO_IMAP_INDEX(inumber)] = tail;
-    tail = increment_tail(tail);
-    imap.offset = tail;
-    memcpy(write_buffer + BLOCK_SIZE, &imap, BLOCK_SIZE);
-    sblock.inode_map_blocks[INODE_TO_IMAP(inumber)] = tail;
-    tail = increment_tail(tail);
-
-    if(log_append(&sblock, write_buffer, 2 * BLOCK_SIZE, entries, 
-                  true) == -1) {
+    struct log_txn txn;
+    if(txn_begin(&txn, data, &sblock) == -1) {
         return -1;
     }
 
-    clear_segsum_entries(old_offsets, 2);
+    if(txn_dirty_inode(&txn, &file) == -1) {
+        txn_abort(&txn);
 
-    return 0;
+        return -1;
+    }
+
+    return txn_commit(&txn, true);
 }
 
-int lfs_truncate(const char* path, off_t new_size) {
-    //TODO: error checking
+int lfs_truncate(struct lfs_data* data, const char* path, off_t new_size) {
+    if(is_stats_path(path)) {
+        return -EACCES;
+    }
+
     struct superblock sblock;
-    struct inode_map imap;
     struct inode file;
-    if(get_superblock(&sblock) == NULL) {
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
     
-    int inumber = get_inumber(path, &sblock, &imap, &file);
+    int inumber = get_inumber(data, path, &sblock, NULL, &file);
     if(inumber == -1) {
         fprintf(stderr, "truncate: file %s not found\n", path);
 
         return -1;
     }
-    
-    off_t old_size = file.statbuf.st_size;
-    if(new_size > MAX_FILE_SIZE) {
-        new_size = MAX_FILE_SIZE;
+
+    struct log_txn txn;
+    if(txn_begin(&txn, data, &sblock) == -1) {
+        return -1;
     }
-    if(new_size == old_size) {
-        return 0;
+
+    txn_set_data_head(&txn, &file);
+    if(lfs_truncate_helper(&txn, &file, new_size) == -1) {
+        txn_abort(&txn);
+
+        return -1;
     }
 
-    if(new_size > old_size) {
-        // write zeroes until size is new_size
-        int extend_size = new_size - old_size;
-        char* zeroes = (char*) calloc(extend_size, sizeof(char));
-        int bytes_written = lfs_write_helper(&sblock, &imap, &file, zeroes,
-                                             extend_size, old_size);
-        free(zeroes);
-        if(bytes_written < extend_size) {
-            return -1;
+    return txn_commit(&txn, true);
+}
+
+// true for user.lfs.clean_* on the root, the cleaning options
+static bool is_clean_xattr(const char* path, const char* name) {
+    size_t prefix_length = strlen(LFS_XATTR_PREFIX CLEAN_OPTION_PREFIX);
+
+    return strcmp(path, "/") == 0
+            && strncmp(name, LFS_XATTR_PREFIX CLEAN_OPTION_PREFIX,
+                       prefix_length) == 0;
+}
+
+// user.lfs.temperature ("hot", "cold" or "auto") picks the log head a file's
+// data blocks are written to, user.lfs.clean_* on the root change the
+// cleaning options
+int lfs_setxattr(struct lfs_data* data, const char* path, const char* name,
+                 const char* value, size_t size, int flags) {
+    if(is_clean_xattr(path, name)) {
+        char option_value[CLEAN_XATTR_VALUE_MAX];
+        if(size >= CLEAN_XATTR_VALUE_MAX) {
+            return -EINVAL;
+        }
+
+        memcpy(option_value, value, size);
+        option_value[size] = '\0';
+        struct clean_config previous;
+        memcpy(&previous, &(data->clean_config), sizeof(struct clean_config));
+        int status = set_clean_option(&(data->clean_config),
+                                      name + strlen(LFS_XATTR_PREFIX),
+                                      option_value);
+        if(status == 0 && check_clean_thresholds(data) != 0) {
+            memcpy(&(data->clean_config), &previous,
+                   sizeof(struct clean_config));
+            status = -EINVAL;
         }
 
+        return status;
+    }
+
+    if(strcmp(name, TEMPERATURE_XATTR) != 0) {
+        return -ENOTSUP;
+    }
+
+    int temperature;
+    if(size == strlen("hot") && strncmp(value, "hot", size) == 0) {
+        temperature = TEMPERATURE_HOT;
+    } else if(size == strlen("cold") && strncmp(value, "cold", size) == 0) {
+        temperature = TEMPERATURE_COLD;
+    } else if(size == strlen("auto") && strncmp(value, "auto", size) == 0) {
+        temperature = TEMPERATURE_AUTO;
+    } else {
+        return -EINVAL;
+    }
+
+    struct superblock sblock;
+    struct inode file;
+    if(get_superblock(data, &sblock) == NULL) {
+        return -1;
+    }
+
+    int inumber = get_inumber(data, path, &sblock, NULL, &file);
+    if(inumber == -1) {
+        fprintf(stderr, "setxattr: file %s not found\n", path);
+
+        return -ENOENT;
+    }
+
+    if(file.temperature == temperature) {
         return 0;
     }
 
-    struct segsum_entry entries[2];
-    int old_offset_count = 2;
-    int old_last_block = old_size / BLOCK_SIZE;
-    int new_last_block = new_size / BLOCK_SIZE;
-    if(new_last_block < old_last_block) {
-        // need the old offsets of any blocks truncated away
-        old_offset_count += old_last_block - new_last_block;
+    file.temperature = temperature;
+    struct log_txn txn;
+    if(txn_begin(&txn, data, &sblock) == -1) {
+        return -1;
     }
-    off_t* old_offsets = (off_t*) malloc(old_offset_count * sizeof(off_t));
-    if(old_offsets == NULL) {
-        fprintf(stderr, "truncate: malloc failed\n");
+
+    if(txn_dirty_inode(&txn, &file) == -1) {
+        txn_abort(&txn);
 
         return -1;
     }
 
-    entries[0].file_owner = inumber;
-    entries[0].file_offset = SEGSUM_METADATA;
-    old_offsets[0] = file.offset;
-    entries[1].file_owner = SEGSUM_METADATA;
-    entries[1].file_offset = INODE_TO_IMAP(inumber);
-    old_offsets[1] = imap.offset;
-    if(new_last_block < old_last_block) {
-        int current_block = new_last_block + 1;
-        int offset_index = 2;
-        while(current_block <= old_last_block) {
-            old_offsets[offset_index] = get_block_offset(current_block, &file);
-            current_block++;
-            offset_index++;
+    return txn_commit(&txn, true);
+}
+
+int lfs_getxattr(struct lfs_data* data, const char* path, const char* name,
+                 char* value, size_t size) {
+    if(is_clean_xattr(path, name)) {
+        char option_value[CLEAN_XATTR_VALUE_MAX];
+        int length = get_clean_option(&(data->clean_config),
+                                      name + strlen(LFS_XATTR_PREFIX),
+                                      option_value, CLEAN_XATTR_VALUE_MAX);
+        if(length < 0 || size == 0) {
+            // size 0 asks for the size of the value
+            return length;
         }
+
+        if(size < length) {
+            return -ERANGE;
+        }
+
+        memcpy(value, option_value, length);
+
+        return length;
     }
-    
-    char write_buffer[2 * BLOCK_SIZE];
-    off_t tail = PRIVATE_DATA->tail;
-    file.statbuf.st_blocks = new_size / BLOCK_SIZE + 1;
-    file.statbuf.st_size = new_size;
-    
-    int pos = 0;
-    // write inode to tail
-    file.offset = tail;
-    memcpy(write_buffer + pos, &file, sizeof(struct inode));
-    pos += BLOCK_SIZE;
-
-    // update imap
-    imap.inode_blocks[INODE_TO_IMAP_INDEX(inumber)] = tail;
-    tail = increment_tail(tail);
-    // write imap to tail
-    imap.offset = tail;
-    memcpy(write_buffer + pos, &imap, BLOCK_SIZE);
-    // update checkpoint region
-    sblock.inode_map_blocks[INODE_TO_IMAP(inumber)] = tail;
-    tail = increment_tail(tail);
-
-    // complete write to tail
-    if(log_append(&sblock, write_buffer, 2 * BLOCK_SIZE, entries, 
-                  true) == -1) {
-        free(old_offsets);
 
+    if(strcmp(name, TEMPERATURE_XATTR) != 0) {
+        return -ENODATA;
+    }
+
+    struct superblock sblock;
+    struct inode file;
+    if(get_superblock(data, &sblock) == NULL) {
         return -1;
     }
 
-    clear_segsum_entries(old_offsets, old_offset_count);
-    free(old_offsets);
+    int inumber = get_inumber(data, path, &sblock, NULL, &file);
+    if(inumber == -1) {
+        fprintf(stderr, "getxattr: file %s not found\n", path);
 
-    return 0;
+        return -ENOENT;
+    }
+
+    const char* temperature = "auto";
+    if(file.temperature == TEMPERATURE_HOT) {
+        temperature = "hot";
+    } else if(file.temperature == TEMPERATURE_COLD) {
+        temperature = "cold";
+    }
+    size_t length = strlen(temperature);
+    if(size == 0) {
+        // caller is asking for the size of the value
+        return length;
+    }
+
+    if(size < length) {
+        return -ERANGE;
+    }
+
+    memcpy(value, temperature, length);
+
+    return length;
 }
@@ -1,15 +1,24 @@
 #ifndef _METADATA_OPS_H_
 #define _METADATA_OPS_H_
 
+#include "380LFS.h"
+
 #include <utime.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-int lfs_getattr(const char*, struct stat*);
-int lfs_access(const char*, int);
-int lfs_utime(const char*, struct utimbuf*);
-int lfs_truncate(const char*, off_t);
-int lfs_chmod(const char*, mode_t);
-int lfs_chown(const char*, uid_t, gid_t);
+#define TEMPERATURE_XATTR "user.lfs.temperature"
+// longest value accepted for a cleaning option xattr
+#define CLEAN_XATTR_VALUE_MAX 32
+
+int lfs_getattr(struct lfs_data*, const char*, struct stat*);
+int lfs_access(struct lfs_data*, const char*, int);
+int lfs_utime(struct lfs_data*, const char*, struct utimbuf*);
+int lfs_truncate(struct lfs_data*, const char*, off_t);
+int lfs_chmod(struct lfs_data*, const char*, mode_t);
+int lfs_chown(struct lfs_data*, const char*, uid_t, gid_t);
+int lfs_setxattr(struct lfs_data*, const char*, const char*, const char*,
+                 size_t, int);
+int lfs_getxattr(struct lfs_data*, const char*, const char*, char*, size_t);
 
 #endif
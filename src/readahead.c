@@ -0,0 +1,152 @@
+#include "readahead.h"
+#include "metadata_helpers.h"
+#include "log_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+void init_readahead(struct readahead* ra, struct lfs_data* data) {
+    memset(ra, 0, sizeof(struct readahead));
+    ra->window = READAHEAD_MIN_BLOCKS;
+    ra->data = data;
+}
+
+// reads the pending blocks, their log offsets were looked up by the calling
+// thread since the inode and indirect blocks may change under the worker
+static void* prefetch_worker(void* arg) {
+    struct readahead* ra = (struct readahead*) arg;
+    int blocks_read = read_block_runs(ra->data, ra->pending_offsets,
+                                      ra->pending.block_count,
+                                      ra->pending.buffer);
+    ra->pending_status = blocks_read == ra->pending.block_count ? 0 : -1;
+
+    return NULL;
+}
+
+// wait for the running prefetch, its blocks replace the cache if it worked
+static void finish_prefetch(struct readahead* ra) {
+    if(!ra->in_flight) {
+        return;
+    }
+
+    pthread_join(ra->thread, NULL);
+    ra->in_flight = false;
+    if(ra->pending_status == 0) {
+        free(ra->cache.buffer);
+        memcpy(&(ra->cache), &(ra->pending), sizeof(struct block_cache));
+    } else {
+        free(ra->pending.buffer);
+    }
+    ra->pending.buffer = NULL;
+    free(ra->pending_offsets);
+    ra->pending_offsets = NULL;
+}
+
+static bool cache_covers(struct block_cache* cache, struct inode* file,
+                         int first_block, int last_block) {
+    return cache->buffer != NULL && cache->inode_version == file->version
+            && first_block >= cache->start_block
+            && last_block < cache->start_block + cache->block_count;
+}
+
+static void start_prefetch(struct readahead* ra, struct inode* file,
+                           int start_block, int count) {
+    off_t* offsets = (off_t*) malloc(count * sizeof(off_t));
+    char* buffer = (char*) alloc_log_buffer((size_t) count * BLOCK_SIZE);
+    if(offsets == NULL || buffer == NULL
+            || get_block_offsets(ra->data, start_block,
+                                 start_block + count - 1, file,
+                                 offsets) == -1) {
+        free(offsets);
+        free(buffer);
+
+        return;
+    }
+
+    ra->pending.buffer = buffer;
+    ra->pending.start_block = start_block;
+    ra->pending.block_count = count;
+    ra->pending.inode_version = file->version;
+    ra->pending_offsets = offsets;
+    if(pthread_create(&(ra->thread), NULL, prefetch_worker, ra) != 0) {
+        ra->pending.buffer = NULL;
+        ra->pending_offsets = NULL;
+        free(offsets);
+        free(buffer);
+
+        return;
+    }
+
+    ra->in_flight = true;
+    ra->data->stats.blocks_prefetched += count;
+}
+
+// copy blocks [first, last] of file into buf from prefetched blocks,
+// returns -1 if they weren't prefetched
+int readahead_read(struct readahead* ra, struct inode* file, int first_block,
+                   int last_block, char* buf) {
+    if(!cache_covers(&(ra->cache), file, first_block, last_block)
+            && ra->in_flight
+            && cache_covers(&(ra->pending), file, first_block, last_block)) {
+        finish_prefetch(ra);
+    }
+
+    if(!cache_covers(&(ra->cache), file, first_block, last_block)) {
+        return -1;
+    }
+
+    size_t cache_pos = (size_t) (first_block - ra->cache.start_block)
+            * BLOCK_SIZE;
+    memcpy(buf, ra->cache.buffer + cache_pos,
+           (size_t) (last_block - first_block + 1) * BLOCK_SIZE);
+
+    return 0;
+}
+
+// record a read of size bytes at offset, a read that continues the previous
+// one grows the window and keeps a prefetch running ahead of the reader
+void readahead_advance(struct readahead* ra, struct inode* file, off_t offset,
+                       size_t size) {
+    bool sequential = offset == ra->next_offset;
+    ra->next_offset = offset + size;
+    if(!sequential) {
+        ra->window = READAHEAD_MIN_BLOCKS;
+
+        return;
+    }
+
+    if(ra->in_flight) {
+        return;
+    }
+
+    int last_block = (int) ((offset + size - 1) / BLOCK_SIZE);
+    int start_block = last_block + 1;
+    if(cache_covers(&(ra->cache), file, last_block, last_block)) {
+        // start once the reader is halfway through the blocks still ahead
+        start_block = ra->cache.start_block + ra->cache.block_count;
+        if(start_block - (last_block + 1) >= ra->window / 2) {
+            return;
+        }
+    }
+
+    int count = ra->window;
+    if(start_block + count > file->statbuf.st_blocks) {
+        count = file->statbuf.st_blocks - start_block;
+    }
+    if(count <= 0) {
+        return;
+    }
+
+    start_prefetch(ra, file, start_block, count);
+    if(ra->window < READAHEAD_MAX_BLOCKS) {
+        ra->window *= 2;
+    }
+}
+
+void free_readahead(struct readahead* ra) {
+    finish_prefetch(ra);
+    free(ra->cache.buffer);
+    ra->cache.buffer = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef _READAHEAD_H_
+#define _READAHEAD_H_
+
+#include "380LFS.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// prefetch window in blocks, doubled by every sequential read up to a default
+// segment
+#define READAHEAD_MIN_BLOCKS 8
+#define READAHEAD_MAX_BLOCKS (DEFAULT_SEGMENT_SIZE / BLOCK_SIZE)
+
+void init_readahead(struct readahead*, struct lfs_data*);
+int readahead_read(struct readahead*, struct inode*, int, int, char*);
+void readahead_advance(struct readahead*, struct inode*, off_t, size_t);
+void free_readahead(struct readahead*);
+
+#endif
@@ -1,476 +1,1017 @@
+// fallocate
+#define _GNU_SOURCE
+
 #include "380LFS.h"
 #include "metadata_helpers.h"
 #include "segments.h"
+#include "transactions.h"
+#include "clean_policy.h"
+#include "log_io.h"
+#include "stats.h"
+#include "latency.h"
 
-#include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
 
 struct segsum_sort_entry {
     int segment_number;
-    double benefit_cost_ratio;
-    struct segment_summary summary;
+    double score;
 };
 
-struct d_ind_table_entry {
-    off_t* original;
+// a file whose blocks are being relocated by the cleaner
+struct clean_file {
+    struct inode file;
+    // newest write time of the victim segments holding its live data blocks
+    double last_write;
+    // loaded when something under the double indirect block moves
+    off_t* double_indirect;
     off_t** indirects;
 };
 
+// a live data block found in a victim segment, relocated once all victims
+// have been scanned
+struct live_block {
+    int inumber;
+    off_t file_offset;
+    off_t block_offset;
+    // last_write of the block's file, so a file's blocks stay together
+    double age_key;
+};
+
+struct live_block_list {
+    struct live_block* blocks;
+    int count;
+    int capacity;
+};
+
+// everything one cleaning pass works with
+struct clean_state {
+    struct lfs_data* data;
+    struct superblock* sblock;
+    struct log_txn* txn;
+    // files touched by the pass, indexed by inumber
+    struct clean_file** file_table;
+    int file_table_len;
+    int* victims;
+    int victim_count;
+    // RELOCATE_*, victims are only read in whole for RELOCATE_READ
+    int relocate;
+    int segment_size;
+    // contents of the victims, victim i at i * segment_size
+    char* segments;
+    struct live_block_list live;
+    // victims are read by reader threads while the pass scans them in order
+    int fd;
+    pthread_t* readers;
+    int reader_count;
+    int reader_capacity;
+    pthread_mutex_t read_lock;
+    pthread_cond_t read_cond;
+    // next victim a reader picks up
+    int next_read;
+    // per victim: 0 while being read, 1 once read, -1 if the read failed
+    int* read_status;
+};
+
 int compare_segments(const void* entry1, const void* entry2) {
     struct segsum_sort_entry* seg1 = (struct segsum_sort_entry*) entry1;
     struct segsum_sort_entry* seg2 = (struct segsum_sort_entry*) entry2;
-    // clean segments go to the back of the list
-    if(seg1->summary.live_bytes == 0) {
+    // highest score first
+    if(seg1->score < seg2->score) {
         return 1;
     }
 
-    if(seg2->summary.live_bytes == 0) {
+    if(seg1->score > seg2->score) {
         return -1;
     }
 
-    return (int) (seg2->benefit_cost_ratio - seg1->benefit_cost_ratio);
+    return 0;
 }
 
-void free_tables(struct inode_map** imap_table, int imap_table_len,
-                 struct inode** file_table, int file_table_len,
-                 struct d_ind_table_entry* d_ind_table,
-                 char** datablock_table, int datablock_count) {
-    int i, j;
-    for(i = 0; i < imap_table_len; i++) {
-        free(imap_table[i]);
-    }
-    free(imap_table);
-    for(i = 0; i < file_table_len; i++) {
-        free(d_ind_table[i].original);
-        for(j = 0; j < OFFSETS_PER_BLOCK; j++) {
-            free(d_ind_table[i].indirects[j]);
-        }
-        free(d_ind_table[i].indirects);
-        free(d_ind_table + i);
-        free(file_table[i]);
+// oldest files first, then by inumber and file offset, so survivors are
+// written back contiguously per file and cold files apart from warm ones
+int compare_live_blocks(const void* entry1, const void* entry2) {
+    struct live_block* block1 = (struct live_block*) entry1;
+    struct live_block* block2 = (struct live_block*) entry2;
+    if(block1->age_key != block2->age_key) {
+        return block1->age_key < block2->age_key ? -1 : 1;
     }
-    free(file_table);
-    for(i = 0; i < datablock_count; i++) {
-        free(datablock_table[i]);
+
+    if(block1->inumber != block2->inumber) {
+        return block1->inumber < block2->inumber ? -1 : 1;
     }
-}
 
-// Mr. Clean gets tough on cold segments
-void clean() {
-    struct lfs_data* data = PRIVATE_DATA;
-    struct superblock sblock;
-    if(get_superblock(&sblock) == NULL) {
-        return;
+    if(block1->file_offset != block2->file_offset) {
+        return block1->file_offset < block2->file_offset ? -1 : 1;
     }
 
-    size_t segsum_sorted_len = data->segment_count 
-            * sizeof(struct segsum_sort_entry);
-    //int d_ind_count;
-    int seg, total_imap_count, imap_count, file_count, datablock_count, block;
-    int file_owner, imap_number, imap_index, new_block_count, old_offset_index;
-    int pos, datablock, inumber, append_status, d_ind_count, ind_count, i;
-    int d_ind_index, block_no;
-    off_t file_offset, old_tail, tail, *old_offsets;
-    struct segsum_sort_entry* segsum_sort_array, *entry_ptr;
-    struct segment_summary* dirty_segsum;
-    struct inode_map** imap_table, *imap;
-    struct inode** file_table, *file;
-    struct d_ind_table_entry* d_ind_table;
-    char* datablock_table[BLOCKS_PER_SEGMENT * SEGMENTS_PER_CLEAN];
-    char* data_block, *append_buffer;
-    struct segsum_entry* entry_table[BLOCKS_PER_SEGMENT * SEGMENTS_PER_CLEAN];
-    struct segsum_entry* append_entries;
-    double utilization, timestamp, age, benefit, cost;
+    return 0;
+}
+
+// pick up to max_victims dirty segments with the best scores under the
+// configured cleaning policy
+int select_victims(struct lfs_data* data, int* victims, int max_victims) {
+    struct clean_config* config = &(data->clean_config);
     struct timespec reference_time;
     if(clock_gettime(CLOCK_REALTIME, &reference_time) == -1) {
         fprintf(stderr, "cleaning error: failed to read clock\n");
 
-        return;
+        return -1;
+    }
+
+    struct segsum_sort_entry* segsum_sort_array = (struct segsum_sort_entry*)
+            malloc(data->segment_count * sizeof(struct segsum_sort_entry));
+    if(segsum_sort_array == NULL) {
+        fprintf(stderr, "cleaning error: malloc failed\n");
+
+        return -1;
+    }
+
+    double current_seconds = reference_time.tv_sec
+            + (double) reference_time.tv_nsec / NSEC_PER_SEC;
+    int candidates = 0;
+    double utilization, timestamp, age, score;
+    struct segment_summary* segsum;
+    for(int seg = data->prologue_segments; seg < data->segment_count; seg++) {
+        segsum = SEGSUM(data, seg);
+        if(segsum->live_bytes == 0 || is_head_segment(data, seg, data->heads)) {
+            continue;
+        }
+
+        utilization = (double) segsum->live_bytes / data->segment_size;
+        timestamp = segsum->last_write_time.tv_sec
+                + (double) segsum->last_write_time.tv_nsec / NSEC_PER_SEC;
+        age = current_seconds - timestamp;
+        score = config->policy->score(utilization, age, config);
+        if(score <= 0) {
+            continue;
+        }
+
+        segsum_sort_array[candidates].segment_number = seg;
+        segsum_sort_array[candidates].score = score;
+        candidates++;
+    }
+    qsort(segsum_sort_array, candidates, sizeof(struct segsum_sort_entry),
+          compare_segments);
+    if(candidates > max_victims) {
+        candidates = max_victims;
+    }
+    for(int i = 0; i < candidates; i++) {
+        victims[i] = segsum_sort_array[i].segment_number;
+    }
+    free(segsum_sort_array);
+
+    return candidates;
+}
+
+// reader thread: read victims one whole segment at a time, in order, until
+// none are left
+// runs on a thread of its own, so it only reads what is in state
+void* victim_reader(void* arg) {
+    struct clean_state* state = (struct clean_state*) arg;
+    int victim, status;
+    off_t segment_offset;
+    while(true) {
+        pthread_mutex_lock(&(state->read_lock));
+        victim = state->next_read;
+        state->next_read++;
+        pthread_mutex_unlock(&(state->read_lock));
+        if(victim >= state->victim_count) {
+            break;
+        }
+
+        segment_offset = (off_t) state->victims[victim] * state->segment_size;
+        status = 1;
+        // whole aligned segments into an aligned buffer, fine for O_DIRECT
+        if(pread(state->fd,
+                 state->segments + (size_t) victim * state->segment_size,
+                 state->segment_size, segment_offset) < state->segment_size) {
+            fprintf(stderr, "cleaning error: failed to read segment %d\n",
+                    state->victims[victim]);
+            status = -1;
+        }
+        pthread_mutex_lock(&(state->read_lock));
+        state->read_status[victim] = status;
+        pthread_cond_broadcast(&(state->read_cond));
+        pthread_mutex_unlock(&(state->read_lock));
+    }
+
+    return NULL;
+}
+
+// start reading the victims, several segments in flight at once, for
+// RELOCATE_READ
+void start_victim_reads(struct clean_state* state) {
+    state->next_read = 0;
+    for(int i = 0; i < state->victim_count; i++) {
+        state->read_status[i] = 0;
+    }
+    state->reader_count = 0;
+    while(state->reader_count < state->reader_capacity
+            && state->reader_count < state->victim_count) {
+        if(pthread_create(&(state->readers[state->reader_count]), NULL,
+                          victim_reader, state) != 0) {
+            break;
+        }
+
+        state->reader_count++;
+    }
+    if(state->reader_count == 0) {
+        // no threads, read everything now
+        victim_reader(state);
+    }
+}
+
+// wait until victim has been read, -1 if reading it failed
+int wait_for_victim(struct clean_state* state, int victim) {
+    pthread_mutex_lock(&(state->read_lock));
+    while(state->read_status[victim] == 0) {
+        pthread_cond_wait(&(state->read_cond), &(state->read_lock));
+    }
+    int status = state->read_status[victim];
+    pthread_mutex_unlock(&(state->read_lock));
+
+    return status == 1 ? 0 : -1;
+}
+
+// wait for the readers to finish, -1 if any victim couldn't be read
+int finish_victim_reads(struct clean_state* state) {
+    int status = 0;
+    for(int i = 0; i < state->reader_count; i++) {
+        pthread_join(state->readers[i], NULL);
+    }
+    state->reader_count = 0;
+    for(int i = 0; i < state->victim_count; i++) {
+        if(state->read_status[i] != 1) {
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+// block at offset if it is in a segment read into state, NULL otherwise
+char* get_cached_block(struct clean_state* state, off_t offset) {
+    if(state->relocate != RELOCATE_READ) {
+        return NULL;
+    }
+
+    int segment = offset / state->segment_size;
+    for(int i = 0; i < state->victim_count; i++) {
+        if(state->victims[i] == segment) {
+            if(wait_for_victim(state, i) == -1) {
+                return NULL;
+            }
+
+            return state->segments + (size_t) i * state->segment_size
+                    + offset % state->segment_size;
+        }
+    }
+
+    return NULL;
+}
+
+// copy the block at offset from the victims if it is there, else read it
+int read_clean_block(struct clean_state* state, off_t offset, void* block) {
+    char* cached = get_cached_block(state, offset);
+    if(cached != NULL) {
+        memcpy(block, cached, BLOCK_SIZE);
+
+        return 0;
+    }
+
+    if(log_pread(state->data, block, BLOCK_SIZE, offset) < BLOCK_SIZE) {
+        fprintf(stderr, "cleaning error: failed to read block at %ld\n",
+                (long) offset);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// record is the file's live inode if it was found in a victim, NULL to read
+// it through the imap
+struct clean_file* get_clean_file(struct clean_state* state, int inumber,
+                                  struct inode* record) {
+    if(inumber < 0 || inumber >= state->file_table_len) {
+        fprintf(stderr, "cleaning error: bad inumber %d\n", inumber);
+
+        return NULL;
+    }
+
+    if(state->file_table[inumber] == NULL) {
+        struct clean_file* new_file = (struct clean_file*)
+                calloc(1, sizeof(struct clean_file));
+        if(new_file == NULL) {
+            fprintf(stderr, "cleaning error: malloc failed\n");
+
+            return NULL;
+        }
+
+        if(record != NULL) {
+            memcpy(&(new_file->file), record, INODE_RECORD_SIZE(record));
+        } else if(get_inode(state->data, inumber, state->sblock,
+                            &(new_file->file)) == NULL) {
+            free(new_file);
+
+            return NULL;
+        }
+
+        state->file_table[inumber] = new_file;
     }
 
-    double current_seconds = reference_time.tv_sec 
-            + reference_time.tv_nsec / NSEC_PER_SEC;
-    while(data->clean_segments < STOP_CLEAN_SEGMENT_THRESHOLD) {
-        segsum_sort_array = (struct segsum_sort_entry*) 
-                malloc(segsum_sorted_len);
-        if(segsum_sort_array == NULL) {
+    return state->file_table[inumber];
+}
+
+off_t* get_clean_double_indirect(struct clean_state* state,
+                                 struct clean_file* cfile) {
+    if(cfile->double_indirect == NULL) {
+        off_t* double_indirect = (off_t*) alloc_log_buffer(BLOCK_SIZE);
+        if(double_indirect == NULL
+                || read_clean_block(state, cfile->file.double_indirect_block,
+                                    double_indirect) == -1) {
+            fprintf(stderr, "cleaning error: failed to read double indirect\n");
+            free(double_indirect);
+
+            return NULL;
+        }
+
+        cfile->indirects = (off_t**) calloc(OFFSETS_PER_BLOCK, sizeof(off_t*));
+        if(cfile->indirects == NULL) {
             fprintf(stderr, "cleaning error: malloc failed\n");
+            free(double_indirect);
+
+            return NULL;
+        }
+
+        cfile->double_indirect = double_indirect;
+    }
+
+    return cfile->double_indirect;
+}
+
+off_t* get_clean_indirect(struct clean_state* state, struct clean_file* cfile,
+                          int d_ind_index) {
+    if(get_clean_double_indirect(state, cfile) == NULL) {
+        return NULL;
+    }
+
+    if(cfile->indirects[d_ind_index] == NULL) {
+        off_t* indirect = (off_t*) alloc_log_buffer(BLOCK_SIZE);
+        if(indirect == NULL
+                || read_clean_block(state, cfile->double_indirect[d_ind_index],
+                                    indirect) == -1) {
+            fprintf(stderr, "cleaning error: failed to read indirect\n");
+            free(indirect);
+
+            return NULL;
+        }
+
+        cfile->indirects[d_ind_index] = indirect;
+    }
+
+    return cfile->indirects[d_ind_index];
+}
 
-            return;
-        }
-
-        for(seg = 0; seg < data->segment_count; seg++) {
-            segsum_sort_array[seg].segment_number = seg;
-            memcpy(&(segsum_sort_array[seg].summary), &(data->segsums[seg]),
-                   sizeof(struct segment_summary));
-            utilization = (double) data->segsums[seg].live_bytes / SEGMENT_SIZE;
-            timestamp = data->segsums[seg].last_write_time.tv_sec 
-                    + data->segsums[seg].last_write_time.tv_nsec / NSEC_PER_SEC;
-            age = current_seconds - timestamp;
-            benefit = (1 - utilization) * age;
-            cost = 1 + utilization;
-            segsum_sort_array[seg].benefit_cost_ratio = benefit / cost;
-        }
-        qsort(segsum_sort_array, data->segment_count, 
-              sizeof(struct segsum_sort_entry), compare_segments);
-        total_imap_count = INODE_TO_IMAP(data->file_count) + 1;
-        imap_table = (struct inode_map**) calloc(total_imap_count, 
-                                                 sizeof(struct inode_map*));
-        imap_count = 0;
-        file_table = (struct inode**) calloc(data->file_count,
-                                             sizeof(struct inode*));
-        file_count = 0;
-        d_ind_table = (struct d_ind_table_entry*) 
-                calloc(data->file_count, sizeof(struct d_ind_table_entry));
-        d_ind_count = 0;
-        ind_count = 0;
-        datablock_count = 0;
-        if(imap_table == NULL || file_table == NULL || d_ind_table == NULL) {
-            fprintf(stderr, "cleaning error: calloc failed\n");
-            free(segsum_sort_array);
-            free(imap_table);
-            free(file_table);
-            free(d_ind_table);
-
-            return;
-        }
-
-        for(seg = 0; seg < SEGMENTS_PER_CLEAN; seg++) {
-            entry_ptr = segsum_sort_array + seg;
-            dirty_segsum = &(entry_ptr->summary);
-            for(block = 0; block < BLOCKS_PER_SEGMENT; block++) {
-                file_owner = dirty_segsum->entries[block].file_owner;
-                file_offset = dirty_segsum->entries[block].file_offset;
-                if(file_owner != 0) {
-                    if(file_owner == SEGSUM_ROOT) {
-                        file_owner = 0;
-                    }
-                    if(file_owner == SEGSUM_METADATA) {
-                        imap_number = (int) file_offset;
-                    } else {
-                        imap_number = INODE_TO_IMAP(file_owner);
-                    }
-                    if(imap_table[imap_number] == NULL) {
-                        imap = (struct inode_map*) 
-                                malloc(sizeof(struct inode_map));
-                        if(imap == NULL 
-                                || get_imap(imap_number * (OFFSETS_PER_BLOCK),
-                                            &sblock, imap) == NULL) {
-                            free(segsum_sort_array);
-                            free_tables(imap_table, total_imap_count, 
-                                        file_table, data->file_count, 
-                                        d_ind_table,
-                                        datablock_table, datablock_count);
-
-                            return;
-                        }
-
-                        imap_table[imap_number] = imap;
-                        imap_count++;
-                    }
-                    if(file_owner != SEGSUM_METADATA) {
-                        if(file_table[file_owner] == NULL) {
-                            file = (struct inode*) malloc(sizeof(struct inode));
-                            if(file == NULL || get_inode(file_owner, &sblock,
-                                                         file) == NULL) {
-                                free(segsum_sort_array);
-                                free_tables(imap_table, total_imap_count,
-                                            file_table, data->file_count,
-                                            d_ind_table,
-                                            datablock_table, datablock_count);
-
-                                return;
-                            }
-
-                            file_table[file_owner] = file;
-                            file_count++;
-                        }
-                        if(file_offset <= SEGSUM_DOUBLE_INDIRECT 
-                                || file_offset >= MIN_INDIRECT_OFFSET) {
-                            // double indirect block
-                            if(d_ind_table[file_owner].original == NULL) {
-                                d_ind_table[file_owner].original = (off_t*) 
-                                        malloc(BLOCK_SIZE);
-                                d_ind_table[file_owner].indirects = (off_t**) 
-                                        calloc(OFFSETS_PER_BLOCK, 
-                                               sizeof(off_t*));
-                                if(d_ind_table[file_owner].original == NULL 
-                                        || d_ind_table[file_owner].indirects 
-                                            == NULL
-                                        || read_double_indirect(
-                                                file_table[file_owner], 
-                                                d_ind_table[file_owner].original
-                                            ) == NULL) {
-                                    free(segsum_sort_array);
-                                    free_tables(imap_table, total_imap_count,
-                                                file_table, data->file_count,
-                                                d_ind_table,
-                                                datablock_table, 
-                                                datablock_count);
-
-                                    return;
-                                }
-                                
-                                d_ind_count++;
-                            }
-                        }
-                        if(file_offset <= SEGSUM_INDIRECT 
-                                || file_offset >= MIN_INDIRECT_OFFSET) {
-                            d_ind_index = file_offset / SEGSUM_INDIRECT - 1;
-                            block_no = d_ind_index * OFFSETS_PER_BLOCK 
-                                    + DIRECT_BLOCK_COUNT;
-                            if(d_ind_table[file_owner].indirects[d_ind_index] 
-                                    == NULL) {
-                                d_ind_table[file_owner].indirects[d_ind_index] =
-                                        (off_t*) malloc(BLOCK_SIZE);
-                                if(d_ind_table[file_owner]
-                                        .indirects[d_ind_index] == NULL
-                                    || read_indirect(
-                                            d_ind_table[file_owner].original, 
-                                            block_no, 
-                                            d_ind_table[file_owner]
-                                                    .indirects[d_ind_index]
-                                        ) == NULL) {
-                                    free(segsum_sort_array);
-                                    free_tables(imap_table, total_imap_count,
-                                                file_table, data->file_count,
-                                                d_ind_table,
-                                                datablock_table, 
-                                                datablock_count);
-
-                                    return;
-                                }
-
-                                ind_count++;
-                            }
-                        }
-                        if(file_offset >= 0) {
-                            data_block = (char*) malloc(BLOCK_SIZE);
-                            if(data_block == NULL 
-                                    || read_block(file_offset / BLOCK_SIZE, 
-                                                  file_table[file_owner], 
-                                                  data_block) < BLOCK_SIZE) {
-                                free(segsum_sort_array);
-                                free_tables(imap_table, total_imap_count, 
-                                            file_table, data->file_count, 
-                                            d_ind_table,
-                                            datablock_table, datablock_count);
-
-                                return;
-                            }
-
-                            datablock_table[datablock_count] = data_block;
-                            entry_table[datablock_count] = 
-                                    &(dirty_segsum->entries[block]);
-                            datablock_count++;
-                        }
-                    }
+void free_clean_files(struct clean_state* state) {
+    struct clean_file** file_table = state->file_table;
+    for(int inumber = 0; inumber < state->file_table_len; inumber++) {
+        if(file_table[inumber] == NULL) {
+            continue;
+        }
+
+        if(file_table[inumber]->indirects != NULL) {
+            for(int i = 0; i < OFFSETS_PER_BLOCK; i++) {
+                free(file_table[inumber]->indirects[i]);
+            }
+        }
+        free(file_table[inumber]->indirects);
+        free(file_table[inumber]->double_indirect);
+        free(file_table[inumber]);
+    }
+    free(file_table);
+    state->file_table = NULL;
+}
+
+int add_live_block(struct live_block_list* live, int inumber,
+                   off_t file_offset, off_t block_offset) {
+    if(live->count == live->capacity) {
+        int new_capacity = live->capacity == 0
+                ? DEFAULT_SEGMENT_SIZE / BLOCK_SIZE : live->capacity * 2;
+        struct live_block* new_blocks = (struct live_block*)
+                realloc(live->blocks, new_capacity * sizeof(struct live_block));
+        if(new_blocks == NULL) {
+            fprintf(stderr, "cleaning error: realloc failed\n");
+
+            return -1;
+        }
+
+        live->blocks = new_blocks;
+        live->capacity = new_capacity;
+    }
+
+    live->blocks[live->count].inumber = inumber;
+    live->blocks[live->count].file_offset = file_offset;
+    live->blocks[live->count].block_offset = block_offset;
+    live->count++;
+
+    return 0;
+}
+
+// scan the live blocks of victim number victim using its segment summary:
+// data blocks are added to the live list, indirect blocks, inodes and imaps
+// are marked to be rewritten
+int scan_segment(struct clean_state* state, int victim) {
+    struct log_txn* txn = state->txn;
+    int segment = state->victims[victim];
+    struct segment_summary* segsum = SEGSUM(state->data, segment);
+    double write_time = segsum->last_write_time.tv_sec
+            + (double) segsum->last_write_time.tv_nsec / NSEC_PER_SEC;
+    char scratch[BLOCK_SIZE];
+    char* block;
+    struct inode* record;
+    struct clean_file* cfile;
+    struct inode_map* imap;
+    off_t block_offset, file_offset;
+    int file_owner, inumber, slot;
+    for(int block_index = 0; block_index < BLOCKS_PER_SEGMENT(state->data);
+            block_index++) {
+        file_owner = segsum->entries[block_index].file_owner;
+        file_offset = segsum->entries[block_index].file_offset;
+        block_offset = (off_t) segment * state->segment_size
+                + (off_t) block_index * BLOCK_SIZE;
+        if(file_owner == 0 || file_owner == SEGSUM_FREED) {
+            continue;
+        }
+
+        if(file_owner == SEGSUM_METADATA || file_owner == SEGSUM_INODES) {
+            block = get_cached_block(state, block_offset);
+            if(block == NULL) {
+                if(read_clean_block(state, block_offset, scratch) == -1) {
+                    return -1;
                 }
+
+                block = scratch;
             }
         }
-        free(segsum_sort_array);
-        old_tail = find_next_clean_segment(data->tail);
-        if(old_tail == (off_t) -1) {
-            fprintf(stderr, "cleaning error: no clean segments left\n");
-            free_tables(imap_table, total_imap_count, file_table, 
-                        data->file_count, d_ind_table, 
-                        datablock_table, datablock_count);
-
-            return;
-        }
-
-        tail = old_tail;
-        new_block_count = datablock_count + d_ind_count + ind_count + file_count
-                + imap_count;
-        old_offsets = (off_t*) malloc(new_block_count * sizeof(off_t));
-        old_offset_index = 0;
-        append_buffer = (char*) malloc(new_block_count * BLOCK_SIZE);
-        append_entries = (struct segsum_entry*) 
-                malloc(new_block_count * sizeof(struct segsum_entry));
-        pos = 0;
-        if(old_offsets == NULL || append_buffer == NULL 
-                || append_entries == NULL) {
-            fprintf(stderr, "cleaning error: malloc failed\n");
-            free_tables(imap_table, total_imap_count, file_table, 
-                        data->file_count, d_ind_table, 
-                        datablock_table, datablock_count);
-            free(old_offsets);
-            free(append_buffer);
-            free(append_entries);
-
-            return;
-        }
-
-        for(datablock = 0; datablock < datablock_count; datablock++) {
-            memcpy(append_buffer + pos, datablock_table[datablock], BLOCK_SIZE);
-            file_owner = entry_table[datablock]->file_owner;
-            block = entry_table[datablock]->file_offset / BLOCK_SIZE;
-            if(block < DIRECT_BLOCK_COUNT) {
-                old_offsets[old_offset_index] = 
-                        file_table[file_owner]->direct_blocks[block];
-            } else {
-                old_offsets[old_offset_index] = d_ind_table[file_owner]
-                        .indirects[DOUBLE_INDIRECT_INDEX(block)]
-                                  [INDIRECT_INDEX(block)];
+
+        if(file_owner == SEGSUM_METADATA) {
+            if(txn_load_imap(txn, (int) file_offset,
+                             (struct inode_map*) block) == NULL) {
+                return -1;
             }
-            append_entries[old_offset_index].file_owner = file_owner;
-            append_entries[old_offset_index].file_offset = 
-                    entry_table[datablock]->file_offset;
-            old_offset_index++;
-            file_table[file_owner]->direct_blocks[block] = tail;
-            tail = increment_tail(tail);
-            pos += BLOCK_SIZE;
-        }
-        for(inumber = 0; inumber < data->file_count; inumber++) {
-            if(d_ind_table[inumber].indirects != NULL) {
-                for(i = 0; i < OFFSETS_PER_BLOCK; i++) {
-                    if(d_ind_table[inumber].indirects[i] != NULL) {
-                        memcpy(append_buffer + pos, 
-                               d_ind_table[inumber].indirects[i], BLOCK_SIZE);
-                        old_offsets[old_offset_index] = 
-                                d_ind_table[inumber].original[i];
-                        if(inumber == 0) {
-                            append_entries[old_offset_index].file_owner = 
-                                    SEGSUM_ROOT;
-                        } else {
-                            append_entries[old_offset_index].file_owner = 
-                                    inumber;
-                        }
-                        append_entries[old_offset_index].file_offset = (i + 1) 
-                                * SEGSUM_INDIRECT;
-                        old_offset_index++;
-                        d_ind_table[inumber].original[i] = tail;
-                        tail = increment_tail(tail);
-                        pos += BLOCK_SIZE;
-                    }
+
+            continue;
+        }
+
+        if(file_owner == SEGSUM_INODES) {
+            for(slot = 0; slot < INODE_SLOTS_PER_BLOCK; slot++) {
+                if((file_offset & ((off_t) 1 << slot)) == 0) {
+                    continue;
                 }
-                memcpy(append_buffer + pos, d_ind_table[inumber].original, 
-                       BLOCK_SIZE);
-                old_offsets[old_offset_index] = 
-                        file_table[inumber]->double_indirect_block;
-                if(inumber == 0) {
-                    append_entries[old_offset_index].file_owner = SEGSUM_ROOT;
-                } else {
-                    append_entries[old_offset_index].file_owner = inumber;
+
+                record = (struct inode*) (block + slot * INODE_SLOT_SIZE);
+                inumber = (int) record->statbuf.st_ino;
+                // only the imap says which record of an inode is live, the
+                // slot mask may still hold one that died
+                if(inumber < 0 || inumber > state->data->max_inumber) {
+                    continue;
                 }
-                append_entries[old_offset_index].file_offset = 
-                        SEGSUM_DOUBLE_INDIRECT;
-                old_offset_index++;
-                file_table[inumber]->double_indirect_block = tail;
-                tail = increment_tail(tail);
-                pos += BLOCK_SIZE;
-            }
-            if(file_table[inumber] != NULL) {
-                memcpy(append_buffer + pos, file_table[inumber], 
-                       sizeof(struct inode));
-                imap_number = INODE_TO_IMAP(inumber);
-                imap_index = INODE_TO_IMAP_INDEX(inumber);
-                old_offsets[old_offset_index] = 
-                        imap_table[imap_number]->inode_blocks[imap_index];
-                if(inumber == 0) {
-                    append_entries[old_offset_index].file_owner = SEGSUM_ROOT;
-                } else {
-                    append_entries[old_offset_index].file_owner = inumber;
+
+                imap = txn_get_imap(txn, INODE_TO_IMAP(inumber));
+                if(imap == NULL) {
+                    return -1;
                 }
-                append_entries[old_offset_index].file_offset = SEGSUM_METADATA;
-                old_offset_index++;
-                imap_table[imap_number]->inode_blocks[imap_index] = tail;
-                tail = increment_tail(tail);
-                pos += BLOCK_SIZE;
+
+                if(imap->inode_blocks[INODE_TO_IMAP_INDEX(inumber)]
+                        != block_offset + slot * INODE_SLOT_SIZE) {
+                    continue;
+                }
+
+                cfile = get_clean_file(state, inumber, record);
+                if(cfile == NULL
+                        || txn_dirty_inode(txn, &(cfile->file)) == -1) {
+                    return -1;
+                }
+            }
+
+            continue;
+        }
+
+        inumber = file_owner == SEGSUM_ROOT ? ROOT_INUMBER : file_owner;
+        cfile = get_clean_file(state, inumber, NULL);
+        if(cfile == NULL || txn_dirty_inode(txn, &(cfile->file)) == -1) {
+            return -1;
+        }
+
+        if(file_offset == SEGSUM_DOUBLE_INDIRECT) {
+            if(get_clean_double_indirect(state, cfile) == NULL) {
+                return -1;
+            }
+
+            continue;
+        }
+
+        if(file_offset <= SEGSUM_INDIRECT) {
+            if(get_clean_indirect(state, cfile,
+                                  file_offset / SEGSUM_INDIRECT - 1) == NULL) {
+                return -1;
+            }
+
+            continue;
+        }
+
+        if(write_time > cfile->last_write) {
+            cfile->last_write = write_time;
+        }
+        if(add_live_block(&(state->live), inumber, file_offset,
+                          block_offset) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// copy the live data blocks to the transaction in sorted order and point
+// their files at the new copies
+int relocate_live_blocks(struct clean_state* state) {
+    struct live_block_list* live = &(state->live);
+    struct live_block* live_block;
+    struct clean_file* cfile;
+    off_t new_offset, *indirect;
+    int block_no;
+    for(int i = 0; i < live->count; i++) {
+        live_block = &(live->blocks[i]);
+        live_block->age_key =
+                state->file_table[live_block->inumber]->last_write;
+    }
+    qsort(live->blocks, live->count, sizeof(struct live_block),
+          compare_live_blocks);
+    for(int i = 0; i < live->count; i++) {
+        live_block = &(live->blocks[i]);
+        cfile = state->file_table[live_block->inumber];
+        if(state->relocate == RELOCATE_COPY_RANGE) {
+            new_offset = txn_append_copy(state->txn, live_block->block_offset,
+                                         SEGSUM_OWNER(live_block->inumber),
+                                         live_block->file_offset,
+                                         live_block->block_offset);
+        } else {
+            new_offset = txn_append(state->txn,
+                                    get_cached_block(state,
+                                                     live_block->block_offset),
+                                    BLOCK_SIZE,
+                                    SEGSUM_OWNER(live_block->inumber),
+                                    live_block->file_offset,
+                                    live_block->block_offset);
+        }
+        if(new_offset == (off_t) -1) {
+            return -1;
+        }
+
+        block_no = live_block->file_offset / BLOCK_SIZE;
+        if(block_no < DIRECT_BLOCK_COUNT) {
+            cfile->file.direct_blocks[block_no] = new_offset;
+        } else {
+            indirect = get_clean_indirect(state, cfile,
+                                          DOUBLE_INDIRECT_INDEX(block_no));
+            if(indirect == NULL) {
+                return -1;
             }
+
+            indirect[INDIRECT_INDEX(block_no)] = new_offset;
         }
-        for(imap_number = 0; imap_number < total_imap_count; imap_number++) {
-            if(imap_table[imap_number] != NULL) {
-                memcpy(append_buffer + pos, imap_table[imap_number], 
-                       sizeof(struct inode_map));
-                old_offsets[old_offset_index] = 
-                        sblock.inode_map_blocks[imap_number];
-                append_entries[old_offset_index].file_owner = SEGSUM_METADATA;
-                append_entries[old_offset_index].file_offset = imap_number;
-                old_offset_index++;
-                sblock.inode_map_blocks[imap_number] = tail;
-                tail = increment_tail(tail);
-                pos += BLOCK_SIZE;
+    }
+
+    return 0;
+}
+
+// append the indirect and double indirect blocks that were loaded (and so
+// changed or need to move) during relocation
+int flush_clean_files(struct clean_state* state) {
+    struct clean_file* cfile;
+    off_t new_offset;
+    int file_owner;
+    for(int inumber = 0; inumber < state->file_table_len; inumber++) {
+        cfile = state->file_table[inumber];
+        if(cfile == NULL || cfile->double_indirect == NULL) {
+            continue;
+        }
+
+        file_owner = SEGSUM_OWNER(inumber);
+        for(int i = 0; i < OFFSETS_PER_BLOCK; i++) {
+            if(cfile->indirects[i] == NULL) {
+                continue;
+            }
+
+            new_offset = txn_append(state->txn, cfile->indirects[i],
+                                    BLOCK_SIZE, file_owner,
+                                    (i + 1) * SEGSUM_INDIRECT,
+                                    cfile->double_indirect[i]);
+            if(new_offset == (off_t) -1) {
+                return -1;
             }
+
+            cfile->double_indirect[i] = new_offset;
+        }
+        new_offset = txn_append(state->txn, cfile->double_indirect, BLOCK_SIZE,
+                                file_owner, SEGSUM_DOUBLE_INDIRECT,
+                                cfile->file.double_indirect_block);
+        if(new_offset == (off_t) -1) {
+            return -1;
+        }
+
+        cfile->file.double_indirect_block = new_offset;
+    }
+
+    return 0;
+}
+
+// relocate the live blocks of state's victims in one transaction
+int clean_victims(struct clean_state* state) {
+    int status = 0;
+    int relocated = 0;
+    struct log_txn txn;
+    state->file_table_len = state->data->max_inumber + 1;
+    state->file_table = (struct clean_file**)
+            calloc(state->file_table_len, sizeof(struct clean_file*));
+    if(state->file_table == NULL) {
+        fprintf(stderr, "cleaning error: calloc failed\n");
+
+        return -1;
+    }
+
+    if(txn_begin(&txn, state->data, state->sblock) == -1) {
+        free_clean_files(state);
+
+        return -1;
+    }
+
+    if(state->relocate == RELOCATE_READ) {
+        start_victim_reads(state);
+    }
+
+    // survivors get a head of their own, and must not be threaded into
+    // victims that haven't been read yet
+    txn.data_head = LOG_HEAD_CLEAN;
+    txn.allow_threading = false;
+    state->txn = &txn;
+    memset(&(state->live), 0, sizeof(struct live_block_list));
+    for(int victim = 0; victim < state->victim_count && status == 0;
+            victim++) {
+        status = scan_segment(state, victim);
+    }
+    // the readers must be done with the buffers whatever happened
+    if(state->relocate == RELOCATE_READ && finish_victim_reads(state) == -1) {
+        status = -1;
+    }
+    if(status == 0) {
+        status = relocate_live_blocks(state);
+    }
+    if(status == 0) {
+        status = flush_clean_files(state);
+    }
+    if(status == 0) {
+        relocated = txn.block_count;
+        status = txn_commit(&txn, false);
+    } else {
+        txn_abort(&txn);
+    }
+    free(state->live.blocks);
+    free_clean_files(state);
+    if(status == 0) {
+        state->data->stats.blocks_relocated += relocated;
+    }
+
+    return status;
+}
+
+void free_clean_state(struct clean_state* state) {
+    free(state->victims);
+    free(state->segments);
+    free(state->read_status);
+    free(state->readers);
+}
+
+// relocate batches of victims until stop_threshold segments are clean
+static void run_cleaner(struct lfs_data* data) {
+    struct superblock sblock;
+    struct clean_state state;
+    int clean_before;
+    // blocks freed since the last checkpoint may already be enough
+    if(sync_checkpoint(data) != 0) {
+        return;
+    }
+
+    // options may change between cleans, but not during one
+    int stop_threshold = clean_threshold(data, &(data->clean_config.stop));
+    int batch = clean_threshold(data, &(data->clean_config.batch));
+    if(batch < 1) {
+        batch = 1;
+    }
+    if(data->clean_config.relocate == RELOCATE_READ
+            && batch > MAX_CLEAN_BUFFER_SIZE / data->segment_size) {
+        batch = MAX_CLEAN_BUFFER_SIZE / data->segment_size;
+    }
+    memset(&state, 0, sizeof(struct clean_state));
+    state.data = data;
+    state.sblock = &sblock;
+    state.fd = data->fd;
+    state.segment_size = data->segment_size;
+    state.relocate = data->clean_config.relocate;
+    state.reader_capacity = data->clean_config.threads;
+    state.victims = (int*) malloc(batch * sizeof(int));
+    if(state.relocate == RELOCATE_READ) {
+        state.segments = (char*)
+                alloc_log_buffer((size_t) batch * state.segment_size);
+        state.read_status = (int*) malloc(batch * sizeof(int));
+        state.readers = (pthread_t*)
+                malloc(state.reader_capacity * sizeof(pthread_t));
+    }
+    if(state.victims == NULL
+            || (state.relocate == RELOCATE_READ
+                    && (state.segments == NULL || state.read_status == NULL
+                            || state.readers == NULL))) {
+        fprintf(stderr, "cleaning error: malloc failed\n");
+        free_clean_state(&state);
+
+        return;
+    }
+
+    if(pthread_mutex_init(&(state.read_lock), NULL) != 0) {
+        free_clean_state(&state);
+
+        return;
+    }
+
+    if(pthread_cond_init(&(state.read_cond), NULL) != 0) {
+        pthread_mutex_destroy(&(state.read_lock));
+        free_clean_state(&state);
+
+        return;
+    }
+
+    while(data->clean_segments < stop_threshold) {
+        if(get_superblock(data, &sblock) == NULL) {
+            break;
         }
-        free_tables(imap_table, total_imap_count, file_table, 
-                    data->file_count, d_ind_table,
-                    datablock_table, datablock_count);
-        data->tail = old_tail;
-        append_status = log_append(&sblock, append_buffer, 
-                                   new_block_count * BLOCK_SIZE, 
-                                   append_entries, false);
-        free(append_buffer);
-        free(append_entries);
-        if(append_status == -1) {
-            free(old_offsets);
 
-            return;
+        state.victim_count = select_victims(data, state.victims, batch);
+        if(state.victim_count <= 0) {
+            break;
         }
 
-        clear_segsum_entries(old_offsets, new_block_count);
-        free(old_offsets);
+        clean_before = data->clean_segments;
+        data->stats.clean_passes++;
+        // victims only become clean once the relocation is checkpointed
+        if(clean_victims(&state) == -1 || sync_checkpoint(data) != 0
+                || data->clean_segments <= clean_before) {
+            // stop if cleaning didn't free anything, victims are all live
+            break;
+        }
+
+        data->stats.segments_cleaned += data->clean_segments - clean_before;
+    }
+    pthread_cond_destroy(&(state.read_cond));
+    pthread_mutex_destroy(&(state.read_lock));
+    free_clean_state(&state);
+}
+
+// Mr. Clean gets tough on cold segments
+void clean(struct lfs_data* data) {
+    struct timespec start = latency_start();
+    data->stats.clean_runs++;
+    run_cleaner(data);
+    data->stats.clean_time_ns += elapsed_ns(&start);
+    record_latency(data, LATENCY_CLEAN, &start, 0);
+}
+
+// use segment_size for data's log, which must be a power of two within the
+// limits, -1 if it isn't
+int set_segment_size(struct lfs_data* data, int segment_size) {
+    if(segment_size < MIN_SEGMENT_SIZE || segment_size > MAX_SEGMENT_SIZE
+            || (segment_size & (segment_size - 1)) != 0) {
+        fprintf(stderr, "invalid segment size %d, must be a power of two "
+                "from %d to %d\n", segment_size, MIN_SEGMENT_SIZE,
+                MAX_SEGMENT_SIZE);
+
+        return -1;
+    }
+
+    data->segment_size = segment_size;
+    data->segsum_size = sizeof(struct segment_summary)
+            + (size_t) BLOCKS_PER_SEGMENT(data) * sizeof(struct segsum_entry);
+
+    return 0;
+}
+
+bool is_head_segment(struct lfs_data* data, int segment,
+                     off_t heads[LOG_HEAD_COUNT]) {
+    for(int head = 0; head < LOG_HEAD_COUNT; head++) {
+        if(heads[head] / data->segment_size == segment) {
+            return true;
+        }
     }
+
+    return false;
 }
 
-off_t find_next_clean_segment(off_t tail) {
-    struct lfs_data* data = PRIVATE_DATA;
+// first clean segment at or after tail that no head is writing to, -1 if there
+// is none
+off_t find_next_clean_segment(struct lfs_data* data, off_t tail,
+                              off_t heads[LOG_HEAD_COUNT]) {
     if(data->clean_segments == 0) {
         return -1;
     }
 
-    int current_segment = tail / SEGMENT_SIZE;
-    while(data->segsums[current_segment].live_bytes > 0) {
-        current_segment = current_segment % (data->segment_count - 1) + 1;
+    int current_segment = tail / data->segment_size;
+    for(int i = data->prologue_segments; i < data->segment_count; i++) {
+        if(current_segment >= data->segment_count) {
+            current_segment = data->prologue_segments;
+        }
+
+        if(SEGSUM(data, current_segment)->live_bytes == 0
+                && !is_head_segment(data, current_segment, heads)) {
+            return (off_t) current_segment * data->segment_size;
+        }
+
+        current_segment++;
     }
 
-    return current_segment * SEGMENT_SIZE;
+    return -1;
 }
 
-off_t increment_tail(off_t tail) {
-    // threading
-    struct lfs_data* data = PRIVATE_DATA;
-    struct segsum_entry* entry;
-    do {
+// next block for the head at tail: the rest of its segment, then a fresh
+// clean segment, -1 if there is none
+off_t increment_tail(struct lfs_data* data, off_t tail,
+                     off_t heads[LOG_HEAD_COUNT]) {
+    for(tail += BLOCK_SIZE; tail % data->segment_size != 0;
+            tail += BLOCK_SIZE) {
+        if(get_segsum_entry(data, tail)->file_owner == 0) {
+            return tail;
+        }
+    }
+
+    return find_next_clean_segment(data, tail, heads);
+}
+
+// threading: next free block in any segment no head is writing to, for when
+// there are no clean segments left, -1 if the log is full
+off_t thread_tail(struct lfs_data* data, off_t tail,
+                  off_t heads[LOG_HEAD_COUNT]) {
+    off_t log_start = (off_t) data->prologue_segments * data->segment_size;
+    off_t block_count = (data->log_size - log_start) / BLOCK_SIZE;
+    for(off_t i = 0; i < block_count; i++) {
         tail += BLOCK_SIZE;
         if(tail >= data->log_size) {
-            tail = SEGMENT_SIZE;
+            tail = log_start;
         }
-        entry = get_segsum_entry(tail);
-    } while(entry->file_owner != 0);
 
-    return tail;
+        if(get_segsum_entry(data, tail)->file_owner == 0
+                && !is_head_segment(data, tail / data->segment_size, heads)) {
+            return tail;
+        }
+    }
+
+    return -1;
 }
 
-struct segment_summary* get_segsum(off_t offset) {
-    int segment = offset / SEGMENT_SIZE;
+// deallocate count segments starting at first in the host filesystem, the
+// log file keeps its size; they are no longer pending once that succeeded
+static int punch_segments(struct lfs_data* data, int first, int count) {
+    if(count == 0) {
+        return 0;
+    }
 
-    return &(PRIVATE_DATA->segsums[segment]);
+    if(fallocate(data->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                 (off_t) first * data->segment_size,
+                 (off_t) count * data->segment_size) == -1) {
+        fprintf(stderr, "failed to punch segments %d to %d\n", first,
+                first + count - 1);
+        if(errno == EOPNOTSUPP) {
+            // the host filesystem can't, stop trying for this mount
+            data->clean_config.punch_rate = 0;
+        }
+
+        return -1;
+    }
+    for(int seg = first; seg < first + count; seg++) {
+        data->punch_pending[seg] = false;
+    }
+    data->stats.segments_punched += count;
+
+    return 0;
 }
 
-struct segsum_entry* get_segsum_entry(off_t offset) {
-    int index = offset % SEGMENT_SIZE / BLOCK_SIZE;
+// give the space of clean segments back to the host filesystem, at most
+// punch_rate segments a second, runs of adjacent segments with one call each
+// segments whose punch failed stay pending and are tried again next time
+void punch_clean_segments(struct lfs_data* data) {
+    int rate = data->clean_config.punch_rate;
+    struct timespec now;
+    if(rate <= 0 || clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        return;
+    }
+
+    double elapsed = (now.tv_sec - data->last_punch.tv_sec)
+            + (double) (now.tv_nsec - data->last_punch.tv_nsec) / NSEC_PER_SEC;
+    memcpy(&(data->last_punch), &now, sizeof(struct timespec));
+    // bursts are capped at a second's worth
+    data->punch_budget += elapsed * rate;
+    if(data->punch_budget > rate) {
+        data->punch_budget = rate;
+    }
+    int budget = (int) data->punch_budget;
+    // only segments actually punched use up the budget
+    int punched = 0, run_start = 0, run_length = 0;
+    for(int seg = data->prologue_segments; seg < data->segment_count
+            && punched + run_length < budget; seg++) {
+        if(!data->punch_pending[seg] || SEGSUM(data, seg)->live_bytes > 0
+                || is_head_segment(data, seg, data->heads)) {
+            if(punch_segments(data, run_start, run_length) == -1) {
+                run_length = 0;
+                break;
+            }
 
-    return &(get_segsum(offset)->entries[index]);
+            punched += run_length;
+            run_length = 0;
+            continue;
+        }
+
+        if(run_length == 0) {
+            run_start = seg;
+        }
+        run_length++;
+    }
+    if(punch_segments(data, run_start, run_length) == 0) {
+        punched += run_length;
+    }
+    data->punch_budget -= punched;
 }
 
-void clear_segsum_entries(off_t* offsets, int offset_count) {
-    struct lfs_data* data = PRIVATE_DATA;
-    struct segment_summary* segsum;
+// allocate count segments starting at first in the host filesystem before
+// they are written
+int prealloc_segments(struct lfs_data* data, int first, int count) {
+    if(fallocate(data->fd, FALLOC_FL_KEEP_SIZE,
+                 (off_t) first * data->segment_size,
+                 (off_t) count * data->segment_size) == -1) {
+        fprintf(stderr, "failed to preallocate segments %d to %d\n", first,
+                first + count - 1);
+        if(errno == EOPNOTSUPP) {
+            data->prealloc = PREALLOC_NONE;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+struct segment_summary* get_segsum(struct lfs_data* data, off_t offset) {
+    int segment = offset / data->segment_size;
+
+    return SEGSUM(data, segment);
+}
+
+struct segsum_entry* get_segsum_entry(struct lfs_data* data, off_t offset) {
+    int index = offset % data->segment_size / BLOCK_SIZE;
+
+    return &(get_segsum(data, offset)->entries[index]);
+}
+
+void clear_segsum_entries(struct lfs_data* data, off_t* offsets,
+                          int offset_count) {
     struct segsum_entry* entry;
     for(int index = 0; index < offset_count; index++) {
-        if(offsets[index] != -1) {
-            segsum = get_segsum(offsets[index]);
-            entry = get_segsum_entry(offsets[index]);
-            entry->file_owner = 0;
-            entry->file_offset = 0;
-            segsum->live_bytes -= BLOCK_SIZE;
-            if(segsum->live_bytes == 0) {
-                data->clean_segments++;
+        if(offsets[index] == -1) {
+            continue;
+        }
+
+        entry = get_segsum_entry(data, offsets[index]);
+        if(entry->file_owner == 0 || entry->file_owner == SEGSUM_FREED) {
+            // already cleared
+            continue;
+        }
+
+        // a slot going dead changes the summary as much as a freed block
+        data->segsum_dirty[offsets[index] / data->segment_size] = true;
+        if(entry->file_owner == SEGSUM_INODES) {
+            // inode block stays live until its last live slot is released
+            entry->file_offset &= ~((off_t) 1 << INODE_SLOT(offsets[index]));
+            if(entry->file_offset != 0) {
+                continue;
             }
         }
+
+        // the last checkpoint may still point here, reuse after the next one
+        entry->file_owner = SEGSUM_FREED;
+        entry->file_offset = 0;
     }
 }
@@ -3,28 +3,42 @@
 
 #include "380LFS.h"
 
-// clean when number of clean segments falls below threshold
-#define START_CLEAN_SEGMENT_THRESHOLD 20
-// number of dirty segments to clean per iteration
-#define SEGMENTS_PER_CLEAN 20
-// stop cleaning once number of clean segments falls above threshold
-#define STOP_CLEAN_SEGMENT_THRESHOLD 75
+// data overwritten within this many seconds of its last write is hot
+#define HOT_DATA_AGE_SEC 60
 
 #define SEGSUM_ROOT (-1)
 #define SEGSUM_METADATA (-2)
 #define SEGSUM_DOUBLE_INDIRECT (-3)
 #define SEGSUM_INDIRECT (-4)
-
-#define ROUND_DOWN_SEGMENT(size) ((size) / SEGMENT_SIZE * SEGMENT_SIZE)
-#define ROUND_UP_SEGMENT(size) ROUND_DOWN_SEGMENT((size) + SEGMENT_SIZE)
+// owner of a packed inode block, file_offset is the bitmask of live slots
+#define SEGSUM_INODES (-5)
+// block freed since the last checkpoint, which still points to it, so it can't
+// be reused until the next checkpoint is durable
+#define SEGSUM_FREED (-6)
+// segsum owner of a file's blocks (0 already means clean)
+#define SEGSUM_OWNER(inumber) \
+        ((inumber) == ROOT_INUMBER ? SEGSUM_ROOT : (inumber))
 
 #define NSEC_PER_SEC 1000000000
 
-void clean();
-off_t find_next_clean_segment(off_t);
-off_t increment_tail(off_t);
-struct segment_summary* get_segsum(off_t);
-struct segsum_entry* get_segsum_entry(off_t);
-void clear_segsum_entries(off_t*, int);
+// how the log file's space is allocated in the host filesystem: on demand,
+// all of it when the log is created or mounted, or a segment at a time as a
+// log head moves into it
+#define PREALLOC_NONE 0
+#define PREALLOC_FULL 1
+#define PREALLOC_AHEAD 2
+
+void clean(struct lfs_data*);
+int select_victims(struct lfs_data*, int*, int);
+int set_segment_size(struct lfs_data*, int);
+bool is_head_segment(struct lfs_data*, int, off_t[LOG_HEAD_COUNT]);
+off_t find_next_clean_segment(struct lfs_data*, off_t, off_t[LOG_HEAD_COUNT]);
+off_t increment_tail(struct lfs_data*, off_t, off_t[LOG_HEAD_COUNT]);
+off_t thread_tail(struct lfs_data*, off_t, off_t[LOG_HEAD_COUNT]);
+struct segment_summary* get_segsum(struct lfs_data*, off_t);
+struct segsum_entry* get_segsum_entry(struct lfs_data*, off_t);
+void clear_segsum_entries(struct lfs_data*, off_t*, int);
+void punch_clean_segments(struct lfs_data*);
+int prealloc_segments(struct lfs_data*, int, int);
 
 #endif
@@ -0,0 +1,158 @@
+#include "stats.h"
+#include "metadata_helpers.h"
+#include "segments.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+bool is_stats_path(const char* path) {
+    return strcmp(path, STATS_PATH) == 0;
+}
+
+// nanoseconds since start on the monotonic clock
+uint64_t elapsed_ns(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) (now.tv_sec - start->tv_sec) * NSEC_PER_SEC
+            + now.tv_nsec - start->tv_nsec;
+}
+
+static double ratio(uint64_t numerator, uint64_t denominator) {
+    return denominator == 0 ? 0.0 : (double) numerator / denominator;
+}
+
+// write the counters, a histogram of how full the log's segments are and the
+// latency percentiles to buf as "name value" lines, returns the length written
+int format_stats(struct lfs_data* data, char* buf, size_t size) {
+    struct lfs_stats* stats = &(data->stats);
+    int histogram[UTILIZATION_BUCKETS];
+    memset(histogram, 0, sizeof(histogram));
+    int bucket;
+    for(int seg = data->prologue_segments; seg < data->segment_count; seg++) {
+        bucket = (int) ((long) SEGSUM(data, seg)->live_bytes
+                * UTILIZATION_BUCKETS / data->segment_size);
+        if(bucket >= UTILIZATION_BUCKETS) {
+            // full segments share the top bucket
+            bucket = UTILIZATION_BUCKETS - 1;
+        }
+        histogram[bucket]++;
+    }
+
+    uint64_t log_bytes = stats->log_bytes_written
+            + stats->checkpoint_bytes_written;
+    uint64_t readahead_reads = stats->readahead_hits + stats->readahead_misses;
+    int length = snprintf(buf, size,
+            "user_bytes_written %lu\n"
+            "user_bytes_read %lu\n"
+            "log_bytes_written %lu\n"
+            "checkpoint_bytes_written %lu\n"
+            "write_amplification %.3f\n"
+            "checkpoints %lu\n"
+            "clean_runs %lu\n"
+            "clean_passes %lu\n"
+            "segments_cleaned %lu\n"
+            "blocks_relocated %lu\n"
+            "inode_blocks %lu\n"
+            "clean_time_us %lu\n"
+            "segments_punched %lu\n"
+            "readahead_hits %lu\n"
+            "readahead_misses %lu\n"
+            "readahead_hit_rate %.3f\n"
+            "blocks_prefetched %lu\n"
+            "files %d\n"
+            "segment_size %d\n"
+            "segments %d\n"
+            "clean_segments %d\n",
+            (unsigned long) stats->user_bytes_written,
+            (unsigned long) stats->user_bytes_read,
+            (unsigned long) stats->log_bytes_written,
+            (unsigned long) stats->checkpoint_bytes_written,
+            ratio(log_bytes, stats->user_bytes_written),
+            (unsigned long) stats->checkpoints,
+            (unsigned long) stats->clean_runs,
+            (unsigned long) stats->clean_passes,
+            (unsigned long) stats->segments_cleaned,
+            (unsigned long) stats->blocks_relocated,
+            (unsigned long) stats->inode_blocks,
+            (unsigned long) (stats->clean_time_ns / 1000),
+            (unsigned long) stats->segments_punched,
+            (unsigned long) stats->readahead_hits,
+            (unsigned long) stats->readahead_misses,
+            ratio(stats->readahead_hits, readahead_reads),
+            (unsigned long) stats->blocks_prefetched,
+            data->file_count,
+            data->segment_size,
+            data->segment_count - data->prologue_segments,
+            data->clean_segments);
+    for(bucket = 0; bucket < UTILIZATION_BUCKETS
+            && length >= 0 && (size_t) length < size; bucket++) {
+        length += snprintf(buf + length, size - length,
+                           "segment_utilization_%d_%d %d\n",
+                           bucket * 100 / UTILIZATION_BUCKETS,
+                           (bucket + 1) * 100 / UTILIZATION_BUCKETS,
+                           histogram[bucket]);
+    }
+    if(length >= 0 && (size_t) length < size) {
+        length += format_latency(data->latency, buf + length, size - length);
+    }
+    if(length < 0) {
+        return 0;
+    }
+
+    return (size_t) length < size ? length : (int) size - 1;
+}
+
+int get_stats_attr(struct lfs_data* data, struct stat* statbuf) {
+    char buf[STATS_SIZE_MAX];
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+    statbuf->st_nlink = 1;
+    statbuf->st_size = format_stats(data, buf, STATS_SIZE_MAX);
+    clock_gettime(CLOCK_REALTIME, &(statbuf->st_mtim));
+    statbuf->st_atim = statbuf->st_mtim;
+    statbuf->st_ctim = statbuf->st_mtim;
+
+    return 0;
+}
+
+int open_stats(struct lfs_data* data, int flags, struct open_file** fh) {
+    if((flags & O_ACCMODE) != O_RDONLY) {
+        return -EACCES;
+    }
+
+    struct inode empty;
+    memset(&empty, 0, sizeof(struct inode));
+    char* snapshot = (char*) malloc(STATS_SIZE_MAX);
+    if(snapshot == NULL || init_fh(data, &empty, fh) == -1) {
+        fprintf(stderr, "stats: malloc failed\n");
+        free(snapshot);
+
+        return -ENOMEM;
+    }
+
+    struct open_file* file = *fh;
+    file->flags = flags;
+    file->stats = snapshot;
+    file->stats_size = format_stats(data, snapshot, STATS_SIZE_MAX);
+
+    return 0;
+}
+
+int read_stats(struct open_file* file, char* buf, size_t size, off_t offset) {
+    if(offset >= file->stats_size) {
+        return 0;
+    }
+
+    if(offset + size > file->stats_size) {
+        size = file->stats_size - offset;
+    }
+    memcpy(buf, file->stats + offset, size);
+
+    return size;
+}
@@ -0,0 +1,24 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "380LFS.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// read-only file at the mount root with the counters in lfs_stats, its
+// contents are a snapshot taken when it's opened
+#define STATS_PATH "/.lfs_stats"
+#define STATS_SIZE_MAX 16384
+// segment utilization histogram buckets, each a tenth of a segment wide
+#define UTILIZATION_BUCKETS 10
+
+bool is_stats_path(const char*);
+int format_stats(struct lfs_data*, char*, size_t);
+int get_stats_attr(struct lfs_data*, struct stat*);
+int open_stats(struct lfs_data*, int, struct open_file**);
+int read_stats(struct open_file*, char*, size_t, off_t);
+uint64_t elapsed_ns(struct timespec*);
+
+#endif
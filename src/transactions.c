@@ -0,0 +1,597 @@
+#include "380LFS.h"
+#include "transactions.h"
+#include "metadata_helpers.h"
+#include "segments.h"
+#include "clean_policy.h"
+#include "log_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void txn_free(struct log_txn*);
+
+int txn_begin(struct log_txn* txn, struct lfs_data* data,
+              struct superblock* sblock) {
+    memset(txn, 0, sizeof(struct log_txn));
+    txn->data = data;
+    txn->sblock = sblock;
+    memcpy(txn->heads, data->heads, sizeof(txn->heads));
+    txn->data_head = -1;
+    txn->allow_threading = true;
+    txn->inode_block_offset = (off_t) -1;
+    txn->inode_block_index = -1;
+    if(clock_gettime(CLOCK_REALTIME, &(txn->start_time)) == -1) {
+        fprintf(stderr, "transaction: failed to read clock\n");
+
+        return -1;
+    }
+
+    txn->block_capacity = TXN_INITIAL_BLOCKS;
+    txn->stale_capacity = TXN_INITIAL_BLOCKS;
+    txn->inode_capacity = TXN_INITIAL_INODES;
+    txn->imap_capacity = TXN_INITIAL_INODES;
+    txn->buffer = (char*) alloc_log_buffer(txn->block_capacity * BLOCK_SIZE);
+    txn->entries = (struct segsum_entry*)
+            malloc(txn->block_capacity * sizeof(struct segsum_entry));
+    txn->offsets = (off_t*) malloc(txn->block_capacity * sizeof(off_t));
+    txn->sources = (off_t*) malloc(txn->block_capacity * sizeof(off_t));
+    txn->unpunched = (bool*) malloc(txn->block_capacity * sizeof(bool));
+    txn->stale_offsets = (off_t*) malloc(txn->stale_capacity * sizeof(off_t));
+    txn->inodes = (struct inode**)
+            malloc(txn->inode_capacity * sizeof(struct inode*));
+    txn->inode_offsets = (off_t*) malloc(txn->inode_capacity * sizeof(off_t));
+    txn->imaps = (struct inode_map**)
+            malloc(txn->imap_capacity * sizeof(struct inode_map*));
+    txn->imap_numbers = (int*) malloc(txn->imap_capacity * sizeof(int));
+    txn->imap_offsets = (off_t*) malloc(txn->imap_capacity * sizeof(off_t));
+    if(txn->buffer == NULL || txn->entries == NULL || txn->offsets == NULL
+            || txn->sources == NULL || txn->unpunched == NULL
+            || txn->stale_offsets == NULL
+            || txn->inodes == NULL || txn->inode_offsets == NULL
+            || txn->imaps == NULL || txn->imap_numbers == NULL
+            || txn->imap_offsets == NULL) {
+        fprintf(stderr, "transaction: malloc failed\n");
+        txn_abort(txn);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// log head for a block: metadata has its own head, data goes to the head the
+// transaction was given or, without one, hot if its previous version was
+// written recently and cold if it lived long
+// a segment's last write time stands in for the age of its blocks
+static int txn_choose_head(struct log_txn* txn, int file_owner,
+                           off_t file_offset, off_t old_offset) {
+    if(file_owner == SEGSUM_METADATA || file_owner == SEGSUM_INODES
+            || file_offset < 0) {
+        return LOG_HEAD_META;
+    }
+
+    if(txn->data_head != -1) {
+        return txn->data_head;
+    }
+
+    // the root directory is rewritten by every create and unlink
+    if(file_owner == SEGSUM_ROOT || old_offset == (off_t) -1) {
+        return LOG_HEAD_HOT;
+    }
+
+    struct timespec* last_write =
+            &(get_segsum(txn->data, old_offset)->last_write_time);
+    if(txn->start_time.tv_sec - last_write->tv_sec < HOT_DATA_AGE_SEC) {
+        return LOG_HEAD_HOT;
+    }
+
+    return LOG_HEAD_COLD;
+}
+
+// take the next block of the transaction for the right log head and reserve
+// it, returns its index in the transaction, -1 on failure
+// old_offset is the block's previous location, -1 if it had none
+static int txn_reserve(struct log_txn* txn, int file_owner, off_t file_offset,
+                       off_t old_offset) {
+    if(txn->block_count == txn->block_capacity) {
+        int new_capacity = txn->block_capacity * 2;
+        // realloc would lose the alignment O_DIRECT writes need
+        char* new_buffer = (char*) alloc_log_buffer(new_capacity * BLOCK_SIZE);
+        if(new_buffer == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        memcpy(new_buffer, txn->buffer,
+               (size_t) txn->block_count * BLOCK_SIZE);
+        free(txn->buffer);
+        txn->buffer = new_buffer;
+        struct segsum_entry* new_entries = (struct segsum_entry*)
+                realloc(txn->entries,
+                        new_capacity * sizeof(struct segsum_entry));
+        if(new_entries == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->entries = new_entries;
+        off_t* new_offsets = (off_t*) realloc(txn->offsets,
+                                              new_capacity * sizeof(off_t));
+        if(new_offsets == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->offsets = new_offsets;
+        off_t* new_sources = (off_t*) realloc(txn->sources,
+                                              new_capacity * sizeof(off_t));
+        if(new_sources == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->sources = new_sources;
+        bool* new_unpunched = (bool*) realloc(txn->unpunched,
+                                              new_capacity * sizeof(bool));
+        if(new_unpunched == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->unpunched = new_unpunched;
+        txn->block_capacity = new_capacity;
+    }
+
+    struct lfs_data* data = txn->data;
+    int head = txn_choose_head(txn, file_owner, file_offset, old_offset);
+    off_t block_offset = txn->heads[head];
+    off_t next_offset = increment_tail(data, block_offset, txn->heads);
+    if(next_offset == (off_t) -1 && txn->allow_threading) {
+        next_offset = thread_tail(data, block_offset, txn->heads);
+    }
+    if(next_offset == (off_t) -1) {
+        fprintf(stderr, "transaction: log is full\n");
+
+        return -1;
+    }
+
+    if(data->prealloc == PREALLOC_AHEAD
+            && next_offset / data->segment_size
+                    != block_offset / data->segment_size) {
+        // the head's next segment gets its host space before it is written
+        prealloc_segments(data, next_offset / data->segment_size, 1);
+    }
+
+    int index = txn->block_count;
+    txn->entries[index].file_owner = file_owner;
+    txn->entries[index].file_offset = file_offset;
+    txn->offsets[index] = block_offset;
+    txn->sources[index] = -1;
+    txn->unpunched[index] = false;
+    txn->block_count++;
+    // reserve the block so no head hands it out again before the commit
+    struct segment_summary* segsum = get_segsum(data, block_offset);
+    memcpy(get_segsum_entry(data, block_offset), &(txn->entries[index]),
+           sizeof(struct segsum_entry));
+    if(segsum->live_bytes == 0) {
+        data->clean_segments--;
+        txn->unpunched[index] =
+                data->punch_pending[block_offset / data->segment_size];
+        data->punch_pending[block_offset / data->segment_size] = false;
+    }
+    segsum->live_bytes += BLOCK_SIZE;
+    txn->heads[head] = next_offset;
+    if(old_offset != (off_t) -1 && txn_release(txn, old_offset) == -1) {
+        return -1;
+    }
+
+    return index;
+}
+
+// copy size bytes (at most one block) into the next block of the transaction
+// returns the log offset the block will be written to, -1 on failure
+// old_offset is the block's previous location, -1 if it had none
+off_t txn_append(struct log_txn* txn, const void* block, size_t size,
+                 int file_owner, off_t file_offset, off_t old_offset) {
+    int index = txn_reserve(txn, file_owner, file_offset, old_offset);
+    if(index == -1) {
+        return -1;
+    }
+
+    char* dest = txn->buffer + (size_t) index * BLOCK_SIZE;
+    memcpy(dest, block, size);
+    if(size < BLOCK_SIZE) {
+        memset(dest + size, 0, BLOCK_SIZE - size);
+    }
+
+    return txn->offsets[index];
+}
+
+// like txn_append, but the block is copied from log offset source inside the
+// kernel when the transaction is written, it never passes through txn's buffer
+off_t txn_append_copy(struct log_txn* txn, off_t source, int file_owner,
+                      off_t file_offset, off_t old_offset) {
+    int index = txn_reserve(txn, file_owner, file_offset, old_offset);
+    if(index == -1) {
+        return -1;
+    }
+
+    txn->sources[index] = source;
+
+    return txn->offsets[index];
+}
+
+// mark a block (or inode slot) as no longer live once the transaction is
+// committed
+int txn_release(struct log_txn* txn, off_t offset) {
+    if(offset == (off_t) -1) {
+        return 0;
+    }
+
+    if(txn->stale_count == txn->stale_capacity) {
+        int new_capacity = txn->stale_capacity * 2;
+        off_t* new_stale = (off_t*) realloc(txn->stale_offsets,
+                                            new_capacity * sizeof(off_t));
+        if(new_stale == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->stale_offsets = new_stale;
+        txn->stale_capacity = new_capacity;
+    }
+
+    txn->stale_offsets[txn->stale_count] = offset;
+    txn->stale_count++;
+
+    return 0;
+}
+
+// inode will be written (once) when the transaction commits, so it must stay
+// valid until then
+int txn_dirty_inode(struct log_txn* txn, struct inode* file) {
+    for(int i = 0; i < txn->inode_count; i++) {
+        if(txn->inodes[i] == file) {
+            return 0;
+        }
+    }
+
+    if(txn->inode_count == txn->inode_capacity) {
+        int new_capacity = txn->inode_capacity * 2;
+        struct inode** new_inodes = (struct inode**)
+                realloc(txn->inodes, new_capacity * sizeof(struct inode*));
+        if(new_inodes == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->inodes = new_inodes;
+        off_t* new_offsets = (off_t*) realloc(txn->inode_offsets,
+                                              new_capacity * sizeof(off_t));
+        if(new_offsets == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return -1;
+        }
+
+        txn->inode_offsets = new_offsets;
+        txn->inode_capacity = new_capacity;
+    }
+
+    txn->inodes[txn->inode_count] = file;
+    txn->inode_offsets[txn->inode_count] = file->offset;
+    txn->inode_count++;
+    file->version++;
+
+    return 0;
+}
+
+// send the data blocks txn appends for file to the head its temperature
+// hint asks for, if it has one
+void txn_set_data_head(struct log_txn* txn, struct inode* file) {
+    if(file->temperature == TEMPERATURE_HOT) {
+        txn->data_head = LOG_HEAD_HOT;
+    } else if(file->temperature == TEMPERATURE_COLD) {
+        txn->data_head = LOG_HEAD_COLD;
+    } else {
+        txn->data_head = -1;
+    }
+}
+
+// every imap loaded through the transaction is rewritten on commit
+struct inode_map* txn_get_imap(struct log_txn* txn, int imap_number) {
+    return txn_load_imap(txn, imap_number, NULL);
+}
+
+// like txn_get_imap, but an imap the transaction hasn't loaded yet is copied
+// from contents instead of read from the log, unless contents is NULL
+struct inode_map* txn_load_imap(struct log_txn* txn, int imap_number,
+                                const struct inode_map* contents) {
+    for(int i = 0; i < txn->imap_count; i++) {
+        if(txn->imap_numbers[i] == imap_number) {
+            return txn->imaps[i];
+        }
+    }
+
+    if(txn->imap_count == txn->imap_capacity) {
+        int new_capacity = txn->imap_capacity * 2;
+        struct inode_map** new_imaps = (struct inode_map**)
+                realloc(txn->imaps, new_capacity * sizeof(struct inode_map*));
+        if(new_imaps == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return NULL;
+        }
+
+        txn->imaps = new_imaps;
+        int* new_numbers = (int*) realloc(txn->imap_numbers,
+                                          new_capacity * sizeof(int));
+        if(new_numbers == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return NULL;
+        }
+
+        txn->imap_numbers = new_numbers;
+        off_t* new_offsets = (off_t*) realloc(txn->imap_offsets,
+                                              new_capacity * sizeof(off_t));
+        if(new_offsets == NULL) {
+            fprintf(stderr, "transaction: realloc failed\n");
+
+            return NULL;
+        }
+
+        txn->imap_offsets = new_offsets;
+        txn->imap_capacity = new_capacity;
+    }
+
+    struct inode_map* imap = (struct inode_map*)
+            calloc(1, sizeof(struct inode_map));
+    if(imap == NULL) {
+        fprintf(stderr, "transaction: malloc failed\n");
+
+        return NULL;
+    }
+
+    if(contents != NULL) {
+        memcpy(imap, contents, sizeof(struct inode_map));
+    } else if(get_imap(txn->data, imap_number * (OFFSETS_PER_BLOCK - 1),
+                       txn->sblock, imap) == NULL) {
+        free(imap);
+
+        return NULL;
+    }
+
+    txn->imaps[txn->imap_count] = imap;
+    txn->imap_numbers[txn->imap_count] = imap_number;
+    txn->imap_offsets[txn->imap_count] =
+            txn->sblock->inode_map_blocks[imap_number];
+    txn->imap_count++;
+
+    return imap;
+}
+
+// put the open inode block where the commit writes it: into the
+// transaction's buffer if the transaction reserved it, else over its old
+// contents in place
+static int txn_write_inode_block(struct log_txn* txn) {
+    struct lfs_data* data = txn->data;
+    if(txn->inode_block_index != -1
+            && txn->offsets[txn->inode_block_index]
+                    == data->inode_block_offset) {
+        memcpy(txn->buffer + (size_t) txn->inode_block_index * BLOCK_SIZE,
+               data->inode_block, BLOCK_SIZE);
+
+        return 0;
+    }
+
+    if(log_pwrite(data, data->inode_block, BLOCK_SIZE,
+                  data->inode_block_offset) < BLOCK_SIZE) {
+        fprintf(stderr, "failed to write to log\n");
+
+        return -1;
+    }
+    data->stats.log_bytes_written += BLOCK_SIZE;
+
+    return 0;
+}
+
+// reserve an empty inode block on the META head and make it the open one
+static int txn_open_inode_block(struct log_txn* txn) {
+    struct lfs_data* data = txn->data;
+    int index = txn_reserve(txn, SEGSUM_INODES, 0, -1);
+    if(index == -1) {
+        return -1;
+    }
+
+    memset(data->inode_block, 0, BLOCK_SIZE);
+    data->inode_block_offset = txn->offsets[index];
+    data->inode_block_slots = 0;
+    data->stats.inode_blocks++;
+    txn->inode_block_index = index;
+
+    return 0;
+}
+
+// pack the dirty inodes into inode blocks, first fit in transaction order,
+// starting with the block earlier transactions left open
+static int txn_pack_inodes(struct log_txn* txn) {
+    struct lfs_data* data = txn->data;
+    struct segsum_entry* entry;
+    struct inode* file;
+    struct inode_map* imap;
+    size_t record_size;
+    int record_slots, inumber, slot;
+    if(txn->inode_count == 0) {
+        return 0;
+    }
+
+    if(data->inode_block_offset != (off_t) -1) {
+        entry = get_segsum_entry(data, data->inode_block_offset);
+        if(entry->file_owner != SEGSUM_INODES) {
+            // its last record died, a freed block takes no more
+            data->inode_block_offset = (off_t) -1;
+        } else {
+            txn->inode_block_offset = data->inode_block_offset;
+            txn->inode_block_mask = entry->file_offset;
+            txn->inode_block_slots = data->inode_block_slots;
+        }
+    }
+    for(int i = 0; i < txn->inode_count; i++) {
+        file = txn->inodes[i];
+        inumber = (int) file->statbuf.st_ino;
+        record_size = INODE_RECORD_SIZE(file);
+        record_slots = (record_size + INODE_SLOT_SIZE - 1) / INODE_SLOT_SIZE;
+        if(data->inode_block_offset == (off_t) -1
+                || data->inode_block_slots + record_slots
+                        > INODE_SLOTS_PER_BLOCK) {
+            if(data->inode_block_offset != (off_t) -1
+                    && txn_write_inode_block(txn) == -1) {
+                return -1;
+            }
+
+            if(txn_open_inode_block(txn) == -1) {
+                return -1;
+            }
+        }
+
+        imap = txn_get_imap(txn, INODE_TO_IMAP(inumber));
+        if(imap == NULL || txn_release(txn, file->offset) == -1) {
+            return -1;
+        }
+
+        slot = data->inode_block_slots;
+        file->offset = data->inode_block_offset + slot * INODE_SLOT_SIZE;
+        memcpy(data->inode_block + slot * INODE_SLOT_SIZE, file, record_size);
+        imap->inode_blocks[INODE_TO_IMAP_INDEX(inumber)] = file->offset;
+        get_segsum_entry(data, file->offset)->file_offset |= (off_t) 1 << slot;
+        data->segsum_dirty[file->offset / data->segment_size] = true;
+        data->inode_block_slots += record_slots;
+    }
+
+    return txn_write_inode_block(txn);
+}
+
+// write dirty inodes, then their imaps, then append everything to the log and
+// update the checkpoint region once
+int txn_commit(struct log_txn* txn, bool allow_clean) {
+    struct lfs_data* data = txn->data;
+    struct inode_map* imap;
+    off_t old_offset;
+    if(txn_pack_inodes(txn) == -1) {
+        txn_abort(txn);
+
+        return -1;
+    }
+
+    for(int i = 0; i < txn->imap_count; i++) {
+        imap = txn->imaps[i];
+        old_offset = imap->offset;
+        imap->offset = txn->heads[LOG_HEAD_META];
+        if(txn_append(txn, imap, BLOCK_SIZE, SEGSUM_METADATA,
+                      txn->imap_numbers[i], old_offset) == -1) {
+            txn_abort(txn);
+
+            return -1;
+        }
+
+        txn->sblock->inode_map_blocks[txn->imap_numbers[i]] = imap->offset;
+    }
+
+    if(txn->block_count > 0 && log_append(txn) == -1) {
+        txn_abort(txn);
+
+        return -1;
+    }
+
+    clear_segsum_entries(data, txn->stale_offsets, txn->stale_count);
+    if(txn->block_count > 0 || txn->stale_count > 0) {
+        data->log_generation++;
+    }
+    txn_free(txn);
+    if(allow_clean && data->clean_segments
+            < clean_threshold(data, &(data->clean_config.start))) {
+        clean(data);
+    } else if(checkpoint_due(data)) {
+        sync_checkpoint(data);
+    }
+
+    return 0;
+}
+
+// give back the blocks reserved by txn, point the superblock back at the old
+// imaps, reload its inodes as the log still has them and release its buffers
+// without writing anything
+void txn_abort(struct log_txn* txn) {
+    struct lfs_data* data = txn->data;
+    struct segment_summary* segsum;
+    struct segsum_entry* entry;
+    for(int i = 0; i < txn->imap_count; i++) {
+        txn->sblock->inode_map_blocks[txn->imap_numbers[i]] =
+                txn->imap_offsets[i];
+    }
+    for(int i = 0; i < txn->inode_count; i++) {
+        txn->inodes[i]->offset = txn->inode_offsets[i];
+        // a new inode has nothing to go back to, its caller drops it
+        if(txn->inode_offsets[i] != (off_t) -1
+                && get_inode(data, (int) txn->inodes[i]->statbuf.st_ino,
+                             txn->sblock, txn->inodes[i]) == NULL) {
+            fprintf(stderr, "transaction: can't reload inode %d\n",
+                    (int) txn->inodes[i]->statbuf.st_ino);
+        }
+    }
+    // the open inode block gets back the slots the transaction took, a block
+    // it opened is given back with its other blocks
+    if(txn->inode_block_offset != (off_t) -1) {
+        get_segsum_entry(data, txn->inode_block_offset)->file_offset =
+                txn->inode_block_mask;
+        if(data->inode_block_offset == txn->inode_block_offset) {
+            data->inode_block_slots = txn->inode_block_slots;
+            memset(data->inode_block + txn->inode_block_slots * INODE_SLOT_SIZE,
+                   0, BLOCK_SIZE - txn->inode_block_slots * INODE_SLOT_SIZE);
+        }
+    }
+    if(txn->inode_block_index != -1) {
+        data->inode_block_offset = (off_t) -1;
+    }
+    for(int i = 0; i < txn->block_count; i++) {
+        segsum = get_segsum(data, txn->offsets[i]);
+        entry = get_segsum_entry(data, txn->offsets[i]);
+        entry->file_owner = 0;
+        entry->file_offset = 0;
+        segsum->live_bytes -= BLOCK_SIZE;
+        if(segsum->live_bytes == 0) {
+            data->clean_segments++;
+        }
+        if(txn->unpunched[i]) {
+            data->punch_pending[txn->offsets[i] / data->segment_size] = true;
+        }
+    }
+    txn_free(txn);
+}
+
+static void txn_free(struct log_txn* txn) {
+    for(int i = 0; i < txn->imap_count; i++) {
+        free(txn->imaps[i]);
+    }
+    free(txn->buffer);
+    free(txn->entries);
+    free(txn->offsets);
+    free(txn->sources);
+    free(txn->unpunched);
+    free(txn->stale_offsets);
+    free(txn->inodes);
+    free(txn->inode_offsets);
+    free(txn->imaps);
+    free(txn->imap_numbers);
+    free(txn->imap_offsets);
+    memset(txn, 0, sizeof(struct log_txn));
+}
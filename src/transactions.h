@@ -0,0 +1,72 @@
+#ifndef _TRANSACTIONS_H_
+#define _TRANSACTIONS_H_
+
+#include "380LFS.h"
+#include "segments.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TXN_INITIAL_BLOCKS 16
+#define TXN_INITIAL_INODES 4
+
+// collects every block an operation writes so it can be appended to the log
+// with a single log_append and a single checkpoint update
+struct log_txn {
+    struct lfs_data* data;
+    struct superblock* sblock;
+    // offset each log head writes its next block to
+    off_t heads[LOG_HEAD_COUNT];
+    // head for data blocks, -1 to choose by block age
+    int data_head;
+    // use free blocks in dirty segments once no clean segment is left
+    bool allow_threading;
+    struct timespec start_time;
+    char* buffer;
+    struct segsum_entry* entries;
+    // log offset of each block in buffer
+    off_t* offsets;
+    // log offset a block is copied from, -1 if its contents are in buffer
+    off_t* sources;
+    // whether reserving a block took its segment off the punch list
+    bool* unpunched;
+    int block_count;
+    int block_capacity;
+    // offsets made stale by this transaction, cleared after the append
+    off_t* stale_offsets;
+    int stale_count;
+    int stale_capacity;
+    // dirty inodes are packed into inode blocks at commit, after all data
+    struct inode** inodes;
+    // offset each dirty inode had before commit, restored on abort
+    off_t* inode_offsets;
+    int inode_count;
+    int inode_capacity;
+    // open inode block the commit found, -1 if none, with the slot mask and
+    // slot count it had, restored on abort
+    off_t inode_block_offset;
+    off_t inode_block_mask;
+    int inode_block_slots;
+    // index of the inode block this transaction opened, -1 if none
+    int inode_block_index;
+    // imaps loaded by this transaction, written once at commit
+    struct inode_map** imaps;
+    int* imap_numbers;
+    // superblock entry of each imap before commit, restored on abort
+    off_t* imap_offsets;
+    int imap_count;
+    int imap_capacity;
+};
+
+int txn_begin(struct log_txn*, struct lfs_data*, struct superblock*);
+off_t txn_append(struct log_txn*, const void*, size_t, int, off_t, off_t);
+off_t txn_append_copy(struct log_txn*, off_t, int, off_t, off_t);
+int txn_release(struct log_txn*, off_t);
+int txn_dirty_inode(struct log_txn*, struct inode*);
+void txn_set_data_head(struct log_txn*, struct inode*);
+struct inode_map* txn_get_imap(struct log_txn*, int);
+struct inode_map* txn_load_imap(struct log_txn*, int, const struct inode_map*);
+int txn_commit(struct log_txn*, bool);
+void txn_abort(struct log_txn*);
+
+#endif
@@ -0,0 +1,72 @@
+// transactions whose log append fails
+#include "test.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// a write whose append fails leaves the inode where the log still has it, so
+// the next commit releases the right slot
+void test_failed_append(struct lfs_data* fs) {
+    char buf[100], read_buf[100];
+    struct open_file* file;
+    memset(buf, 'a', sizeof(buf));
+    CHECK(lfs_create(fs, "/file", S_IFREG | 0644, &file) == 0);
+    CHECK(lfs_write(fs, file, buf, sizeof(buf), 0) == (int) sizeof(buf));
+    off_t offset = file->file_inode.offset;
+    // every log write fails through a read-only descriptor
+    int log_fd = fs->fd;
+    fs->fd = open(SCRATCH_LOG, O_RDONLY);
+    CHECK(fs->fd != -1);
+    memset(buf, 'b', sizeof(buf));
+    CHECK(lfs_write(fs, file, buf, sizeof(buf), 0) < 0);
+    CHECK(file->file_inode.offset == offset);
+    close(fs->fd);
+    fs->fd = log_fd;
+    memset(buf, 'c', sizeof(buf));
+    CHECK(lfs_write(fs, file, buf, sizeof(buf), 0) == (int) sizeof(buf));
+    CHECK(file->file_inode.offset != offset);
+    CHECK(lfs_read(fs, file, read_buf, sizeof(read_buf), 0)
+          == (int) sizeof(read_buf));
+    CHECK(memcmp(read_buf, buf, sizeof(buf)) == 0);
+    lfs_release(fs, file);
+    CHECK(lfs_unlink(fs, "/file") == 0);
+}
+
+// a write that would move an inline file into blocks leaves the handle with
+// the size and contents it had before
+void test_failed_grow(struct lfs_data* fs) {
+    char buf[3 * BLOCK_SIZE], read_buf[100];
+    struct open_file* file;
+    memset(buf, 'a', sizeof(read_buf));
+    CHECK(lfs_create(fs, "/grow", S_IFREG | 0644, &file) == 0);
+    CHECK(lfs_write(fs, file, buf, sizeof(read_buf), 0)
+          == (int) sizeof(read_buf));
+    struct stat statbuf = file->file_inode.statbuf;
+    int log_fd = fs->fd;
+    fs->fd = open(SCRATCH_LOG, O_RDONLY);
+    CHECK(fs->fd != -1);
+    memset(buf, 'b', sizeof(buf));
+    CHECK(lfs_write(fs, file, buf, sizeof(buf), 0) < 0);
+    close(fs->fd);
+    fs->fd = log_fd;
+    CHECK(file->file_inode.statbuf.st_size == statbuf.st_size);
+    CHECK(file->file_inode.statbuf.st_blocks == statbuf.st_blocks);
+    CHECK(INODE_IS_INLINE(&file->file_inode));
+    CHECK(lfs_read(fs, file, read_buf, sizeof(read_buf), 0)
+          == (int) sizeof(read_buf));
+    CHECK(read_buf[0] == 'a' && read_buf[sizeof(read_buf) - 1] == 'a');
+    lfs_release(fs, file);
+    CHECK(lfs_unlink(fs, "/grow") == 0);
+}
+
+int main(int argc, char* argv[]) {
+    struct lfs_data* fs = open_scratch_log();
+    if(fs != NULL) {
+        test_failed_append(fs);
+        test_failed_grow(fs);
+        lfs_close_log(fs);
+    }
+
+    return finish_tests("abort");
+}
@@ -0,0 +1,131 @@
+// recovery from the two checkpoint regions
+#include "test.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// create an empty file, and make it durable if sync is set
+int create_file(struct lfs_data* fs, const char* name, bool sync) {
+    struct open_file* file;
+    if(lfs_create(fs, name, S_IFREG | 0644, &file) != 0) {
+        return -1;
+    }
+
+    int status = sync ? lfs_fsync(fs, file, 0) : 0;
+    lfs_release(fs, file);
+
+    return status;
+}
+
+// zero the commit record of the region checkpointed last, as if the log went
+// down while that checkpoint was written
+void tear_last_checkpoint(off_t commit_offset) {
+    struct checkpoint_commit commit;
+    memset(&commit, 0, sizeof(commit));
+    int fd = open(SCRATCH_LOG, O_WRONLY);
+    CHECK(fd != -1);
+    CHECK(pwrite(fd, &commit, sizeof(commit), commit_offset)
+          == (ssize_t) sizeof(commit));
+    close(fd);
+}
+
+// a torn checkpoint falls back to the one before it, and a log with no
+// committed region doesn't mount
+void test_torn_checkpoint() {
+    struct stat statbuf;
+    struct lfs_data* fs = open_scratch_log();
+    if(fs == NULL) {
+        return;
+    }
+
+    CHECK(create_file(fs, "/before", true) == 0);
+    CHECK(create_file(fs, "/after", false) == 0);
+    // closing checkpoints into this region, the one before is in the other
+    int region = fs->checkpoint_region;
+    off_t region_size = CHECKPOINT_REGION_SIZE(fs);
+    off_t torn = region * region_size + region_size - BLOCK_SIZE;
+    off_t older = (1 - region) * region_size + region_size - BLOCK_SIZE;
+    lfs_close_log(fs);
+
+    tear_last_checkpoint(torn);
+    fs = lfs_open_log(SCRATCH_LOG, 0);
+    CHECK(fs != NULL);
+    if(fs == NULL) {
+        return;
+    }
+
+    CHECK(lfs_getattr(fs, "/before", &statbuf) == 0);
+    CHECK(lfs_getattr(fs, "/after", &statbuf) == -ENOENT);
+    // the fallback is whole enough to keep using
+    CHECK(create_file(fs, "/again", false) == 0);
+    CHECK(lfs_unlink(fs, "/before") == 0);
+    lfs_close_log(fs);
+
+    fs = lfs_open_log(SCRATCH_LOG, 0);
+    CHECK(fs != NULL);
+    if(fs == NULL) {
+        return;
+    }
+
+    CHECK(lfs_getattr(fs, "/again", &statbuf) == 0);
+    CHECK(lfs_getattr(fs, "/before", &statbuf) == -ENOENT);
+    lfs_close_log(fs);
+
+    tear_last_checkpoint(torn);
+    tear_last_checkpoint(older);
+    fs = lfs_open_log(SCRATCH_LOG, 0);
+    CHECK(fs == NULL);
+}
+
+// an fsync with nothing appended since the last checkpoint writes nothing
+void test_fsync_coalesces() {
+    struct open_file* file;
+    struct lfs_data* fs = open_scratch_log();
+    if(fs == NULL) {
+        return;
+    }
+
+    CHECK(lfs_create(fs, "/file", S_IFREG | 0644, &file) == 0);
+    uint64_t checkpoints = fs->stats.checkpoints;
+    CHECK(lfs_fsync(fs, file, 0) == 0);
+    CHECK(fs->stats.checkpoints == checkpoints + 1);
+    CHECK(lfs_fsync(fs, file, 0) == 0);
+    CHECK(lfs_fsync(fs, file, 1) == 0);
+    CHECK(fs->stats.checkpoints == checkpoints + 1);
+    CHECK(lfs_write(fs, file, "x", 1, 0) == 1);
+    CHECK(lfs_fsync(fs, file, 0) == 0);
+    CHECK(fs->stats.checkpoints == checkpoints + 2);
+    lfs_release(fs, file);
+    lfs_close_log(fs);
+}
+
+// a log whose checkpoint header has another format, or none, doesn't mount
+void test_format_version() {
+    struct lfs_data* fs = open_scratch_log();
+    if(fs == NULL) {
+        return;
+    }
+
+    lfs_close_log(fs);
+    int fd = open(SCRATCH_LOG, O_RDWR);
+    CHECK(fd != -1);
+    int version = CHECKPOINT_VERSION - 1;
+    CHECK(pwrite(fd, &version, sizeof(int), BLOCK_SIZE + sizeof(int))
+          == sizeof(int));
+    CHECK(lfs_open_log(SCRATCH_LOG, 0) == NULL);
+    // logs from before the format was versioned start with the log heads
+    off_t head = BLOCK_SIZE;
+    CHECK(pwrite(fd, &head, sizeof(off_t), BLOCK_SIZE) == sizeof(off_t));
+    CHECK(lfs_open_log(SCRATCH_LOG, 0) == NULL);
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    test_torn_checkpoint();
+    test_fsync_coalesces();
+    test_format_version();
+
+    return finish_tests("checkpoint");
+}
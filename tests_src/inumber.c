@@ -0,0 +1,79 @@
+// reuse of unlinked files' inumbers
+#include "test.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#define CHURN_FILES 50
+#define CHURN_ROUNDS 20
+
+// create a file and return its inumber, -1 if it couldn't be created
+int create_file(struct lfs_data* fs, const char* name) {
+    struct open_file* file;
+    if(lfs_create(fs, name, S_IFREG | 0644, &file) != 0) {
+        return -1;
+    }
+
+    int inumber = (int) file->file_inode.statbuf.st_ino;
+    lfs_release(fs, file);
+
+    return inumber;
+}
+
+// a file created after another is unlinked gets its inumber, and recreating
+// the same set of files over and over doesn't use any new ones
+void test_reuse(struct lfs_data* fs) {
+    char name[MAX_FILENAME];
+    int inumber = create_file(fs, "/first");
+    CHECK(inumber > ROOT_INUMBER);
+    CHECK(lfs_unlink(fs, "/first") == 0);
+    CHECK(create_file(fs, "/second") == inumber);
+    CHECK(lfs_unlink(fs, "/second") == 0);
+
+    int max_inumber = -1;
+    for(int round = 0; round < CHURN_ROUNDS; round++) {
+        for(int i = 0; i < CHURN_FILES; i++) {
+            snprintf(name, sizeof(name), "/churn%d", i);
+            CHECK(create_file(fs, name) > ROOT_INUMBER);
+        }
+        if(round == 0) {
+            max_inumber = fs->max_inumber;
+            CHECK(max_inumber <= CHURN_FILES + ROOT_INUMBER);
+        }
+        CHECK(fs->max_inumber == max_inumber);
+        for(int i = 0; i < CHURN_FILES; i++) {
+            snprintf(name, sizeof(name), "/churn%d", i);
+            CHECK(lfs_unlink(fs, name) == 0);
+        }
+    }
+}
+
+// a handle to an unlinked file doesn't reach the file that got its inumber
+void test_stale_handle(struct lfs_data* fs) {
+    char buf[10];
+    struct open_file* old_file;
+    struct open_file* new_file;
+    CHECK(lfs_create(fs, "/old", S_IFREG | 0644, &old_file) == 0);
+    CHECK(lfs_unlink(fs, "/old") == 0);
+    CHECK(lfs_create(fs, "/new", S_IFREG | 0644, &new_file) == 0);
+    CHECK(new_file->file_inode.statbuf.st_ino
+          == old_file->file_inode.statbuf.st_ino);
+    CHECK(lfs_write(fs, old_file, "old", 3, 0) == -ESTALE);
+    CHECK(lfs_read(fs, old_file, buf, sizeof(buf), 0) == -ESTALE);
+    CHECK(lfs_write(fs, new_file, "new", 3, 0) == 3);
+    CHECK(lfs_read(fs, new_file, buf, sizeof(buf), 0) == 3);
+    lfs_release(fs, old_file);
+    lfs_release(fs, new_file);
+    CHECK(lfs_unlink(fs, "/new") == 0);
+}
+
+int main(int argc, char* argv[]) {
+    struct lfs_data* fs = open_scratch_log();
+    if(fs != NULL) {
+        test_reuse(fs);
+        test_stale_handle(fs);
+        lfs_close_log(fs);
+    }
+
+    return finish_tests("inumber");
+}
@@ -0,0 +1,55 @@
+// inodes written by separate transactions sharing inode blocks
+#include "test.h"
+
+#include <stdio.h>
+#include <utime.h>
+
+#define PACKED_FILES 160
+
+// a utime per file fills inode blocks instead of taking one each, and every
+// record packed that way is still there after a remount
+void test_utime_packing() {
+    char name[MAX_FILENAME];
+    struct open_file* file;
+    struct stat statbuf;
+    struct utimbuf times;
+    struct lfs_data* fs = open_scratch_log();
+    if(fs == NULL) {
+        return;
+    }
+
+    for(int i = 0; i < PACKED_FILES; i++) {
+        snprintf(name, sizeof(name), "/file%d", i);
+        CHECK(lfs_create(fs, name, S_IFREG | 0644, &file) == 0);
+        lfs_release(fs, file);
+    }
+    uint64_t inode_blocks = fs->stats.inode_blocks;
+    for(int i = 0; i < PACKED_FILES; i++) {
+        snprintf(name, sizeof(name), "/file%d", i);
+        times.actime = i;
+        times.modtime = i;
+        CHECK(lfs_utime(fs, name, &times) == 0);
+    }
+    CHECK(fs->stats.inode_blocks - inode_blocks
+          <= PACKED_FILES / INODE_SLOTS_PER_BLOCK + 1);
+    lfs_close_log(fs);
+
+    fs = lfs_open_log(SCRATCH_LOG, 0);
+    CHECK(fs != NULL);
+    if(fs == NULL) {
+        return;
+    }
+
+    for(int i = 0; i < PACKED_FILES; i++) {
+        snprintf(name, sizeof(name), "/file%d", i);
+        CHECK(lfs_getattr(fs, name, &statbuf) == 0
+              && statbuf.st_mtime == i);
+    }
+    lfs_close_log(fs);
+}
+
+int main(int argc, char* argv[]) {
+    test_utime_packing();
+
+    return finish_tests("packing");
+}
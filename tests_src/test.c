@@ -0,0 +1,25 @@
+#include "test.h"
+
+#include <unistd.h>
+
+int failures = 0;
+
+// a new, empty scratch log
+struct lfs_data* open_scratch_log() {
+    unlink(SCRATCH_LOG);
+    struct lfs_data* fs = lfs_open_log(SCRATCH_LOG, (off_t) GB / 8);
+    if(fs == NULL) {
+        fprintf(stderr, "unable to create %s\n", SCRATCH_LOG);
+        failures++;
+    }
+
+    return fs;
+}
+
+// remove the scratch log and report, the result is the exit status
+int finish_tests(const char* name) {
+    unlink(SCRATCH_LOG);
+    printf("%s: %s\n", name, failures == 0 ? "passed" : "FAILED");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include "../src/lfs.h"
+
+#include <stdio.h>
+
+// each test program runs in-process against the library on this log file,
+// and exits 0 if every check passed
+#define SCRATCH_LOG "scratch_test.log"
+
+#define CHECK(condition) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                #condition); \
+        failures++; \
+    } \
+} while(0)
+
+extern int failures;
+
+struct lfs_data* open_scratch_log();
+int finish_tests(const char*);
+
+#endif
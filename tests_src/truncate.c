@@ -0,0 +1,58 @@
+// truncate shrinking inline and block files
+#include "test.h"
+
+#include <string.h>
+
+// an inline file shrunk by truncate stays inline and keeps its first bytes
+void test_shrink_inline(struct lfs_data* fs) {
+    char buf[1000], read_buf[1000];
+    struct open_file* file;
+    struct stat statbuf;
+    memset(buf, 'x', sizeof(buf));
+    CHECK(lfs_create(fs, "/inline", S_IFREG | 0644, &file) == 0);
+    CHECK(lfs_write(fs, file, buf, 1000, 0) == 1000);
+    CHECK(lfs_truncate(fs, "/inline", 500) == 0);
+    CHECK(lfs_getattr(fs, "/inline", &statbuf) == 0);
+    CHECK(statbuf.st_size == 500 && statbuf.st_blocks == 0);
+    memset(read_buf, 0, sizeof(read_buf));
+    CHECK(lfs_read(fs, file, read_buf, 1000, 0) == 500);
+    CHECK(memcmp(read_buf, buf, 500) == 0);
+    // growing it again must not bring the cut bytes back
+    CHECK(lfs_truncate(fs, "/inline", 1000) == 0);
+    CHECK(lfs_read(fs, file, read_buf, 1000, 0) == 1000);
+    CHECK(memcmp(read_buf, buf, 500) == 0);
+    for(int i = 500; i < 1000; i++) {
+        CHECK(read_buf[i] == 0);
+    }
+    lfs_release(fs, file);
+    CHECK(lfs_unlink(fs, "/inline") == 0);
+}
+
+// a file with data blocks shrunk by truncate keeps the blocks it still needs
+void test_shrink_blocks(struct lfs_data* fs) {
+    char buf[3 * BLOCK_SIZE], read_buf[3 * BLOCK_SIZE];
+    struct open_file* file;
+    struct stat statbuf;
+    memset(buf, 'y', sizeof(buf));
+    CHECK(lfs_create(fs, "/blocks", S_IFREG | 0644, &file) == 0);
+    CHECK(lfs_write(fs, file, buf, sizeof(buf), 0) == (int) sizeof(buf));
+    CHECK(lfs_truncate(fs, "/blocks", BLOCK_SIZE + 10) == 0);
+    CHECK(lfs_getattr(fs, "/blocks", &statbuf) == 0);
+    CHECK(statbuf.st_size == BLOCK_SIZE + 10 && statbuf.st_blocks == 2);
+    CHECK(lfs_read(fs, file, read_buf, sizeof(read_buf), 0)
+          == BLOCK_SIZE + 10);
+    CHECK(memcmp(read_buf, buf, BLOCK_SIZE + 10) == 0);
+    lfs_release(fs, file);
+    CHECK(lfs_unlink(fs, "/blocks") == 0);
+}
+
+int main(int argc, char* argv[]) {
+    struct lfs_data* fs = open_scratch_log();
+    if(fs != NULL) {
+        test_shrink_inline(fs);
+        test_shrink_blocks(fs);
+        lfs_close_log(fs);
+    }
+
+    return finish_tests("truncate");
+}
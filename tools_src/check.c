@@ -0,0 +1,633 @@
+// offline consistency checker: walks the checkpoint, imaps, inodes and block
+// maps of an unmounted log and checks them against the segment summaries
+#include "tools.h"
+
+#include <stdarg.h>
+#include <getopt.h>
+#include <pthread.h>
+
+// inodes a thread takes from the shared counter at a time
+#define INODE_CHUNK 64
+#define UTILIZATION_BUCKETS 10
+
+// problems found, each kind is counted separately
+#define PROBLEM_BAD_POINTER 0
+#define PROBLEM_BAD_METADATA 1
+#define PROBLEM_WRONG_OWNER 2
+#define PROBLEM_MARKED_CLEAN 3
+#define PROBLEM_DOUBLE_OWNED 4
+#define PROBLEM_LEAKED 5
+#define PROBLEM_LIVE_BYTES 6
+#define PROBLEM_COUNTS 7
+#define PROBLEM_DANGLING 8
+#define PROBLEM_ORPHAN 9
+#define PROBLEM_KINDS 10
+
+const char* problem_names[PROBLEM_KINDS] = {
+    "pointers outside the log",
+    "unreadable or mismatched metadata",
+    "blocks with another owner in their summary",
+    "referenced blocks marked clean",
+    "blocks referenced more than once",
+    "leaked blocks",
+    "segments with wrong live bytes",
+    "wrong checkpoint counts",
+    "directory entries of free inodes",
+    "inodes without a directory entry"
+};
+
+struct check_config {
+    const char* log_name;
+    int threads;
+    // most fragmented files listed, all of them with list_all
+    int top_files;
+    bool list_all;
+    // problems printed, the rest are only counted
+    int max_reports;
+};
+
+struct file_info {
+    // data blocks, -1 for a free inumber
+    int blocks;
+    // runs of contiguous data blocks
+    int runs;
+    // name in the root directory, NULL if none
+    const char* name;
+};
+
+struct check_state {
+    struct check_config* config;
+    struct lfs_data* data;
+    // references to each block of the log, an inode block is referenced once
+    // per live slot
+    uint8_t* references;
+    struct file_info* files;
+    // next inumber for the inode walkers
+    int next_inumber;
+    uint64_t problems[PROBLEM_KINDS];
+    int reported;
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [OPTIONS] LOGFILE\n"
+        "    -t THREADS  inode walkers, default the number of CPUs\n"
+        "    -n COUNT    most fragmented files to list, default 10\n"
+        "    -a          list every file\n"
+        "    -e COUNT    problems to print, default 20, the rest are counted\n"
+        "exits 0 if the log is consistent, 1 if it isn't, 2 on errors\n",
+        name);
+}
+
+int parse_args(int argc, char* argv[], struct check_config* config) {
+    config->threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    config->top_files = 10;
+    config->list_all = false;
+    config->max_reports = 20;
+    int opt;
+    while((opt = getopt(argc, argv, "t:n:ae:h")) != -1) {
+        switch(opt) {
+        case 't':
+            config->threads = atoi(optarg);
+            break;
+        case 'n':
+            config->top_files = atoi(optarg);
+            break;
+        case 'a':
+            config->list_all = true;
+            break;
+        case 'e':
+            config->max_reports = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if(optind != argc - 1 || config->threads <= 0 || config->top_files < 0
+            || config->max_reports < 0) {
+        return -1;
+    }
+
+    config->log_name = argv[optind];
+
+    return 0;
+}
+
+void report(struct check_state* state, int kind, const char* format, ...) {
+    __atomic_fetch_add(&(state->problems[kind]), 1, __ATOMIC_RELAXED);
+    if(__atomic_fetch_add(&(state->reported), 1, __ATOMIC_RELAXED)
+            >= state->config->max_reports) {
+        return;
+    }
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    printf("problem: %s\n", message);
+}
+
+// whether offset can hold a block (or an inode slot) of the log proper
+bool valid_offset(struct lfs_data* data, off_t offset, int alignment) {
+    return offset % alignment == 0
+            && offset >= (off_t) data->prologue_segments * data->segment_size
+            && offset < (off_t) data->segment_count * data->segment_size;
+}
+
+// count a reference to the block at offset, whose summary entry should say
+// it is file_offset of owner (or hold a live inode slot); false if offset
+// isn't in the log at all
+bool reference_block(struct check_state* state, off_t offset, int owner,
+                     off_t file_offset, int inumber) {
+    struct lfs_data* data = state->data;
+    int alignment = owner == SEGSUM_INODES ? INODE_SLOT_SIZE : BLOCK_SIZE;
+    if(!valid_offset(data, offset, alignment)) {
+        report(state, PROBLEM_BAD_POINTER, "inode %d points to offset %ld",
+               inumber, (long) offset);
+
+        return false;
+    }
+
+    __atomic_fetch_add(&(state->references[offset / BLOCK_SIZE]), 1,
+                       __ATOMIC_RELAXED);
+    struct segsum_entry* entry = get_segsum_entry(data, offset);
+    if(entry->file_owner == 0) {
+        report(state, PROBLEM_MARKED_CLEAN,
+               "block %ld of inode %d is marked clean", (long) offset,
+               inumber);
+    } else if(owner == SEGSUM_INODES
+              ? entry->file_owner != SEGSUM_INODES
+                || !(entry->file_offset & ((off_t) 1 << INODE_SLOT(offset)))
+              : entry->file_owner != owner
+                || entry->file_offset != file_offset) {
+        report(state, PROBLEM_WRONG_OWNER,
+               "block %ld of inode %d (offset %ld) is listed as owner %d "
+               "offset %ld", (long) offset, inumber, (long) file_offset,
+               entry->file_owner, (long) entry->file_offset);
+    }
+
+    return true;
+}
+
+// the data blocks of a file, a run at a time
+void count_data_block(struct file_info* info, off_t offset, off_t* previous) {
+    if(*previous == -1 || offset != *previous + BLOCK_SIZE) {
+        info->runs++;
+    }
+    *previous = offset;
+    info->blocks++;
+}
+
+// reference every block of a file: data blocks, indirect blocks and the
+// double indirect block
+int check_blocks(struct check_state* state, int inumber, struct inode* file,
+                 struct file_info* info) {
+    struct lfs_data* data = state->data;
+    int owner = SEGSUM_OWNER(inumber);
+    int blocks = (int) file->statbuf.st_blocks;
+    off_t previous = -1;
+    off_t offset;
+    for(int block = 0; block < blocks && block < DIRECT_BLOCK_COUNT; block++) {
+        offset = file->direct_blocks[block];
+        if(reference_block(state, offset, owner, (off_t) block * BLOCK_SIZE,
+                           inumber)) {
+            count_data_block(info, offset, &previous);
+        }
+    }
+    if(blocks <= DIRECT_BLOCK_COUNT) {
+        return 0;
+    }
+
+    off_t double_indirect[OFFSETS_PER_BLOCK];
+    off_t indirect[OFFSETS_PER_BLOCK];
+    if(!reference_block(state, file->double_indirect_block, owner,
+                        SEGSUM_DOUBLE_INDIRECT, inumber)) {
+        return 0;
+    }
+
+    if(read_double_indirect(data, file, double_indirect) == NULL) {
+        return -1;
+    }
+
+    int last_indirect = DOUBLE_INDIRECT_INDEX(blocks - 1);
+    int block;
+    for(int i = 0; i <= last_indirect; i++) {
+        block = i * OFFSETS_PER_BLOCK + DIRECT_BLOCK_COUNT;
+        if(!reference_block(state, double_indirect[i], owner,
+                            (i + 1) * SEGSUM_INDIRECT, inumber)) {
+            continue;
+        }
+
+        if(read_indirect(data, double_indirect, block, indirect) == NULL) {
+            return -1;
+        }
+
+        for(int j = 0; j < OFFSETS_PER_BLOCK && block < blocks; j++, block++) {
+            offset = indirect[j];
+            if(reference_block(state, offset, owner,
+                               (off_t) block * BLOCK_SIZE, inumber)) {
+                count_data_block(info, offset, &previous);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// an inode and its blocks, as its imap locates it
+int check_inode(struct check_state* state, int inumber,
+                struct inode_map* imap, struct inode* file) {
+    struct file_info* info = &(state->files[inumber]);
+    off_t inode_offset = imap->inode_blocks[INODE_TO_IMAP_INDEX(inumber)];
+    if(inode_offset == (off_t) -1) {
+        info->blocks = -1;
+
+        return 0;
+    }
+
+    if(!reference_block(state, inode_offset, SEGSUM_INODES, 0, inumber)) {
+        return 0;
+    }
+
+    if(log_pread(state->data, file, sizeof(struct inode), inode_offset)
+            < (ssize_t) INODE_HEADER_SIZE) {
+        report(state, PROBLEM_BAD_METADATA, "inode %d can't be read",
+               inumber);
+
+        return 0;
+    }
+
+    if(file->statbuf.st_ino != (ino_t) inumber
+            || file->offset != inode_offset
+            || file->statbuf.st_blocks < 0
+            || file->statbuf.st_blocks > MAX_BLOCK_COUNT) {
+        report(state, PROBLEM_BAD_METADATA,
+               "inode %d at %ld says it is inode %ld at %ld with %ld blocks",
+               inumber, (long) inode_offset, (long) file->statbuf.st_ino,
+               (long) file->offset, (long) file->statbuf.st_blocks);
+
+        return 0;
+    }
+
+    return check_blocks(state, inumber, file, info);
+}
+
+// inode walker: checks chunks of inumbers until none are left
+void* check_inodes(void* arg) {
+    struct check_state* state = (struct check_state*) arg;
+    struct lfs_data* data = state->data;
+    struct inode_map imap;
+    struct inode file;
+    int imap_number = -1;
+    int first, inumber;
+    while((first = __atomic_fetch_add(&(state->next_inumber), INODE_CHUNK,
+                                      __ATOMIC_RELAXED))
+            <= data->max_inumber) {
+        for(inumber = first; inumber < first + INODE_CHUNK
+                && inumber <= data->max_inumber; inumber++) {
+            if(INODE_TO_IMAP(inumber) != imap_number) {
+                imap_number = INODE_TO_IMAP(inumber);
+                if(!valid_offset(data, data->sblock->inode_map_blocks[
+                                     imap_number], BLOCK_SIZE)
+                        || get_imap(data, inumber, data->sblock,
+                                    &imap) == NULL) {
+                    // already reported, its inodes can't be found
+                    memset(imap.inode_blocks, 0xff,
+                           sizeof(imap.inode_blocks));
+                }
+            }
+
+            if(check_inode(state, inumber, &imap, &file) == -1) {
+                fprintf(stderr, "failed to read the blocks of inode %d\n",
+                        inumber);
+
+                return (void*) -1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// imaps are referenced by the superblock
+void check_imaps(struct check_state* state) {
+    struct lfs_data* data = state->data;
+    struct inode_map imap;
+    off_t offset;
+    for(int i = 0; i <= INODE_TO_IMAP(data->max_inumber); i++) {
+        offset = data->sblock->inode_map_blocks[i];
+        if(!reference_block(state, offset, SEGSUM_METADATA, i, -1)) {
+            continue;
+        }
+
+        if(log_pread(data, &imap, BLOCK_SIZE, offset) < BLOCK_SIZE
+                || imap.offset != offset) {
+            report(state, PROBLEM_BAD_METADATA, "imap %d at %ld says it is "
+                   "at %ld", i, (long) offset, (long) imap.offset);
+        }
+    }
+}
+
+// name the files from the root directory's entries; returns the directory's
+// blocks, which the names point into
+struct dir_block* read_names(struct check_state* state) {
+    struct lfs_data* data = state->data;
+    struct inode root;
+    if(get_inode(data, ROOT_INUMBER, data->sblock, &root) == NULL) {
+        return NULL;
+    }
+
+    int dir_size = BLOCK_SIZE * (int) root.statbuf.st_blocks;
+    struct dir_block* dblocks = (struct dir_block*)
+            alloc_log_buffer(dir_size);
+    if(dblocks == NULL || read_blocks_all(data, &root, (char*) dblocks)
+            < dir_size) {
+        free(dblocks);
+
+        return NULL;
+    }
+
+    int entry_count = root.statbuf.st_size / sizeof(struct dir_entry);
+    struct dir_entry* entry;
+    // the first two entries are . and ..
+    for(int i = 2; i < entry_count; i++) {
+        entry = &(dblocks[0].entries[i]);
+        entry->name[MAX_FILENAME - 1] = '\0';
+        if(entry->inumber <= ROOT_INUMBER
+                || entry->inumber > data->max_inumber
+                || state->files[entry->inumber].blocks == -1) {
+            report(state, PROBLEM_DANGLING, "%s names free inode %d",
+                   entry->name, entry->inumber);
+        } else {
+            state->files[entry->inumber].name = entry->name;
+        }
+    }
+
+    return dblocks;
+}
+
+// compare the references found with every summary entry, and the live bytes
+// and checkpoint counts with the entries
+void check_segments(struct check_state* state) {
+    struct lfs_data* data = state->data;
+    struct segment_summary* segsum;
+    struct segsum_entry* entry;
+    int clean_segments = 0;
+    int live_blocks, expected;
+    off_t block_number;
+    for(int seg = data->prologue_segments; seg < data->segment_count; seg++) {
+        segsum = SEGSUM(data, seg);
+        live_blocks = 0;
+        for(int block = 0; block < BLOCKS_PER_SEGMENT(data); block++) {
+            entry = &(segsum->entries[block]);
+            block_number = (off_t) seg * BLOCKS_PER_SEGMENT(data) + block;
+            if(entry->file_owner == 0) {
+                continue;
+            }
+
+            live_blocks++;
+            expected = entry->file_owner == SEGSUM_INODES
+                    ? __builtin_popcountll(entry->file_offset) : 1;
+            if(state->references[block_number] == 0) {
+                report(state, PROBLEM_LEAKED, "block %ld is live for owner "
+                       "%d but nothing references it",
+                       (long) block_number * BLOCK_SIZE, entry->file_owner);
+            } else if(state->references[block_number] > expected) {
+                report(state, PROBLEM_DOUBLE_OWNED, "block %ld is "
+                       "referenced %d times", (long) block_number * BLOCK_SIZE,
+                       state->references[block_number]);
+            } else if(state->references[block_number] < expected) {
+                report(state, PROBLEM_LEAKED, "inode block %ld has %d live "
+                       "slots but %d references",
+                       (long) block_number * BLOCK_SIZE, expected,
+                       state->references[block_number]);
+            }
+        }
+        if(segsum->live_bytes != live_blocks * BLOCK_SIZE) {
+            report(state, PROBLEM_LIVE_BYTES, "segment %d has %d live bytes "
+                   "but %d live blocks", seg, segsum->live_bytes, live_blocks);
+        }
+        if(segsum->live_bytes == 0) {
+            clean_segments++;
+        }
+    }
+
+    if(clean_segments != data->clean_segments) {
+        report(state, PROBLEM_COUNTS, "checkpoint counts %d clean segments, "
+               "the summaries %d", data->clean_segments, clean_segments);
+    }
+    int live_files = 0;
+    for(int inumber = 0; inumber <= data->max_inumber; inumber++) {
+        if(state->files[inumber].blocks == -1) {
+            continue;
+        }
+
+        live_files++;
+        if(inumber != ROOT_INUMBER && state->files[inumber].name == NULL) {
+            report(state, PROBLEM_ORPHAN, "inode %d has no directory entry",
+                   inumber);
+        }
+    }
+    if(live_files != data->file_count) {
+        report(state, PROBLEM_COUNTS, "checkpoint counts %d files, the imaps "
+               "%d", data->file_count, live_files);
+    }
+}
+
+void print_utilization(struct lfs_data* data) {
+    int buckets[UTILIZATION_BUCKETS + 1];
+    memset(buckets, 0, sizeof(buckets));
+    int clean = 0;
+    int bucket;
+    for(int seg = data->prologue_segments; seg < data->segment_count; seg++) {
+        if(SEGSUM(data, seg)->live_bytes == 0) {
+            clean++;
+            continue;
+        }
+
+        bucket = (int) ((long) SEGSUM(data, seg)->live_bytes
+                        * UTILIZATION_BUCKETS / data->segment_size);
+        buckets[bucket]++;
+    }
+    // full segments go with the top bucket
+    buckets[UTILIZATION_BUCKETS - 1] += buckets[UTILIZATION_BUCKETS];
+
+    int segments = data->segment_count - data->prologue_segments;
+    printf("\nSegment utilization (%d segments)\n", segments);
+    printf("%-10s %10d %6.1f%%\n", "clean", clean, 100.0 * clean / segments);
+    char label[16];
+    for(int i = 0; i < UTILIZATION_BUCKETS; i++) {
+        snprintf(label, sizeof(label), "%d-%d%%", i * 100 / UTILIZATION_BUCKETS,
+                 (i + 1) * 100 / UTILIZATION_BUCKETS);
+        printf("%-10s %10d %6.1f%%\n", label, buckets[i],
+               100.0 * buckets[i] / segments);
+    }
+}
+
+struct ranked_file {
+    int inumber;
+    struct file_info* info;
+};
+
+// most runs first, then most blocks
+int compare_fragmentation(const void* entry1, const void* entry2) {
+    const struct ranked_file* file1 = (const struct ranked_file*) entry1;
+    const struct ranked_file* file2 = (const struct ranked_file*) entry2;
+    if(file1->info->runs != file2->info->runs) {
+        return file1->info->runs > file2->info->runs ? -1 : 1;
+    }
+
+    if(file1->info->blocks != file2->info->blocks) {
+        return file1->info->blocks > file2->info->blocks ? -1 : 1;
+    }
+
+    return file1->inumber < file2->inumber ? -1 : 1;
+}
+
+int print_fragmentation(struct check_state* state) {
+    struct lfs_data* data = state->data;
+    struct ranked_file* files = (struct ranked_file*)
+            malloc((data->max_inumber + 1) * sizeof(struct ranked_file));
+    if(files == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return -1;
+    }
+
+    int file_count = 0;
+    long blocks = 0;
+    long runs = 0;
+    int fragmented = 0;
+    for(int inumber = 0; inumber <= data->max_inumber; inumber++) {
+        if(state->files[inumber].blocks <= 0) {
+            continue;
+        }
+
+        files[file_count].inumber = inumber;
+        files[file_count].info = &(state->files[inumber]);
+        blocks += state->files[inumber].blocks;
+        runs += state->files[inumber].runs;
+        if(state->files[inumber].runs > 1) {
+            fragmented++;
+        }
+        file_count++;
+    }
+    qsort(files, file_count, sizeof(struct ranked_file),
+          compare_fragmentation);
+
+    printf("\nFragmentation\n");
+    printf("%-30s: %d\n", "Files with data blocks", file_count);
+    printf("%-30s: %d\n", "Files in more than one run", fragmented);
+    printf("%-30s: %f\n", "Runs per file",
+           file_count > 0 ? (double) runs / file_count : 0);
+    printf("%-30s: %f\n", "Blocks per run",
+           runs > 0 ? (double) blocks / runs : 0);
+    int listed = state->config->list_all ? file_count
+            : state->config->top_files;
+    if(listed > file_count) {
+        listed = file_count;
+    }
+    if(listed > 0) {
+        printf("%8s %10s %10s  %s\n", "inode", "blocks", "runs", "name");
+    }
+    for(int i = 0; i < listed; i++) {
+        printf("%8d %10d %10d  %s\n", files[i].inumber,
+               files[i].info->blocks, files[i].info->runs,
+               files[i].inumber == ROOT_INUMBER ? "(root directory)"
+               : files[i].info->name != NULL ? files[i].info->name
+               : "(no name)");
+    }
+    free(files);
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    struct check_config config;
+    if(parse_args(argc, argv, &config) == -1) {
+        usage(argv[0]);
+
+        return 2;
+    }
+
+    struct check_state state;
+    memset(&state, 0, sizeof(struct check_state));
+    state.config = &config;
+    state.data = open_log_readonly(config.log_name);
+    if(state.data == NULL) {
+        return 2;
+    }
+
+    struct lfs_data* data = state.data;
+    state.references = (uint8_t*) calloc(
+            (size_t) data->segment_count * BLOCKS_PER_SEGMENT(data), 1);
+    state.files = (struct file_info*)
+            calloc(data->max_inumber + 1, sizeof(struct file_info));
+    pthread_t* threads = (pthread_t*)
+            malloc(config.threads * sizeof(pthread_t));
+    if(state.references == NULL || state.files == NULL || threads == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return 2;
+    }
+
+    printf("%s: %d segments of %dK (%d in the prologue), %d files, "
+           "max inode %d\n", config.log_name, data->segment_count,
+           data->segment_size / 1024, data->prologue_segments,
+           data->file_count, data->max_inumber);
+
+    check_imaps(&state);
+    int started = 0;
+    void* result;
+    bool failed = false;
+    for(; started < config.threads; started++) {
+        if(pthread_create(&(threads[started]), NULL, check_inodes,
+                          &state) != 0) {
+            break;
+        }
+    }
+    if(started == 0) {
+        fprintf(stderr, "failed to start inode walkers\n");
+
+        return 2;
+    }
+
+    for(int i = 0; i < started; i++) {
+        pthread_join(threads[i], &result);
+        failed |= result != NULL;
+    }
+    if(failed) {
+        return 2;
+    }
+
+    struct dir_block* dblocks = read_names(&state);
+    if(dblocks == NULL) {
+        fprintf(stderr, "failed to read the root directory\n");
+
+        return 2;
+    }
+
+    check_segments(&state);
+    print_utilization(data);
+    if(print_fragmentation(&state) == -1) {
+        return 2;
+    }
+
+    uint64_t problems = 0;
+    printf("\nConsistency\n");
+    for(int kind = 0; kind < PROBLEM_KINDS; kind++) {
+        printf("%-45s: %lu\n", problem_names[kind],
+               (unsigned long) state.problems[kind]);
+        problems += state.problems[kind];
+    }
+    printf("%s: %s\n", config.log_name,
+           problems == 0 ? "consistent" : "INCONSISTENT");
+    free(dblocks);
+    free(threads);
+    free(state.files);
+    free(state.references);
+
+    return problems == 0 ? 0 : 1;
+}
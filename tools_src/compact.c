@@ -0,0 +1,476 @@
+// offline compaction: copies every file of an unmounted log into a new log of
+// the same size, each file's data blocks in one run, then replaces the old log
+#include "tools.h"
+#include "../src/transactions.h"
+
+#include <getopt.h>
+
+#define KB (1 << 10)
+#define MAX_PATH 4096
+#define COMPACT_SUFFIX ".compact"
+
+struct compact_config {
+    const char* log_name;
+    // log written, NULL to replace log_name with it
+    const char* output;
+    // file data copied per transaction
+    int chunk_blocks;
+    // segment size of the new log, 0 to keep that of log_name
+    int segment_size;
+    bool verbose;
+};
+
+struct layout {
+    int files;
+    long blocks;
+    long runs;
+};
+
+struct compact_state {
+    struct compact_config* config;
+    struct lfs_data* source;
+    struct lfs_data* dest;
+    off_t* offsets;
+    char* buffer;
+    struct layout before;
+    struct layout after;
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [OPTIONS] LOGFILE\n"
+        "    -o FILE   write the compacted log to FILE, LOGFILE is left as it "
+        "is\n"
+        "    -c BYTES  file data copied per transaction, default 16M\n"
+        "    -S BYTES  segment size of the compacted log, default that of "
+        "LOGFILE\n"
+        "    -v        list each file's runs before and after\n"
+        "sizes take a K, M or G suffix; the filesystem must not be mounted\n",
+        name);
+}
+
+long parse_size(const char* arg) {
+    char* end;
+    long size = strtol(arg, &end, 10);
+    if(*end == 'K' || *end == 'k') {
+        size *= KB;
+    } else if(*end == 'M' || *end == 'm') {
+        size *= KB * KB;
+    } else if(*end == 'G' || *end == 'g') {
+        size *= KB * KB * KB;
+    } else if(*end != '\0') {
+        return -1;
+    }
+
+    return size;
+}
+
+int parse_args(int argc, char* argv[], struct compact_config* config) {
+    config->output = NULL;
+    config->chunk_blocks = 16 * KB * KB / BLOCK_SIZE;
+    config->segment_size = 0;
+    config->verbose = false;
+    long size;
+    int opt;
+    while((opt = getopt(argc, argv, "o:c:S:vh")) != -1) {
+        switch(opt) {
+        case 'o':
+            config->output = optarg;
+            break;
+        case 'c':
+            size = parse_size(optarg);
+            if(size < BLOCK_SIZE || size > (long) GB) {
+                return -1;
+            }
+            config->chunk_blocks = (int) (size / BLOCK_SIZE);
+            break;
+        case 'S':
+            size = parse_size(optarg);
+            if(size < MIN_SEGMENT_SIZE || size > MAX_SEGMENT_SIZE) {
+                return -1;
+            }
+            config->segment_size = (int) size;
+            break;
+        case 'v':
+            config->verbose = true;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if(optind != argc - 1) {
+        return -1;
+    }
+
+    config->log_name = argv[optind];
+
+    return 0;
+}
+
+// runs of contiguous data blocks in a file, -1 if its block map can't be read
+long count_runs(struct compact_state* state, struct lfs_data* data,
+                struct inode* file) {
+    int blocks = (int) file->statbuf.st_blocks;
+    int count;
+    long runs = 0;
+    off_t previous = -1;
+    for(int start = 0; start < blocks; start += state->config->chunk_blocks) {
+        count = blocks - start < state->config->chunk_blocks
+                ? blocks - start : state->config->chunk_blocks;
+        if(get_block_offsets(data, start, start + count - 1, file,
+                             state->offsets) == -1) {
+            return -1;
+        }
+
+        for(int i = 0; i < count; i++) {
+            if(previous == -1 || state->offsets[i] != previous + BLOCK_SIZE) {
+                runs++;
+            }
+            previous = state->offsets[i];
+        }
+    }
+
+    return runs;
+}
+
+// start a transaction on the new log; the imap entries of the inumbers
+// skipped since the last file are marked free, so that inumbers are kept
+int begin_copy(struct compact_state* state, struct log_txn* txn,
+               struct superblock* sblock, int inumber) {
+    struct lfs_data* dest = state->dest;
+    if(get_superblock(dest, sblock) == NULL
+            || txn_begin(txn, dest, sblock) == -1) {
+        return -1;
+    }
+
+    // copies have outlived their writers, keep them apart from new data
+    txn->data_head = LOG_HEAD_COLD;
+    struct inode_map* imap;
+    for(int skipped = dest->max_inumber + 1; skipped < inumber; skipped++) {
+        imap = txn_get_imap(txn, INODE_TO_IMAP(skipped));
+        if(imap == NULL) {
+            txn_abort(txn);
+
+            return -1;
+        }
+
+        imap->inode_blocks[INODE_TO_IMAP_INDEX(skipped)] = (off_t) -1;
+    }
+
+    return 0;
+}
+
+// copy a file under the same inumber, a chunk of its data per transaction;
+// returns 1 if the source has no such inode
+int copy_file(struct compact_state* state, struct dir_entry* entry) {
+    struct lfs_data* source = state->source;
+    struct lfs_data* dest = state->dest;
+    int inumber = entry->inumber;
+    struct inode_map imap;
+    struct inode original;
+    if(inumber <= ROOT_INUMBER || inumber > source->max_inumber
+            || get_imap(source, inumber, source->sblock, &imap) == NULL
+            || imap.inode_blocks[INODE_TO_IMAP_INDEX(inumber)] == (off_t) -1
+            || inumber <= dest->max_inumber) {
+        return 1;
+    }
+
+    if(get_inode(source, inumber, source->sblock, &original) == NULL) {
+        return -1;
+    }
+
+    long runs = count_runs(state, source, &original);
+    if(runs == -1) {
+        return -1;
+    }
+
+    // inline data and attributes come along with the inode
+    struct inode file;
+    memcpy(&file, &original, sizeof(struct inode));
+    file.offset = (off_t) -1;
+    file.double_indirect_block = (off_t) -1;
+    if(!INODE_IS_INLINE(&original)) {
+        file.statbuf.st_size = 0;
+        file.statbuf.st_blocks = 0;
+    }
+
+    struct superblock sblock;
+    struct log_txn txn;
+    if(begin_copy(state, &txn, &sblock, inumber) == -1
+            || txn_dirty_inode(&txn, &file) == -1) {
+        return -1;
+    }
+
+    int blocks = (int) original.statbuf.st_blocks;
+    int count, end;
+    size_t size;
+    for(int start = 0; start < blocks; start += state->config->chunk_blocks) {
+        count = blocks - start < state->config->chunk_blocks
+                ? blocks - start : state->config->chunk_blocks;
+        end = start + count - 1;
+        size = (size_t) count * BLOCK_SIZE;
+        if((off_t) (end + 1) * BLOCK_SIZE > original.statbuf.st_size) {
+            size = original.statbuf.st_size - (off_t) start * BLOCK_SIZE;
+        }
+        if(start > 0 && (get_superblock(dest, &sblock) == NULL
+                         || txn_begin(&txn, dest, &sblock) == -1)) {
+            return -1;
+        }
+
+        txn.data_head = LOG_HEAD_COLD;
+        if(get_block_offsets(source, start, end, &original,
+                             state->offsets) == -1
+                || read_block_runs(source, state->offsets, count,
+                                   state->buffer) < count
+                || lfs_write_helper(&txn, &file, state->buffer, size,
+                                    (off_t) start * BLOCK_SIZE)
+                   < (int) size) {
+            txn_abort(&txn);
+
+            return -1;
+        }
+
+        // the first chunk creates the file
+        if(txn_commit(&txn, false) == -1) {
+            return -1;
+        }
+
+        if(start == 0) {
+            dest->file_count++;
+            use_inumber(dest, inumber);
+        }
+    }
+    if(blocks == 0) {
+        if(txn_commit(&txn, false) == -1) {
+            return -1;
+        }
+
+        dest->file_count++;
+        use_inumber(dest, inumber);
+    }
+
+    long new_runs = count_runs(state, dest, &file);
+    if(new_runs == -1) {
+        return -1;
+    }
+
+    if(state->config->verbose) {
+        printf("%-30s %8d %10d %10ld %10ld\n", entry->name, inumber, blocks,
+               runs, new_runs);
+    }
+    if(blocks > 0) {
+        state->before.files++;
+        state->before.blocks += blocks;
+        state->before.runs += runs;
+        state->after.files++;
+        state->after.blocks += blocks;
+        state->after.runs += new_runs;
+    }
+
+    return 0;
+}
+
+// lowest inumber first, so they can be kept
+int compare_entries(const void* entry1, const void* entry2) {
+    int inumber1 = ((const struct dir_entry*) entry1)->inumber;
+    int inumber2 = ((const struct dir_entry*) entry2)->inumber;
+
+    return inumber1 < inumber2 ? -1 : inumber1 > inumber2;
+}
+
+// copy the files named by the root directory, then write the directory with
+// the entries of the files copied, in their old order
+int copy_files(struct compact_state* state) {
+    struct lfs_data* source = state->source;
+    struct inode old_root;
+    if(get_inode(source, ROOT_INUMBER, source->sblock, &old_root) == NULL) {
+        return -1;
+    }
+
+    int dir_size = BLOCK_SIZE * (int) old_root.statbuf.st_blocks;
+    int entry_count = old_root.statbuf.st_size / sizeof(struct dir_entry);
+    struct dir_entry* entries = (struct dir_entry*) alloc_log_buffer(dir_size);
+    struct dir_entry* sorted = (struct dir_entry*)
+            malloc(entry_count * sizeof(struct dir_entry));
+    bool* copied = (bool*) calloc(source->max_inumber + 1, sizeof(bool));
+    if(entries == NULL || sorted == NULL || copied == NULL
+            || read_blocks_all(source, &old_root, (char*) entries)
+               < dir_size) {
+        fprintf(stderr, "failed to read the root directory\n");
+        free(entries);
+        free(sorted);
+        free(copied);
+
+        return -1;
+    }
+
+    memcpy(sorted, entries, entry_count * sizeof(struct dir_entry));
+    qsort(sorted, entry_count, sizeof(struct dir_entry), compare_entries);
+    int result;
+    for(int i = 0; i < entry_count; i++) {
+        if(sorted[i].inumber == ROOT_INUMBER) {
+            continue;
+        }
+
+        sorted[i].name[MAX_FILENAME - 1] = '\0';
+        result = copy_file(state, &(sorted[i]));
+        if(result == -1) {
+            fprintf(stderr, "failed to copy %s\n", sorted[i].name);
+            free(entries);
+            free(sorted);
+            free(copied);
+
+            return -1;
+        }
+
+        if(result == 1) {
+            fprintf(stderr, "skipping %s, inode %d is free or named twice\n",
+                    sorted[i].name, sorted[i].inumber);
+        } else {
+            copied[sorted[i].inumber] = true;
+        }
+    }
+    free(sorted);
+
+    // drop the entries that were skipped, keep the rest in place
+    int kept = 0;
+    int inumber;
+    for(int i = 0; i < entry_count; i++) {
+        inumber = entries[i].inumber;
+        if(inumber != ROOT_INUMBER) {
+            if(inumber < 0 || inumber > source->max_inumber
+                    || !copied[inumber]) {
+                continue;
+            }
+
+            // a second name for the same inode is dropped
+            copied[inumber] = false;
+        }
+
+        entries[kept++] = entries[i];
+    }
+    free(copied);
+
+    struct lfs_data* dest = state->dest;
+    struct superblock sblock;
+    struct inode root;
+    struct log_txn txn;
+    if(get_superblock(dest, &sblock) == NULL
+            || get_inode(dest, ROOT_INUMBER, &sblock, &root) == NULL
+            || txn_begin(&txn, dest, &sblock) == -1) {
+        free(entries);
+
+        return -1;
+    }
+
+    size_t size = kept * sizeof(struct dir_entry);
+    root.statbuf.st_mode = old_root.statbuf.st_mode;
+    root.statbuf.st_uid = old_root.statbuf.st_uid;
+    root.statbuf.st_gid = old_root.statbuf.st_gid;
+    root.statbuf.st_atim = old_root.statbuf.st_atim;
+    root.statbuf.st_mtim = old_root.statbuf.st_mtim;
+    root.statbuf.st_ctim = old_root.statbuf.st_ctim;
+    if(lfs_write_helper(&txn, &root, (char*) entries, size, 0) < (int) size
+            || txn_dirty_inode(&txn, &root) == -1) {
+        txn_abort(&txn);
+        free(entries);
+
+        return -1;
+    }
+    free(entries);
+
+    return txn_commit(&txn, false);
+}
+
+void print_layout(const char* label, struct layout* layout,
+                  int clean_segments) {
+    printf("%-7s %8d %12ld %10ld %14.1f %12d\n", label, layout->files,
+           layout->blocks, layout->runs,
+           layout->runs > 0 ? (double) layout->blocks / layout->runs : 0,
+           clean_segments);
+}
+
+int main(int argc, char* argv[]) {
+    struct compact_config config;
+    if(parse_args(argc, argv, &config) == -1) {
+        usage(argv[0]);
+
+        return 1;
+    }
+
+    char output[MAX_PATH];
+    snprintf(output, MAX_PATH, "%s", config.output != NULL ? config.output
+             : config.log_name);
+    if(config.output == NULL) {
+        strncat(output, COMPACT_SUFFIX, MAX_PATH - strlen(output) - 1);
+    }
+    if(access(output, F_OK) == 0) {
+        fprintf(stderr, "%s already exists\n", output);
+
+        return 1;
+    }
+
+    struct compact_state state;
+    memset(&state, 0, sizeof(struct compact_state));
+    state.config = &config;
+    state.source = open_log_readonly(config.log_name);
+    if(state.source == NULL) {
+        return 1;
+    }
+
+    state.dest = lfs_alloc(output, state.source->log_size);
+    if(state.dest != NULL) {
+        state.dest->segment_size = config.segment_size != 0
+                ? config.segment_size : state.source->segment_size;
+    }
+    state.offsets = (off_t*) malloc(config.chunk_blocks * sizeof(off_t));
+    state.buffer = (char*) alloc_log_buffer(
+            (size_t) config.chunk_blocks * BLOCK_SIZE);
+    if(state.dest == NULL || state.offsets == NULL || state.buffer == NULL) {
+        fprintf(stderr, "malloc failed\n");
+
+        return 1;
+    }
+
+    if(lfs_init(state.dest) == -1) {
+        unlink(output);
+
+        return 1;
+    }
+
+    // copied inodes keep their generations
+    state.dest->inode_generation = state.source->inode_generation;
+
+    if(config.verbose) {
+        printf("%-30s %8s %10s %10s %10s\n", "name", "inode", "blocks",
+               "runs", "new runs");
+    }
+    int clean_before = state.source->clean_segments;
+    if(copy_files(&state) == -1) {
+        fprintf(stderr, "compaction failed, %s is unchanged\n",
+                config.log_name);
+        lfs_close_log(state.dest);
+        unlink(output);
+
+        return 1;
+    }
+
+    int clean_after = state.dest->clean_segments;
+    lfs_close_log(state.dest);
+    if(config.output == NULL && rename(output, config.log_name) == -1) {
+        fprintf(stderr, "failed to replace %s with %s\n", config.log_name,
+                output);
+
+        return 1;
+    }
+
+    printf("%-7s %8s %12s %10s %14s %12s\n", "", "files", "data blocks",
+           "runs", "blocks per run", "clean segs");
+    print_layout("before", &(state.before), clean_before);
+    print_layout("after", &(state.after), clean_after);
+    free(state.offsets);
+    free(state.buffer);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include "tools.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// the log read only, with the checkpoint and segment summaries loaded the way
+// a mount loads them
+struct lfs_data* open_log_readonly(const char* log_name) {
+    struct lfs_data* data = lfs_alloc(log_name, 0);
+    if(data == NULL) {
+        return NULL;
+    }
+
+    struct stat statbuf;
+    data->fd = open(log_name, O_RDONLY);
+    if(data->fd == -1 || fstat(data->fd, &statbuf) == -1) {
+        fprintf(stderr, "unable to open log file %s\n", log_name);
+
+        return NULL;
+    }
+
+    data->log_size = statbuf.st_size;
+    if(data->log_size < (off_t) MIN_PROLOGUE_SIZE || init_data(data) == -1) {
+        fprintf(stderr, "unable to load the checkpoint of %s\n", log_name);
+
+        return NULL;
+    }
+
+    if((off_t) data->segment_count * data->segment_size > data->log_size
+            || data->prologue_segments >= data->segment_count
+            || data->max_inumber < 0 || data->max_inumber >= MAX_INUMBER) {
+        fprintf(stderr, "%s has a corrupt checkpoint header\n", log_name);
+
+        return NULL;
+    }
+
+    return data;
+}
@@ -0,0 +1,18 @@
+#ifndef _TOOLS_H_
+#define _TOOLS_H_
+
+#include "../src/380LFS.h"
+#include "../src/fs_ops.h"
+#include "../src/metadata_helpers.h"
+#include "../src/segments.h"
+#include "../src/log_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+struct lfs_data* open_log_readonly(const char*);
+
+#endif